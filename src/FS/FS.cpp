@@ -1,11 +1,49 @@
 #include <algorithm>
+#include <mutex>
 #include <string>
 #include <vector>
-#include <dirent.h>
 #include <physfs.h>
 #include <string.h>
 #include <stdio.h>
 #include "FS.hpp"
+#include "Hash.hpp"
+#include "ImageSize.hpp"
+
+// Where every name resolves to, and which of its sources PhysFS has mounted
+static FS::FileIndex fileIndex;
+static std::mutex mountMutex;
+static std::vector<char> mounted;
+
+// Each source is mounted on its own, a path through it only ever reaches
+// that directory or archive
+static std::string MountPoint(int source)
+{
+    return "sources/" + std::to_string(source);
+}
+
+// PhysFS path of the copy of a file the index picked, its source mounted
+// the first time, empty if there's no such file
+static std::string Resolve(const char *fileName)
+{
+    const FS::FileIndex::Entry *entry = fileIndex.Find(fileName);
+    if (entry == nullptr)
+        return std::string();
+
+    std::string mountPoint = MountPoint(entry->source);
+    std::lock_guard<std::mutex> lock(mountMutex);
+    if (!mounted[entry->source])
+    {
+        const char *path = fileIndex.GetSource(entry->source).path.c_str();
+        if (!PHYSFS_mount(path, mountPoint.c_str(), 1))
+        {
+            printf("Failed to mount %s\n", path);
+            return std::string();
+        }
+        mounted[entry->source] = 1;
+    }
+
+    return mountPoint + "/" + fileName;
+}
 
 int FS::Init()
 {
@@ -20,62 +58,45 @@ int FS::Init()
     return 0;
 }
 
-int FS::AddDir(const char *dirPath)
+int FS::AddDir(const char *dirPath, const char *indexFile)
 {
-    PHYSFS_mount(dirPath, "/", 1);
-
-    DIR *dir;
-    struct dirent *ent;
-    std::vector<std::string> zipFiles;
-
-    if ((dir = opendir(dirPath)) != NULL)
-    {
-        // Collect all ZIP file names
-        while ((ent = readdir(dir)) != NULL)
-        {
-            std::string fileName = ent->d_name;
-            if (fileName.size() > 4 && fileName.substr(fileName.size() - 4) == ".pk3")
-            {
-                zipFiles.push_back(fileName);
-            }
-        }
-        closedir(dir);
-
-        // Sort the filenames alphabetically
-        std::sort(zipFiles.begin(), zipFiles.end());
-
-        // Mount them in order
-        for (const std::string &zipFile : zipFiles)
-        {
-            std::string fullPath = std::string(dirPath) + "/" + zipFile;
-            PHYSFS_mount(fullPath.c_str(), "/", 1);
-        }
-    }
-    else
-    {
+    // the directory's loose files, then its pk3s alphabetically, each
+    // winning over the ones after it
+    if (!fileIndex.AddDir(dirPath, indexFile))
         return -1; // Failed to open directory
-    }
 
+    std::lock_guard<std::mutex> lock(mountMutex);
+    mounted.resize(fileIndex.SourceCount(), 0);
     return 0;
 }
 
 void FS::Close()
 {
     PHYSFS_deinit();
+
+    std::lock_guard<std::mutex> lock(mountMutex);
+    fileIndex.Clear();
+    mounted.clear();
+}
+
+const FS::FileIndex &FS::GetFileIndex()
+{
+    return fileIndex;
 }
 
 bool FS::Exists(const char *fileName)
 {
-    return PHYSFS_exists(fileName);
+    return fileIndex.Find(fileName) != nullptr;
 }
 
 FS::Binaryfile FS::LoadBinaryFile(const char *fileName)
 {
     Binaryfile file = { .buffer = nullptr, .size = 0 };
 
-    if (FS::Exists(fileName))
+    std::string path = Resolve(fileName);
+    PHYSFS_File *physFile = path.empty() ? nullptr : PHYSFS_openRead(path.c_str());
+    if (physFile != nullptr)
     {
-        PHYSFS_File *physFile = PHYSFS_openRead(fileName);
         PHYSFS_sint64 length = PHYSFS_fileLength(physFile);
         file.size = length;
         file.buffer = new unsigned char[length];
@@ -96,22 +117,41 @@ void FS::FreeBinaryFile(FS::Binaryfile &file)
 Image FS::LoadImage(const char *fileName)
 {
     Image image;
+    FS::DecodeImage(fileName, image);
+    return image;
+}
 
-    if (FS::Exists(fileName))
-    {
-        Binaryfile file = FS::LoadBinaryFile(fileName);
-        const char* fileType = GetFileExtension(fileName);
-        image = LoadImageFromMemory(fileType, file.buffer, file.size);
-        ImageMipmaps(&image);
-        FS::FreeBinaryFile(file);
-    }
+// Looked for in this order
+static const char *TEXTURE_EXTENSIONS[] = { ".tga", ".jpg", ".png" };
 
-    return image;
+std::string FS::FindTexture(const std::string &baseName)
+{
+    const FileIndex::Entry *entry =
+        fileIndex.FindFirst(baseName, TEXTURE_EXTENSIONS, sizeof(TEXTURE_EXTENSIONS) / sizeof(TEXTURE_EXTENSIONS[0]));
+    return entry != nullptr ? baseName + entry->extension : std::string();
+}
+
+bool FS::DecodeImage(const char *fileName, Image &image)
+{
+    image = Image{};
+
+    Binaryfile file = FS::LoadBinaryFile(fileName);
+    if (file.buffer == nullptr)
+        return false;
+
+    const char* fileType = GetFileExtension(fileName);
+    image = LoadImageFromMemory(fileType, file.buffer, file.size);
+    FS::FreeBinaryFile(file);
+    if (image.data == nullptr)
+        return false;
+
+    ImageMipmaps(&image);
+    return true;
 }
 
 Texture2D FS::LoadTexture(const char *fileName)
 {
-    Texture2D texture = { 0 };
+    Texture2D texture = {};
 
     if (FS::Exists(fileName))
     {
@@ -122,3 +162,60 @@ Texture2D FS::LoadTexture(const char *fileName)
 
     return texture;
 }
+
+bool FS::ReadImageSize(const char *fileName, int &width, int &height)
+{
+    std::string path = Resolve(fileName);
+    PHYSFS_File *physFile = path.empty() ? nullptr : PHYSFS_openRead(path.c_str());
+    if (physFile == nullptr)
+        return false;
+
+    // the header is almost always in the first block, the rest of the file
+    // is only read when it isn't
+    PHYSFS_sint64 length = PHYSFS_fileLength(physFile);
+    std::vector<unsigned char> data((size_t)std::min<PHYSFS_sint64>(length, FS::IMAGE_HEADER_BYTES));
+    bool ok = PHYSFS_readBytes(physFile, data.data(), data.size()) == (PHYSFS_sint64)data.size() &&
+              FS::ParseImageSize(GetFileExtension(fileName), data.data(), data.size(), width, height);
+
+    if (!ok && length > (PHYSFS_sint64)data.size())
+    {
+        size_t start = data.size();
+        data.resize((size_t)length);
+        PHYSFS_sint64 rest = (PHYSFS_sint64)(data.size() - start);
+        ok = PHYSFS_readBytes(physFile, data.data() + start, rest) == rest &&
+             FS::ParseImageSize(GetFileExtension(fileName), data.data(), data.size(), width, height);
+    }
+
+    PHYSFS_close(physFile);
+    return ok;
+}
+
+bool FS::Stat(const char *fileName, FileStamp &stamp)
+{
+    const FileIndex::Entry *entry = fileIndex.Find(fileName);
+    if (entry == nullptr)
+        return false;
+
+    // archive entries are stamped from the index, their archive needn't be
+    // mounted to tell whether they changed
+    const FileIndex::Source &source = fileIndex.GetSource(entry->source);
+    if (source.archive)
+    {
+        stamp.size = entry->size;
+        stamp.modified = entry->modified;
+    }
+    else
+    {
+        PHYSFS_Stat stat;
+        std::string path = Resolve(fileName);
+        if (path.empty() || !PHYSFS_stat(path.c_str(), &stat))
+            return false;
+
+        stamp.size = (uint64_t)stat.filesize;
+        stamp.modified = stat.modtime;
+    }
+
+    std::string name = source.path + '\0' + fileName;
+    stamp.nameHash = FS::Hash64(name.data(), name.size());
+    return true;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <string>
 #include <raylib.h>
+#include "FileIndex.hpp"
 
 namespace FS
 {
@@ -12,11 +15,39 @@ namespace FS
     };
 
     int Init();
-    int AddDir(const char *dirPath);
+    // Makes the files of a directory and its pk3s readable behind the ones
+    // added before. Names resolve through a FileIndex, indexFile keeps its
+    // archive part between runs. Archives are only mounted in PhysFS once
+    // a file is read from them.
+    int AddDir(const char *dirPath, const char *indexFile = nullptr);
     void Close();
+    const FileIndex &GetFileIndex();
     bool Exists(const char *fileName);
     Binaryfile LoadBinaryFile(const char *fileName);
     void FreeBinaryFile(Binaryfile &file);
     Image LoadImage(const char *fileName);
     Texture2D LoadTexture(const char *fileName);
+
+    // First of baseName with a .tga, .jpg or .png extension that exists,
+    // empty if none does
+    std::string FindTexture(const std::string &baseName);
+
+    // Reads an image, decodes it and builds its mipmaps. Doesn't touch the
+    // GPU, safe to call from any thread.
+    bool DecodeImage(const char *fileName, Image &image);
+
+    // Width and height of an image from the first bytes of its file, no
+    // decode. Safe to call from any thread.
+    bool ReadImageSize(const char *fileName, int &width, int &height);
+
+    // Which file a name resolves to and what it looked like, data derived
+    // from the file is stale once any of it changes
+    struct FileStamp
+    {
+        uint64_t nameHash; // of the directory or archive it's in and the name
+        uint64_t size;
+        int64_t modified;
+    };
+
+    bool Stat(const char *fileName, FileStamp &stamp);
 }
@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "FileIndex.hpp"
+#include "MappedFile.hpp"
+
+namespace FS
+{
+    static const char MAGIC[4] = {'F', 'I', 'D', 'X'};
+
+    struct IndexHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t archiveCount, entryCount;
+        uint32_t directoryCount, nameCount;
+        uint64_t stringSize;
+    };
+
+    struct IndexArchive
+    {
+        uint64_t size;
+        int64_t modified;
+        uint32_t nameOffset, nameLength;
+    };
+
+    struct IndexEntry
+    {
+        uint32_t archive; // of the ones in the file
+        uint32_t nameOffset, nameLength;
+        uint32_t padding;
+        uint64_t size;
+        int64_t modified;
+    };
+
+    // A loose directory, its files and then its subdirectories are nameCount
+    // names from firstName on
+    struct IndexDirectory
+    {
+        int64_t modified;
+        uint32_t pathOffset, pathLength;
+        uint32_t firstName, fileCount, dirCount;
+        uint32_t padding;
+    };
+
+    struct IndexName
+    {
+        uint32_t offset, length;
+    };
+
+    // Zip records, little endian and unaligned
+    static const uint32_t END_OF_DIRECTORY = 0x06054b50;
+    static const uint32_t DIRECTORY_ENTRY = 0x02014b50;
+    static const size_t END_OF_DIRECTORY_SIZE = 22;
+    static const size_t DIRECTORY_ENTRY_SIZE = 46;
+    static const size_t MAX_ZIP_COMMENT = 0xffff;
+
+    static uint32_t Read16(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t Read32(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    // Name up to its extension and the extension with its dot, a dot in a
+    // directory name doesn't count
+    static void SplitExtension(std::string_view fileName, std::string_view &base, std::string_view &extension)
+    {
+        size_t dot = fileName.find_last_of('.');
+        size_t slash = fileName.find_last_of('/');
+        if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash))
+            dot = fileName.size();
+
+        base = fileName.substr(0, dot);
+        extension = fileName.substr(dot);
+    }
+
+    static bool StatFile(const std::string &path, uint64_t &size, int64_t &modified, bool &directory)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+
+        size = (uint64_t)info.st_size;
+        modified = (int64_t)info.st_mtime;
+        directory = S_ISDIR(info.st_mode);
+        return true;
+    }
+
+    // Without following symbolic links, false for one. PhysFS doesn't serve
+    // them from a mounted directory either, and a link back up the tree
+    // would otherwise be listed forever.
+    static bool StatLoose(const std::string &path, int64_t &modified, bool &directory)
+    {
+        struct stat info;
+#ifdef _WIN32
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+#else
+        if (lstat(path.c_str(), &info) != 0 || S_ISLNK(info.st_mode))
+            return false;
+#endif
+
+        modified = (int64_t)info.st_mtime;
+        directory = S_ISDIR(info.st_mode);
+        return true;
+    }
+
+    bool FileIndex::AddDir(const char *dirPath, const char *indexFile)
+    {
+        DIR *dir = opendir(dirPath);
+        if (dir == nullptr)
+            return false;
+
+        std::vector<std::string> zipFiles;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            std::string fileName = ent->d_name;
+            if (fileName.size() > 4 && fileName.substr(fileName.size() - 4) == ".pk3")
+                zipFiles.push_back(fileName);
+        }
+        closedir(dir);
+
+        // the same order AddDir mounts them in
+        std::sort(zipFiles.begin(), zipFiles.end());
+
+        int loose = (int)sources.size();
+        sources.push_back({dirPath, false, 0, 0});
+
+        int firstArchive = (int)sources.size();
+        for (const std::string &zipFile : zipFiles)
+        {
+            Source source;
+            source.path = std::string(dirPath) + "/" + zipFile;
+            source.archive = true;
+            bool directory = false;
+            if (StatFile(source.path, source.size, source.modified, directory) && !directory)
+                sources.push_back(source);
+        }
+
+        std::vector<ArchiveFile> archiveFiles;
+        std::vector<LooseDir> knownDirs;
+        std::vector<int> unreadable;
+        bool archivesCurrent = indexFile != nullptr && LoadIndex(indexFile, firstArchive, archiveFiles, knownDirs);
+        if (!archivesCurrent)
+        {
+            archiveFiles.clear();
+            for (int source = firstArchive; source < (int)sources.size(); source++)
+            {
+                if (!ReadArchive(source, archiveFiles))
+                {
+                    printf("Failed to read the central directory of %s\n", sources[source].path.c_str());
+                    unreadable.push_back(source);
+                }
+            }
+        }
+
+        // loose files come before the archives of their directory
+        std::unordered_map<std::string, const LooseDir *> known;
+        for (const LooseDir &knownDir : knownDirs)
+            known[knownDir.path] = &knownDir;
+        std::vector<LooseDir> looseDirs;
+        size_t listedBefore = directoriesListed;
+        ListLoose(dirPath, "", loose, known, looseDirs);
+        for (const ArchiveFile &file : archiveFiles)
+            Add(file.name, file.entry);
+
+        bool changed = !archivesCurrent || directoriesListed != listedBefore || looseDirs.size() != knownDirs.size();
+        if (indexFile != nullptr && changed && !SaveIndex(indexFile, firstArchive, archiveFiles, looseDirs, unreadable))
+            printf("Failed to write file index %s\n", indexFile);
+
+        return true;
+    }
+
+    void FileIndex::Clear()
+    {
+        sources.clear();
+        files.clear();
+        fileCount = 0;
+        archivesRead = 0;
+        directoriesListed = 0;
+    }
+
+    void FileIndex::Add(std::string_view fileName, const Entry &entry)
+    {
+        std::string_view base, extension;
+        SplitExtension(fileName, base, extension);
+
+        std::vector<Entry> &entries = files[std::string(base)];
+        for (const Entry &existing : entries)
+        {
+            if (existing.extension == extension)
+                return; // an earlier source has it
+        }
+
+        entries.push_back(entry);
+        entries.back().extension = std::string(extension);
+        fileCount++;
+    }
+
+    const FileIndex::Entry *FileIndex::Find(std::string_view fileName) const
+    {
+        std::string_view base, extension;
+        SplitExtension(fileName, base, extension);
+
+        auto found = files.find(std::string(base));
+        if (found == files.end())
+            return nullptr;
+
+        for (const Entry &entry : found->second)
+        {
+            if (entry.extension == extension)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    const FileIndex::Entry *FileIndex::FindFirst(std::string_view baseName, const char *const *extensions,
+                                                 size_t count) const
+    {
+        auto found = files.find(std::string(baseName));
+        if (found == files.end())
+            return nullptr;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            for (const Entry &entry : found->second)
+            {
+                if (entry.extension == extensions[i])
+                    return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void FileIndex::ListLoose(const std::string &dirPath, const std::string &prefix, int source,
+                              const std::unordered_map<std::string, const LooseDir *> &known,
+                              std::vector<LooseDir> &out)
+    {
+        LooseDir looseDir;
+        bool directory = false;
+        if (!StatLoose(dirPath, looseDir.modified, directory) || !directory)
+            return;
+
+        // adding, removing or renaming anything in a directory changes its
+        // time, while it's the same the recorded names still are
+        auto found = known.find(dirPath);
+        if (found != known.end() && found->second->modified == looseDir.modified)
+        {
+            looseDir = *found->second;
+        }
+        else
+        {
+            DIR *dir = opendir(dirPath.c_str());
+            if (dir == nullptr)
+                return;
+            directoriesListed++;
+
+            // sorted so the index is the same whatever order the OS lists in
+            std::vector<std::string> names;
+            struct dirent *ent;
+            while ((ent = readdir(dir)) != NULL)
+            {
+                if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+                    names.push_back(ent->d_name);
+            }
+            closedir(dir);
+            std::sort(names.begin(), names.end());
+
+            for (std::string &name : names)
+            {
+                int64_t modified;
+                if (StatLoose(dirPath + "/" + name, modified, directory))
+                    (directory ? looseDir.dirs : looseDir.files).push_back(std::move(name));
+            }
+
+            // times only have seconds, a change later in the same second
+            // wouldn't show, so a directory that just changed is listed
+            // again next time
+            looseDir.path = dirPath;
+            if (looseDir.modified >= (int64_t)time(nullptr) - 1)
+                looseDir.modified = -1;
+        }
+
+        for (const std::string &name : looseDir.files)
+        {
+            Entry entry;
+            entry.source = source;
+            Add(prefix + name, entry);
+        }
+
+        std::vector<std::string> dirs = looseDir.dirs;
+        out.push_back(std::move(looseDir));
+        for (const std::string &name : dirs)
+            ListLoose(dirPath + "/" + name, prefix + name + "/", source, known, out);
+    }
+
+    // Appends the files of a zip's central directory, stops at the first
+    // damaged record
+    bool FileIndex::ReadCentralDirectory(const unsigned char *data, size_t size, int source,
+                                         std::vector<ArchiveFile> &out)
+    {
+        if (size < END_OF_DIRECTORY_SIZE)
+            return false;
+
+        // the end record is followed by a comment of up to 64 KB
+        size_t end = size - END_OF_DIRECTORY_SIZE;
+        size_t stop = size > END_OF_DIRECTORY_SIZE + MAX_ZIP_COMMENT ? size - END_OF_DIRECTORY_SIZE - MAX_ZIP_COMMENT : 0;
+        while (Read32(data + end) != END_OF_DIRECTORY)
+        {
+            if (end == stop)
+                return false;
+            end--;
+        }
+
+        uint32_t count = Read16(data + end + 10);
+        uint32_t directorySize = Read32(data + end + 12);
+        uint32_t directoryOffset = Read32(data + end + 16);
+        if (directoryOffset > end || directorySize > end - directoryOffset)
+            return false; // zip64 or damaged
+
+        size_t pos = directoryOffset, directoryEnd = (size_t)directoryOffset + directorySize;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (pos + DIRECTORY_ENTRY_SIZE > directoryEnd || Read32(data + pos) != DIRECTORY_ENTRY)
+                return false;
+
+            const unsigned char *record = data + pos;
+            uint32_t time = Read16(record + 12), date = Read16(record + 14), crc = Read32(record + 16);
+            uint32_t uncompressed = Read32(record + 24);
+            size_t nameLength = Read16(record + 28), extraLength = Read16(record + 30),
+                   commentLength = Read16(record + 32);
+
+            pos += DIRECTORY_ENTRY_SIZE + nameLength + extraLength + commentLength;
+            if (pos > directoryEnd)
+                return false;
+
+            std::string name((const char *)record + DIRECTORY_ENTRY_SIZE, nameLength);
+            if (name.empty() || name.back() == '/')
+                continue; // directory
+
+            ArchiveFile archiveFile;
+            archiveFile.name = std::move(name);
+            archiveFile.entry.source = source;
+            archiveFile.entry.size = uncompressed;
+            archiveFile.entry.modified = (int64_t)(((uint64_t)date << 48) | ((uint64_t)time << 32) | crc);
+            out.push_back(std::move(archiveFile));
+        }
+
+        return true;
+    }
+
+    // Only the central directory at the end of the archive is touched, the
+    // file's mapped so the rest is never read. A damaged archive adds
+    // nothing, rather than the files before the damage.
+    bool FileIndex::ReadArchive(int source, std::vector<ArchiveFile> &out)
+    {
+        archivesRead++;
+
+        MappedFile file;
+        if (!file.Open(sources[source].path.c_str()))
+            return false;
+
+        size_t first = out.size();
+        if (!ReadCentralDirectory((const unsigned char *)file.Data(), file.Size(), source, out))
+        {
+            out.resize(first);
+            return false;
+        }
+        return true;
+    }
+
+    bool FileIndex::LoadIndex(const char *indexFile, int firstArchive, std::vector<ArchiveFile> &archiveFiles,
+                              std::vector<LooseDir> &looseDirs) const
+    {
+        // a missing index is the normal first run
+        FILE *exists = fopen(indexFile, "rb");
+        if (!exists)
+            return false;
+        fclose(exists);
+
+        MappedFile file;
+        if (!file.Open(indexFile, false) || file.Size() < sizeof(IndexHeader))
+            return false;
+
+        const char *data = file.Data();
+        size_t size = file.Size();
+
+        IndexHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+            return false;
+
+        size_t archiveCount = sources.size() - firstArchive;
+        size_t stringOffset = sizeof(IndexHeader) + (size_t)header.archiveCount * sizeof(IndexArchive) +
+                              (size_t)header.entryCount * sizeof(IndexEntry) +
+                              (size_t)header.directoryCount * sizeof(IndexDirectory) +
+                              (size_t)header.nameCount * sizeof(IndexName);
+        if (stringOffset > size || header.stringSize != size - stringOffset)
+            return false;
+
+        const IndexArchive *archives = (const IndexArchive *)(data + sizeof(IndexHeader));
+        const IndexEntry *entries = (const IndexEntry *)(archives + header.archiveCount);
+        const IndexDirectory *directories = (const IndexDirectory *)(entries + header.entryCount);
+        const IndexName *names = (const IndexName *)(directories + header.directoryCount);
+        const char *strings = data + stringOffset;
+        auto text = [&](uint32_t offset, uint32_t length, std::string_view &view)
+        {
+            if (offset > header.stringSize || length > header.stringSize - offset)
+                return false;
+            view = std::string_view(strings + offset, length);
+            return true;
+        };
+
+        // directories are checked against the disk as they're listed
+        looseDirs.resize(header.directoryCount);
+        for (uint32_t i = 0; i < header.directoryCount; i++)
+        {
+            const IndexDirectory &directory = directories[i];
+            std::string_view path;
+            if (!text(directory.pathOffset, directory.pathLength, path) ||
+                (uint64_t)directory.firstName + directory.fileCount + directory.dirCount > header.nameCount)
+            {
+                looseDirs.clear();
+                return false;
+            }
+
+            LooseDir &looseDir = looseDirs[i];
+            looseDir.path = std::string(path);
+            looseDir.modified = directory.modified;
+            for (uint32_t n = 0; n < directory.fileCount + directory.dirCount; n++)
+            {
+                std::string_view name;
+                if (!text(names[directory.firstName + n].offset, names[directory.firstName + n].length, name))
+                {
+                    looseDirs.clear();
+                    return false;
+                }
+                (n < directory.fileCount ? looseDir.files : looseDir.dirs).push_back(std::string(name));
+            }
+        }
+
+        // stale once any archive was added, removed, replaced or touched
+        if (header.archiveCount != archiveCount)
+            return false;
+        for (size_t i = 0; i < archiveCount; i++)
+        {
+            const Source &source = sources[firstArchive + i];
+            std::string_view name;
+            if (!text(archives[i].nameOffset, archives[i].nameLength, name) || name != source.path ||
+                archives[i].size != source.size || archives[i].modified != source.modified)
+                return false;
+        }
+
+        archiveFiles.reserve(header.entryCount);
+        for (uint32_t i = 0; i < header.entryCount; i++)
+        {
+            std::string_view name;
+            if (entries[i].archive >= archiveCount || !text(entries[i].nameOffset, entries[i].nameLength, name))
+                return false;
+
+            ArchiveFile archiveFile;
+            archiveFile.name = std::string(name);
+            archiveFile.entry.source = firstArchive + (int)entries[i].archive;
+            archiveFile.entry.size = entries[i].size;
+            archiveFile.entry.modified = entries[i].modified;
+            archiveFiles.push_back(std::move(archiveFile));
+        }
+
+        return true;
+    }
+
+    bool FileIndex::SaveIndex(const char *indexFile, int firstArchive, const std::vector<ArchiveFile> &archiveFiles,
+                              const std::vector<LooseDir> &looseDirs, const std::vector<int> &unreadable) const
+    {
+        std::string strings;
+        std::vector<IndexArchive> archives;
+        for (size_t s = firstArchive; s < sources.size(); s++)
+        {
+            // an archive that couldn't be read is stored as changed, so the
+            // next run reads it again
+            bool read = std::find(unreadable.begin(), unreadable.end(), (int)s) == unreadable.end();
+            archives.push_back({sources[s].size, read ? sources[s].modified : -1, (uint32_t)strings.size(),
+                                (uint32_t)sources[s].path.size()});
+            strings += sources[s].path;
+        }
+
+        std::vector<IndexEntry> entries;
+        for (const ArchiveFile &file : archiveFiles)
+        {
+            entries.push_back({(uint32_t)(file.entry.source - firstArchive), (uint32_t)strings.size(),
+                               (uint32_t)file.name.size(), 0, file.entry.size, file.entry.modified});
+            strings += file.name;
+        }
+
+        std::vector<IndexDirectory> directories;
+        std::vector<IndexName> names;
+        for (const LooseDir &looseDir : looseDirs)
+        {
+            directories.push_back({looseDir.modified, (uint32_t)strings.size(), (uint32_t)looseDir.path.size(),
+                                   (uint32_t)names.size(), (uint32_t)looseDir.files.size(),
+                                   (uint32_t)looseDir.dirs.size(), 0});
+            strings += looseDir.path;
+            for (const std::vector<std::string> *list : {&looseDir.files, &looseDir.dirs})
+            {
+                for (const std::string &name : *list)
+                {
+                    names.push_back({(uint32_t)strings.size(), (uint32_t)name.size()});
+                    strings += name;
+                }
+            }
+        }
+
+        IndexHeader header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.archiveCount = (uint32_t)archives.size();
+        header.entryCount = (uint32_t)entries.size();
+        header.directoryCount = (uint32_t)directories.size();
+        header.nameCount = (uint32_t)names.size();
+        header.stringSize = strings.size();
+
+        // written next to the target and renamed over it, so a reader never
+        // sees a partial file
+        std::string tempName = std::string(indexFile) + ".tmp";
+        FILE *out = fopen(tempName.c_str(), "wb");
+        if (!out)
+            return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = ok && (archives.empty() || fwrite(archives.data(), sizeof(IndexArchive), archives.size(), out) == archives.size());
+        ok = ok && (entries.empty() || fwrite(entries.data(), sizeof(IndexEntry), entries.size(), out) == entries.size());
+        ok = ok && (directories.empty() ||
+                    fwrite(directories.data(), sizeof(IndexDirectory), directories.size(), out) == directories.size());
+        ok = ok && (names.empty() || fwrite(names.data(), sizeof(IndexName), names.size(), out) == names.size());
+        ok = ok && (strings.empty() || fwrite(strings.data(), 1, strings.size(), out) == strings.size());
+        ok = fclose(out) == 0 && ok;
+
+        if (ok)
+        {
+            remove(indexFile);
+            ok = rename(tempName.c_str(), indexFile) == 0;
+        }
+
+        if (!ok)
+            remove(tempName.c_str());
+        return ok;
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace FS
+{
+    // Where every file of the mounted directories and their pk3s is, so a
+    // name resolves with one hash lookup instead of a search through every
+    // archive. Sources are searched in the order they're added and the
+    // first one with a file wins, like PhysFS' search path. Names are
+    // looked up without their extension, a name can be there with several.
+    class FileIndex
+    {
+    public:
+        // Bump whenever the layout of the index file changes, older ones
+        // are thrown away
+        static const uint32_t VERSION = 2;
+
+        // A directory's loose files or one of its pk3s
+        struct Source
+        {
+            std::string path; // on disk
+            bool archive = false;
+            uint64_t size = 0; // of archives, to tell when they change
+            int64_t modified = 0;
+        };
+
+        // The winning copy of a file
+        struct Entry
+        {
+            std::string extension; // with the dot, empty if the name has none
+            int source = -1;
+            uint64_t size = 0;    // in archives, uncompressed
+            int64_t modified = 0; // in archives, DOS date and time above the CRC32
+        };
+
+        // Adds the loose files of a directory, then its pk3s in alphabetical
+        // order, behind everything added before. The pk3s' entries come from
+        // indexFile while the archives there have the same names, sizes and
+        // times, otherwise their central directories are read. Loose
+        // directories are only listed again when their time changed. Either
+        // rewrites indexFile. It can be null to keep the index in memory
+        // only. Symbolic links are skipped like PhysFS does by default.
+        bool AddDir(const char *dirPath, const char *indexFile = nullptr);
+        void Clear();
+
+        // The entry a name with its extension resolves to, null if there's
+        // none. Safe from any thread once nothing is being added.
+        const Entry *Find(std::string_view fileName) const;
+        // The first of a name without its extension and the given ones
+        // that's there, extensions like ".tga"
+        const Entry *FindFirst(std::string_view baseName, const char *const *extensions, size_t count) const;
+
+        const Source &GetSource(int source) const { return sources[source]; }
+        size_t SourceCount() const { return sources.size(); }
+        size_t FileCount() const { return fileCount; }
+        // Archives whose central directory was read, not taken from an index file
+        size_t ArchivesRead() const { return archivesRead; }
+        // Same for loose directories
+        size_t DirectoriesListed() const { return directoriesListed; }
+
+    private:
+        // A file of one of the pk3s being added, in the order they're searched
+        struct ArchiveFile
+        {
+            std::string name;
+            Entry entry;
+        };
+
+        // The names in a loose directory, sorted
+        struct LooseDir
+        {
+            std::string path; // on disk
+            int64_t modified = 0;
+            std::vector<std::string> files, dirs;
+        };
+
+        std::vector<Source> sources;
+        std::unordered_map<std::string, std::vector<Entry>> files; // by name without extension
+        size_t fileCount = 0;
+        size_t archivesRead = 0;
+        size_t directoriesListed = 0;
+
+        void Add(std::string_view fileName, const Entry &entry);
+        void ListLoose(const std::string &dirPath, const std::string &prefix, int source,
+                       const std::unordered_map<std::string, const LooseDir *> &known, std::vector<LooseDir> &out);
+        bool ReadArchive(int source, std::vector<ArchiveFile> &out);
+        static bool ReadCentralDirectory(const unsigned char *data, size_t size, int source,
+                                         std::vector<ArchiveFile> &out);
+        // Fills looseDirs from any readable index file, archiveFiles only
+        // when its archives are current, which is what it returns
+        bool LoadIndex(const char *indexFile, int firstArchive, std::vector<ArchiveFile> &archiveFiles,
+                       std::vector<LooseDir> &looseDirs) const;
+        // Archives listed in unreadable are stored so they don't match next time
+        bool SaveIndex(const char *indexFile, int firstArchive, const std::vector<ArchiveFile> &archiveFiles,
+                       const std::vector<LooseDir> &looseDirs, const std::vector<int> &unreadable) const;
+    };
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace FS
+{
+    // 64-bit xxHash of a block of memory. Not cryptographic, used to tell
+    // whether the contents of a file changed.
+    uint64_t Hash64(const void *data, size_t size, uint64_t seed = 0);
+}
@@ -0,0 +1,116 @@
+#include <cctype>
+#include <cstring>
+#include "ImageSize.hpp"
+
+namespace FS
+{
+    static bool HasExtension(const char *extension, const char *wanted)
+    {
+        if (extension == nullptr || strlen(extension) != strlen(wanted))
+            return false;
+
+        for (size_t i = 0; wanted[i]; i++)
+        {
+            if (tolower((unsigned char)extension[i]) != wanted[i])
+                return false;
+        }
+        return true;
+    }
+
+    static int ReadBigEndian16(const unsigned char *p)
+    {
+        return (p[0] << 8) | p[1];
+    }
+
+    static long ReadBigEndian32(const unsigned char *p)
+    {
+        return ((long)p[0] << 24) | ((long)p[1] << 16) | ((long)p[2] << 8) | (long)p[3];
+    }
+
+    // 18 byte header, the size is little endian at 12
+    static bool ParseTgaSize(const unsigned char *data, size_t size, int &width, int &height)
+    {
+        if (size < 18)
+            return false;
+
+        width = data[12] | (data[13] << 8);
+        height = data[14] | (data[15] << 8);
+        return true;
+    }
+
+    // the signature, then IHDR is always the first chunk
+    static bool ParsePngSize(const unsigned char *data, size_t size, int &width, int &height)
+    {
+        static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        if (size < 24 || memcmp(data, SIGNATURE, sizeof(SIGNATURE)) != 0 || memcmp(data + 12, "IHDR", 4) != 0)
+            return false;
+
+        width = (int)ReadBigEndian32(data + 16);
+        height = (int)ReadBigEndian32(data + 20);
+        return true;
+    }
+
+    // segments are skipped by their lengths up to the start of frame
+    static bool ParseJpegSize(const unsigned char *data, size_t size, int &width, int &height)
+    {
+        if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+            return false;
+
+        size_t pos = 2;
+        while (pos + 4 <= size)
+        {
+            if (data[pos] != 0xff)
+                return false;
+
+            unsigned char marker = data[pos + 1];
+            if (marker == 0xff)
+            {
+                pos++; // fill byte
+                continue;
+            }
+
+            // markers without a length
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+            {
+                pos += 2;
+                continue;
+            }
+
+            int length = ReadBigEndian16(data + pos + 2);
+            if (length < 2)
+                return false;
+
+            // start of frame, all of them but DHT, JPG and DAC share the range
+            bool frame = marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+            if (frame)
+            {
+                if (pos + 9 > size)
+                    return false;
+
+                height = ReadBigEndian16(data + pos + 5);
+                width = ReadBigEndian16(data + pos + 7);
+                return true;
+            }
+
+            // the image data starts without a frame, or the end
+            if (marker == 0xda || marker == 0xd9)
+                return false;
+
+            pos += 2 + length;
+        }
+        return false;
+    }
+
+    bool ParseImageSize(const char *extension, const unsigned char *data, size_t size, int &width, int &height)
+    {
+        bool ok = false;
+        if (HasExtension(extension, ".tga"))
+            ok = ParseTgaSize(data, size, width, height);
+        else if (HasExtension(extension, ".png"))
+            ok = ParsePngSize(data, size, width, height);
+        else if (HasExtension(extension, ".jpg") || HasExtension(extension, ".jpeg"))
+            ok = ParseJpegSize(data, size, width, height);
+
+        return ok && width > 0 && height > 0;
+    }
+}
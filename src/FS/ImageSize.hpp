@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+namespace FS
+{
+    // Bytes from the start of a file that hold the size of nearly every
+    // image, JPEGs with large metadata blocks need more
+    static const size_t IMAGE_HEADER_BYTES = 64 * 1024;
+
+    // Width and height of a TGA, PNG or JPEG from the first bytes of the
+    // file, without decoding it. extension is like ".tga", any case. False
+    // if the format isn't one of those or the size isn't in the bytes.
+    bool ParseImageSize(const char *extension, const unsigned char *data, size_t size, int &width, int &height);
+}
@@ -0,0 +1,192 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FS::MappedFile::~MappedFile()
+{
+    Close();
+}
+
+FS::MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data(other.data), size(other.size), mapped(other.mapped)
+{
+    other.data = nullptr;
+    other.size = 0;
+    other.mapped = false;
+}
+
+FS::MappedFile &FS::MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        std::swap(mapped, other.mapped);
+    }
+
+    return *this;
+}
+
+bool FS::MappedFile::Open(const char *fileName, bool allowMapping)
+{
+    Close();
+
+    if (allowMapping && OpenMapping(fileName))
+        return true;
+
+    return OpenRead(fileName);
+}
+
+void FS::MappedFile::Close()
+{
+    if (mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void *)data, size);
+#endif
+    }
+    else
+    {
+        free((void *)data);
+    }
+
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
+
+void FS::MappedFile::Release(size_t end)
+{
+#ifndef _WIN32
+    if (!mapped)
+        return;
+
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (end < size ? end : size) / pageSize * pageSize;
+
+    if (length > 0)
+        madvise((void *)data, length, MADV_DONTNEED);
+#else
+    (void)end; // file views can't be partially dropped, the working set manager trims them
+#endif
+}
+
+#ifdef _WIN32
+bool FS::MappedFile::OpenMapping(const char *fileName)
+{
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping alive
+    if (!view)
+        return false;
+
+    data = (const char *)view;
+    size = (size_t)fileSize.QuadPart;
+    mapped = true;
+    return true;
+}
+#else
+bool FS::MappedFile::OpenMapping(const char *fileName)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (view == MAP_FAILED)
+        return false;
+
+    // maps are lexed front to back exactly once
+    madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    data = (const char *)view;
+    size = (size_t)st.st_size;
+    mapped = true;
+    return true;
+}
+#endif
+
+bool FS::MappedFile::OpenRead(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (fileSize < 0)
+    {
+        int error = errno;
+        fclose(file);
+        errno = error;
+        return false;
+    }
+
+    errno = 0;
+    char *buffer = (char *)malloc(fileSize > 0 ? fileSize : 1);
+    if (!buffer || fread(buffer, 1, fileSize, file) != (size_t)fileSize)
+    {
+        int error = errno != 0 ? errno : EIO; // a short read sets nothing
+        fclose(file);
+        free(buffer);
+        errno = error;
+        return false;
+    }
+    fclose(file);
+
+    data = buffer;
+    size = (size_t)fileSize;
+    mapped = false;
+    return true;
+}
+
+bool FS::RenameOver(const char *from, const char *to)
+{
+#ifdef _WIN32
+    // rename doesn't replace an existing file on Windows
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+namespace FS
+{
+    // Read-only view of a file on disk (not a PhysFS path). The file is memory
+    // mapped when possible and read into a heap buffer otherwise, e.g. for
+    // empty files or when allowMapping is false. The data is not NUL-terminated.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        MappedFile(MappedFile &&other) noexcept;
+        MappedFile &operator=(MappedFile &&other) noexcept;
+
+        // Returns false with errno telling why if the file can't be opened
+        // or read, printing that is up to the caller
+        bool Open(const char *fileName, bool allowMapping = true);
+        void Close();
+
+        // Tells the OS that the bytes before end won't be read again, so mapped
+        // pages can be dropped from memory. They are re-read if touched again.
+        void Release(size_t end);
+
+        const char *Data() const { return data; }
+        size_t Size() const { return size; }
+        bool IsMapped() const { return mapped; }
+
+    private:
+        const char *data = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+
+        bool OpenMapping(const char *fileName);
+        bool OpenRead(const char *fileName);
+    };
+
+    // Renames a file over another, replacing it in one step so a reader
+    // sees either the old or the new file. On Windows the target must not
+    // be mapped.
+    bool RenameOver(const char *from, const char *to);
+}
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include "Hash.hpp"
+#include "TextureCache.hpp"
+
+namespace FS
+{
+    static const char MAGIC[4] = {'T', 'E', 'X', 'C'};
+
+    // Pixels start on this boundary, like the sections of a compiled map
+    static const size_t PIXEL_ALIGNMENT = 16;
+
+    // Largest image side a cache entry can have, keeps the size checks of a
+    // damaged file from overflowing
+    static const int32_t MAX_IMAGE_SIZE = 16384;
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t entryOffset, entryCount; // sorted by name hash
+        uint64_t imageOffset, imageCount;
+    };
+
+    struct CacheEntry
+    {
+        uint64_t nameHash;
+        uint64_t size;
+        int64_t modified;
+        uint64_t image;
+    };
+
+    struct CacheImage
+    {
+        uint64_t contentHash;
+        uint64_t offset, size; // of the pixels in the file
+        int32_t width, height, mipmaps, format;
+    };
+
+    size_t ImageDataSize(const Image &image)
+    {
+        size_t size = 0;
+        int width = image.width, height = image.height;
+        for (int level = 0; level < image.mipmaps; level++)
+        {
+            size += (size_t)GetPixelDataSize(width, height, image.format);
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        return size;
+    }
+
+    bool TextureCache::Open(const char *fileName)
+    {
+        Close();
+
+        // a missing cache is the normal first run
+        FILE *exists = fopen(fileName, "rb");
+        if (!exists)
+            return false;
+        fclose(exists);
+
+        MappedFile mapped;
+        if (!mapped.Open(fileName) || mapped.Size() < sizeof(CacheHeader))
+            return false;
+
+        CacheHeader header;
+        memcpy(&header, mapped.Data(), sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+            return false;
+
+        // a truncated or damaged file must not be read past its end
+        size_t size = mapped.Size();
+        if (header.entryOffset % 8 != 0 || header.entryOffset > size ||
+            header.entryCount > (size - header.entryOffset) / sizeof(CacheEntry) || header.imageOffset % 8 != 0 ||
+            header.imageOffset > size || header.imageCount > (size - header.imageOffset) / sizeof(CacheImage))
+            return false;
+
+        const CacheEntry *entries = (const CacheEntry *)(mapped.Data() + header.entryOffset);
+        const CacheImage *images = (const CacheImage *)(mapped.Data() + header.imageOffset);
+        // Find binary searches the entries
+        for (uint64_t i = 0; i < header.entryCount; i++)
+        {
+            if (entries[i].image >= header.imageCount || (i > 0 && entries[i - 1].nameHash >= entries[i].nameHash))
+                return false;
+        }
+
+        // the uploader reads as many bytes as the layout needs, the pixels
+        // must be exactly that long
+        for (uint64_t i = 0; i < header.imageCount; i++)
+        {
+            const CacheImage &image = images[i];
+            if (image.offset % PIXEL_ALIGNMENT != 0 || image.offset > size || image.size > size - image.offset)
+                return false;
+
+            if (image.width < 1 || image.width > MAX_IMAGE_SIZE || image.height < 1 ||
+                image.height > MAX_IMAGE_SIZE || image.mipmaps < 1 || image.mipmaps > 32)
+                return false;
+
+            Image layout = {nullptr, image.width, image.height, image.mipmaps, image.format};
+            size_t expected = ImageDataSize(layout);
+            if (expected == 0 || image.size != expected)
+                return false;
+        }
+
+        file = std::move(mapped);
+        data = file.Data();
+        openName = fileName;
+        return true;
+    }
+
+    void TextureCache::Close()
+    {
+        file.Close();
+        data = nullptr;
+        openName.clear();
+    }
+
+    bool TextureCache::Find(const FileStamp &stamp, Image &image) const
+    {
+        if (!data)
+            return false;
+
+        const CacheHeader *header = (const CacheHeader *)data;
+        const CacheEntry *entries = (const CacheEntry *)(data + header->entryOffset);
+        const CacheEntry *end = entries + header->entryCount;
+
+        const CacheEntry *entry = std::lower_bound(entries, end, stamp.nameHash,
+                                                   [](const CacheEntry &e, uint64_t hash) { return e.nameHash < hash; });
+        if (entry == end || entry->nameHash != stamp.nameHash || entry->size != stamp.size ||
+            entry->modified != stamp.modified)
+            return false;
+
+        const CacheImage &cached = ((const CacheImage *)(data + header->imageOffset))[entry->image];
+        image.data = (void *)(data + cached.offset);
+        image.width = cached.width;
+        image.height = cached.height;
+        image.mipmaps = cached.mipmaps;
+        image.format = cached.format;
+        return true;
+    }
+
+    void TextureCache::Add(const FileStamp &stamp, const Image &image)
+    {
+        Added entry;
+        entry.stamp = stamp;
+        entry.image = image;
+        entry.pixels.assign((const unsigned char *)image.data,
+                            (const unsigned char *)image.data + ImageDataSize(image));
+        entry.image.data = entry.pixels.data();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        added.push_back(std::move(entry));
+    }
+
+    bool TextureCache::Save(const char *fileName)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // the newest entry of every name, the ones added win over the file
+        struct Source
+        {
+            FileStamp stamp;
+            Image image;
+        };
+        std::unordered_map<uint64_t, Source> sources;
+
+        if (data)
+        {
+            const CacheHeader *header = (const CacheHeader *)data;
+            const CacheEntry *entries = (const CacheEntry *)(data + header->entryOffset);
+            for (uint64_t i = 0; i < header->entryCount; i++)
+            {
+                Source source = {{entries[i].nameHash, entries[i].size, entries[i].modified}, Image{}};
+                Find(source.stamp, source.image);
+                sources[entries[i].nameHash] = source;
+            }
+        }
+        for (const Added &entry : added)
+            sources[entry.stamp.nameHash] = {entry.stamp, entry.image};
+
+        std::vector<CacheEntry> entries;
+        for (const auto &pair : sources)
+            entries.push_back({pair.second.stamp.nameHash, pair.second.stamp.size, pair.second.stamp.modified, 0});
+        std::sort(entries.begin(), entries.end(),
+                  [](const CacheEntry &a, const CacheEntry &b) { return a.nameHash < b.nameHash; });
+
+        // images only referenced by replaced entries are dropped, equal
+        // pixels are stored once
+        std::vector<CacheImage> images;
+        std::vector<const void *> pixels;
+        std::unordered_map<uint64_t, uint64_t> byContent;
+        for (CacheEntry &entry : entries)
+        {
+            const Image &image = sources[entry.nameHash].image;
+            size_t size = ImageDataSize(image);
+            int32_t layout[4] = {image.width, image.height, image.mipmaps, image.format};
+            uint64_t contentHash = Hash64(layout, sizeof(layout), Hash64(image.data, size));
+
+            // the hash only finds candidates, the pixels decide
+            auto found = byContent.find(contentHash);
+            if (found != byContent.end())
+            {
+                const CacheImage &other = images[found->second];
+                if (other.size == size && other.width == image.width && other.height == image.height &&
+                    other.mipmaps == image.mipmaps && other.format == image.format &&
+                    memcmp(pixels[found->second], image.data, size) == 0)
+                {
+                    entry.image = found->second;
+                    continue;
+                }
+            }
+
+            entry.image = images.size();
+            byContent.emplace(contentHash, entry.image);
+            images.push_back({contentHash, 0, size, image.width, image.height, image.mipmaps, image.format});
+            pixels.push_back(image.data);
+        }
+
+        CacheHeader header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.entryOffset = sizeof(CacheHeader);
+        header.entryCount = entries.size();
+        header.imageOffset = header.entryOffset + entries.size() * sizeof(CacheEntry);
+        header.imageCount = images.size();
+
+        size_t end = header.imageOffset + images.size() * sizeof(CacheImage);
+        for (CacheImage &image : images)
+        {
+            image.offset = (end + PIXEL_ALIGNMENT - 1) / PIXEL_ALIGNMENT * PIXEL_ALIGNMENT;
+            end = image.offset + image.size;
+        }
+
+        // written next to the target and renamed over it, so a reader never
+        // sees a partial file. The pixels go straight from the mapped file
+        // and the added images to the output, nothing is copied in memory.
+        std::string tempName = std::string(fileName) + ".tmp";
+        FILE *out = fopen(tempName.c_str(), "wb");
+        if (!out)
+            return false;
+
+        size_t written = 0;
+        auto write = [&](const void *bytes, size_t size)
+        {
+            if (size > 0 && fwrite(bytes, 1, size, out) != size)
+                return false;
+            written += size;
+            return true;
+        };
+
+        static const char zeros[PIXEL_ALIGNMENT] = {};
+        bool ok = write(&header, sizeof(header)) && write(entries.data(), entries.size() * sizeof(CacheEntry)) &&
+                  write(images.data(), images.size() * sizeof(CacheImage));
+        for (size_t i = 0; ok && i < images.size(); i++)
+            ok = write(zeros, images[i].offset - written) && write(pixels[i], images[i].size);
+        ok = fclose(out) == 0 && ok;
+        if (!ok)
+        {
+            remove(tempName.c_str());
+            return false;
+        }
+
+        // a mapping outlives the rename of its file except on Windows, where
+        // the old file has to be unmapped first
+        std::string oldName = openName;
+#ifdef _WIN32
+        Close();
+#endif
+        if (!RenameOver(tempName.c_str(), fileName))
+        {
+            remove(tempName.c_str());
+            if (!data && !oldName.empty())
+                Open(oldName.c_str());
+            return false;
+        }
+
+        // the added images are kept for another Save until the new file maps
+        if (!Open(fileName))
+        {
+            if (!oldName.empty() && oldName != fileName)
+                Open(oldName.c_str());
+            return false;
+        }
+
+        added.clear();
+        return true;
+    }
+
+    size_t TextureCache::EntryCount() const
+    {
+        return data ? (size_t)((const CacheHeader *)data)->entryCount : 0;
+    }
+
+    size_t TextureCache::ImageCount() const
+    {
+        return data ? (size_t)((const CacheHeader *)data)->imageCount : 0;
+    }
+
+    size_t TextureCache::AddedCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return added.size();
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <raylib.h>
+#include "FS.hpp"
+#include "MappedFile.hpp"
+
+namespace FS
+{
+    // Bytes of an image's pixels with all its mip levels
+    size_t ImageDataSize(const Image &image);
+
+    // Decoded and mipmapped textures kept on disk between runs. Entries are
+    // looked up by the stamp of the file they were decoded from, images with
+    // the same pixels are stored once whatever their names. The file is
+    // flat and used straight from the mapping, little endian and only used
+    // on the machine that wrote it.
+    class TextureCache
+    {
+    public:
+        // Bump whenever the layout of the file or how images are decoded
+        // changes, older caches are thrown away
+        static const uint32_t VERSION = 1;
+
+        TextureCache() = default;
+        TextureCache(const TextureCache &) = delete;
+        TextureCache &operator=(const TextureCache &) = delete;
+
+        // Maps a cache file, false if it's missing or not a valid cache, the
+        // cache is empty then
+        bool Open(const char *fileName);
+        void Close();
+
+        // Image decoded from the stamped file, if it's cached. The pixels
+        // are in the mapped file, the image must not be unloaded and is only
+        // valid until the cache is closed or saved. Safe from any thread.
+        bool Find(const FileStamp &stamp, Image &image) const;
+
+        // Keeps a copy of an image decoded from the stamped file for Save,
+        // it replaces an older entry of the same name. Safe from any thread.
+        void Add(const FileStamp &stamp, const Image &image);
+
+        // Writes the cached and added images, then maps the new file. On
+        // failure the cache stays as it was and keeps the added images for
+        // another Save.
+        bool Save(const char *fileName);
+
+        size_t EntryCount() const;
+        size_t ImageCount() const;
+        size_t AddedCount();
+
+    private:
+        struct Added
+        {
+            FileStamp stamp;
+            Image image; // data points into pixels
+            std::vector<unsigned char> pixels;
+        };
+
+        MappedFile file;
+        const char *data = nullptr;
+        std::string openName; // of the mapped file, empty if none is
+
+        std::mutex mutex;
+        std::vector<Added> added;
+    };
+}
@@ -0,0 +1,178 @@
+#include <chrono>
+#include <cstdio>
+#include "FS.hpp"
+#include "TextureLoader.hpp"
+
+namespace FS
+{
+    void DecodedTexture::Unload()
+    {
+        if (image.data != nullptr && !cached)
+            UnloadImage(image);
+        image = Image{};
+    }
+
+    std::vector<TextureSize> ReadTextureSizes(const std::vector<std::string> &names)
+    {
+        std::vector<TextureSize> sizes(names.size());
+        Jobs::ParallelFor(names.size(), [&](size_t i)
+        {
+            std::string fileName = FindTexture(names[i]);
+            if (!fileName.empty() && !ReadImageSize(fileName.c_str(), sizes[i].width, sizes[i].height))
+                sizes[i] = TextureSize();
+        });
+        return sizes;
+    }
+
+    TextureLoader::~TextureLoader()
+    {
+        Cancel();
+
+        for (DecodedTexture &texture : finished)
+            texture.Unload();
+    }
+
+    void TextureLoader::Start(const std::vector<std::string> &textureNames, TextureCache *textureCache)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cache = textureCache;
+            names = textureNames;
+            priorities.assign(names.size(), 0.0f);
+            for (size_t i = 0; i < names.size(); i++)
+                waiting.push_back((int)i);
+            remaining += names.size();
+        }
+
+        // every task takes whichever texture is first when it runs, so
+        // priorities set later still count. Without other threads Run would
+        // decode everything right here.
+        background = Jobs::ThreadCount() > 1;
+        for (size_t i = 0; background && i < names.size(); i++)
+        {
+            group.Run([this]
+            {
+                DecodeNext();
+            });
+        }
+    }
+
+    void TextureLoader::Prioritize(const std::vector<float> &newPriorities)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < priorities.size(); i++)
+            priorities[i] = i < newPriorities.size() ? newPriorities[i] : 0.0f;
+    }
+
+    bool TextureLoader::DecodeNext()
+    {
+        DecodedTexture texture;
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (waiting.empty())
+                return false;
+
+            // a few hundred textures at most, a scan is cheaper than keeping
+            // a heap that every new set of priorities invalidates
+            size_t best = 0;
+            for (size_t i = 1; i < waiting.size(); i++)
+            {
+                float priority = priorities[waiting[i]], bestPriority = priorities[waiting[best]];
+                if (priority > bestPriority || (priority == bestPriority && waiting[i] < waiting[best]))
+                    best = i;
+            }
+
+            texture.id = waiting[best];
+            waiting[best] = waiting.back();
+            waiting.pop_back();
+            name = names[texture.id];
+        }
+
+        texture.fileName = FindTexture(name);
+
+        FileStamp stamp;
+        bool stamped = !texture.fileName.empty() && cache && Stat(texture.fileName.c_str(), stamp);
+        if (stamped && cache->Find(stamp, texture.image))
+        {
+            texture.cached = true;
+        }
+        else if (!texture.fileName.empty())
+        {
+            if (!DecodeImage(texture.fileName.c_str(), texture.image))
+                printf("Failed to decode %s\n", texture.fileName.c_str());
+            else if (stamped)
+                cache->Add(stamp, texture.image);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(std::move(texture));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    bool TextureLoader::Pop(DecodedTexture &texture)
+    {
+        texture = std::move(finished.front());
+        finished.pop_front();
+        remaining--;
+        return true;
+    }
+
+    bool TextureLoader::Next(DecodedTexture &texture)
+    {
+        if (!background)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!finished.empty())
+                    return Pop(texture);
+            }
+            DecodeNext();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return remaining == 0 || !finished.empty(); });
+        return remaining > 0 && Pop(texture);
+    }
+
+    bool TextureLoader::TryNext(DecodedTexture &texture)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !finished.empty() && Pop(texture);
+    }
+
+    void TextureLoader::Pump(double budgetMs)
+    {
+        if (background)
+            return;
+
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                   std::chrono::duration<double, std::milli>(budgetMs));
+        while (DecodeNext() && Clock::now() < end)
+        {
+        }
+    }
+
+    void TextureLoader::Cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining -= waiting.size();
+            waiting.clear();
+        }
+        ready.notify_all();
+
+        // the queued tasks find nothing left to decode
+        group.Wait();
+    }
+
+    size_t TextureLoader::Remaining()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return remaining;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <raylib.h>
+#include "../Jobs/Jobs.hpp"
+#include "TextureCache.hpp"
+
+namespace FS
+{
+    // A texture read, decoded and mipmapped off the main thread
+    struct DecodedTexture
+    {
+        int id = -1;          // index of the name given to Start
+        std::string fileName; // file it was read from, empty if there's none
+        Image image = {};     // no data if there was no file or it didn't decode
+        bool cached = false;  // the pixels are in the texture cache's file
+
+        // Frees the image unless the cache owns it
+        void Unload();
+    };
+
+    struct TextureSize
+    {
+        int width = 0, height = 0;
+    };
+
+    // Sizes of textures read from their file headers on the job pool, without
+    // decoding them. Names are like the loader's, a texture without a file or
+    // a readable header is 0x0.
+    std::vector<TextureSize> ReadTextureSizes(const std::vector<std::string> &names);
+
+    // Decodes textures on the job pool, the ones with the highest priority
+    // first. Finished textures wait in a queue for the main thread, which
+    // only has to upload them. When the pool has no threads besides the
+    // calling one, Next and Pump do the decoding instead.
+    class TextureLoader
+    {
+    public:
+        TextureLoader() = default;
+        TextureLoader(const TextureLoader &) = delete;
+        TextureLoader &operator=(const TextureLoader &) = delete;
+
+        // Cancels, then frees the images that weren't taken
+        ~TextureLoader();
+
+        // Queues a decode for every name, names have no extension like
+        // "textures/base_wall/concrete". Call once. Images found in the cache
+        // aren't decoded again, the ones that are get added to it, the
+        // cache must outlive the loader.
+        void Start(const std::vector<std::string> &names, TextureCache *cache = nullptr);
+
+        // Order for the textures not started yet, highest priority first and
+        // by index among equal ones. Indexed like the names, missing ones
+        // are 0. Can be changed any time.
+        void Prioritize(const std::vector<float> &priorities);
+
+        // Takes a finished texture in whatever order they finish, waits for
+        // one if none is. Returns false once all of them were taken. The
+        // texture is the caller's to unload.
+        bool Next(DecodedTexture &texture);
+        // Same without waiting, false if none is finished yet
+        bool TryNext(DecodedTexture &texture);
+
+        // Decodes on the calling thread for about budgetMs when there's no
+        // pool thread doing it in the background, otherwise does nothing
+        void Pump(double budgetMs);
+
+        // Drops the textures not started yet and waits for the decodes
+        // running, after it nothing touches the file system anymore. The
+        // finished ones can still be taken.
+        void Cancel();
+
+        // Textures not taken yet
+        size_t Remaining();
+
+    private:
+        Jobs::TaskGroup group;
+        TextureCache *cache = nullptr;
+        bool background = false;
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<std::string> names;
+        std::vector<float> priorities;
+        std::vector<int> waiting; // not started yet
+        std::deque<DecodedTexture> finished;
+        size_t remaining = 0;
+
+        bool Pop(DecodedTexture &texture);
+        bool DecodeNext();
+    };
+}
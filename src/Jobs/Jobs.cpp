@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Jobs.hpp"
+
+namespace Jobs
+{
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup *group;
+    };
+
+    // One thread's tasks. The owner takes the newest task, thieves take the
+    // oldest, which tends to be the biggest piece of work left.
+    class WorkQueue
+    {
+    public:
+        void Push(Task &&task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+
+        bool PopNewest(Task &task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+
+            task = std::move(tasks.back());
+            tasks.pop_back();
+            return true;
+        }
+
+        bool PopOldest(Task &task)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty())
+                return false;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    class Pool;
+
+    // Queue of the current thread, queue 0 is shared by threads outside the pool
+    static thread_local Pool *currentPool = nullptr;
+    static thread_local int currentQueue = 0;
+
+    class Pool
+    {
+    public:
+        explicit Pool(int threadCount) : queues(threadCount)
+        {
+            for (auto &queue : queues)
+                queue = std::make_unique<WorkQueue>();
+
+            for (int i = 1; i < threadCount; i++)
+                threads.emplace_back([this, i] { WorkerLoop(i); });
+        }
+
+        ~Pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+            for (std::thread &thread : threads)
+                thread.join();
+        }
+
+        int ThreadCount() const
+        {
+            return (int)queues.size();
+        }
+
+        void Push(Task &&task)
+        {
+            queues[QueueIndex()]->Push(std::move(task));
+
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued++;
+            }
+
+            wake.notify_one();
+        }
+
+        // Takes a task from this thread's queue or steals one, false if
+        // there's nothing to do
+        bool Take(Task &task)
+        {
+            int self = QueueIndex();
+            int count = (int)queues.size();
+
+            if (queues[self]->PopNewest(task))
+                return Taken();
+
+            for (int i = 1; i < count; i++)
+            {
+                if (queues[(self + i) % count]->PopOldest(task))
+                    return Taken();
+            }
+
+            return false;
+        }
+
+        static void RunTask(Task &task)
+        {
+            task.fn();
+            task.group->TaskDone();
+        }
+
+    private:
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<std::thread> threads;
+
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        int queued = 0; // tasks in all queues
+        bool stopping = false;
+
+        int QueueIndex() const
+        {
+            return currentPool == this ? currentQueue : 0;
+        }
+
+        bool Taken()
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued--;
+            return true;
+        }
+
+        void WorkerLoop(int index)
+        {
+            currentPool = this;
+            currentQueue = index;
+
+            for (;;)
+            {
+                Task task;
+                if (Take(task))
+                {
+                    RunTask(task);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this] { return stopping || queued > 0; });
+
+                if (stopping)
+                    return;
+            }
+        }
+    };
+
+    static int requestedThreads = 0;
+    static std::unique_ptr<Pool> pool;
+    static std::once_flag poolOnce;
+
+    static Pool &GetPool()
+    {
+        std::call_once(poolOnce, [] {
+            if (!pool)
+            {
+                int count = requestedThreads > 0 ? requestedThreads : (int)std::thread::hardware_concurrency();
+                pool = std::make_unique<Pool>(count > 0 ? count : 1);
+            }
+        });
+
+        return *pool;
+    }
+
+    int ThreadCount()
+    {
+        return GetPool().ThreadCount();
+    }
+
+    void SetThreadCount(int count)
+    {
+        requestedThreads = count;
+        int threads = count > 0 ? count : (int)std::thread::hardware_concurrency();
+
+        GetPool();
+        pool.reset();
+        pool = std::make_unique<Pool>(threads > 0 ? threads : 1);
+    }
+
+    void TaskGroup::Run(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+        }
+
+        Pool &workers = GetPool();
+        if (workers.ThreadCount() == 1)
+        {
+            fn();
+            TaskDone();
+            return;
+        }
+
+        workers.Push({std::move(fn), this});
+    }
+
+    void TaskGroup::Wait()
+    {
+        Pool &workers = GetPool();
+
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pending == 0)
+                    return;
+            }
+
+            // help out instead of blocking, the task may not be ours
+            Task task;
+            if (workers.Take(task))
+            {
+                Pool::RunTask(task);
+                continue;
+            }
+
+            // the rest is running elsewhere, check again now and then in
+            // case more tasks show up
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending == 0; });
+        }
+    }
+
+    void TaskGroup::TaskDone()
+    {
+        // under the lock, so Wait can't return and free the group before
+        // the notify is done
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            finished.notify_all();
+    }
+
+    // Tasks per thread a ParallelFor is split into, more than one so threads
+    // that finish early have something to steal
+    static const size_t TASKS_PER_THREAD = 4;
+
+    void ParallelFor(size_t count, const std::function<void(size_t)> &fn)
+    {
+        if (count == 0)
+            return;
+
+        int threads = ThreadCount();
+
+        if (count == 1 || threads == 1)
+        {
+            for (size_t i = 0; i < count; i++)
+                fn(i);
+            return;
+        }
+
+        size_t taskCount = std::min(count, (size_t)threads * TASKS_PER_THREAD);
+
+        TaskGroup group;
+        for (size_t t = 0; t < taskCount; t++)
+        {
+            size_t begin = count * t / taskCount;
+            size_t end = count * (t + 1) / taskCount;
+
+            group.Run([&fn, begin, end] {
+                for (size_t i = begin; i < end; i++)
+                    fn(i);
+            });
+        }
+
+        group.Wait();
+    }
+}
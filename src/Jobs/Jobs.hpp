@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+// Process wide work stealing pool. Every worker has its own task queue, new
+// tasks go to the queue of the thread that makes them and idle workers
+// steal from the others.
+namespace Jobs
+{
+    // Number of threads work is spread over, including the calling thread
+    int ThreadCount();
+
+    // Resizes the pool, 0 means one thread per hardware thread. Must not be
+    // called while any work is running.
+    void SetThreadCount(int count);
+
+    // Tasks that are waited on together
+    class TaskGroup
+    {
+    public:
+        TaskGroup() = default;
+        ~TaskGroup() { Wait(); }
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        // Queues fn on the pool
+        void Run(std::function<void()> fn);
+
+        // Returns once every task of the group has run. The waiting thread
+        // runs queued tasks in the meantime, so groups can be nested.
+        void Wait();
+
+    private:
+        friend class Pool;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        int pending = 0;
+
+        void TaskDone();
+    };
+
+    // Runs fn(i) for every i in [0, count) on the pool and the calling thread,
+    // returns once all of them are done. Calls may be nested.
+    void ParallelFor(size_t count, const std::function<void(size_t)> &fn);
+}
@@ -1,69 +1,25 @@
 #include <algorithm>
 #include "map.hpp"
+#include "VertexWelder.hpp"
 
-bool isEqual(vec3 &a, vec3 &b)
-{
-    return glm::length(a - b) < 0.001f;
-}
-
-bool isPointInList(vec3 &point, std::vector<vec3> &list)
-{
-    for (auto &v : list)
-    {
-        if (isEqual(point, v))
-            return true;
-    }
-    return false;
-}
+// Most points a winding keeps on the stack. A face clipped by k planes has
+// at most 4 + k points, brushes with more faces than that clip on the heap.
+static const int MAX_WINDING_POINTS = 256;
 
-bool isPointLegal(vec3 &p, Brush *brush)
-{
-    for (auto &face : brush->faces)
-    {
-        vec3 facing = normalize(p - face.GetCenter());
-        if (dot(facing, face.GetNormal()) < -0.001f)
-            return false;
-    }
-    return true;
-}
+// Points closer than this to a clip plane are on it
+static const float CLIP_EPSILON = 1e-3f;
 
-vec3 Brush::GetCenter()
+// Convex polygon in storage owned by the caller
+struct Winding
 {
-    if (glm::length(center) < 0.001f)
-    {
-        center = vec3(0.0f);
-
-        for (auto &vertex : vertices)
-        {
-            center += vertex;
-        }
-
-        center /= static_cast<float>(vertices.size());
-        return center;
-    }
-
-    return center;
-}
-
-AABB Brush::GetAABB()
-{
-    if (aabb.min == vec3(0.0f) && aabb.max == vec3(0.0f))
-    {
-        for (auto &vertex : vertices)
-        {
-            aabb.min = glm::min(aabb.min, vertex);
-            aabb.max = glm::max(aabb.max, vertex);
-        }
-    }
-
-    return aabb;
-}
+    vec3 *points = nullptr;
+    int count = 0;
+    int capacity = 0;
+};
 
 // — WindingForFace: build one giant quad in the face’s plane —
-static std::vector<vec3> WindingForFace(Face &f, float large = 8192.0f)
+static void WindingForFace(const vec3 &n, float d, Winding &w, float large = 8192.0f)
 {
-    vec3 n = f.GetNormal();
-    float d = f.GetDistance();
     // pick an arbitrary “right” axis not parallel to n
     vec3 up = (fabs(n.z) < 0.9f ? vec3(0, 0, 1) : vec3(1, 0, 0));
     vec3 u = glm::normalize(glm::cross(up, n));
@@ -71,94 +27,179 @@ static std::vector<vec3> WindingForFace(Face &f, float large = 8192.0f)
     // center on the plane
     vec3 origin = n * d;
     // build a huge quad
-    std::vector<vec3> w(4);
-    w[0] = origin + (u + v) * large;
-    w[1] = origin + (-u + v) * large;
-    w[2] = origin + (-u + -v) * large;
-    w[3] = origin + (u + -v) * large;
-    return w;
+    w.points[0] = origin + (u + v) * large;
+    w.points[1] = origin + (-u + v) * large;
+    w.points[2] = origin + (-u + -v) * large;
+    w.points[3] = origin + (u + -v) * large;
+    w.count = 4;
 }
 
 // — ClipToPlane: Sutherland–Hodgman clip of polygon against plane —
-static std::vector<vec3> ClipToPlane(const std::vector<vec3> &in,
-                                     const vec3 &clipN, float clipD,
-                                     float eps = 1e-3f)
+// Keeps the front of the plane. sides holds in.count floats of scratch.
+// Returns the clipped winding, which is in itself when the plane misses it
+// and out otherwise, or null if the result doesn't fit in out.
+static const Winding *ClipToPlane(const Winding &in, Winding &out, float *sides, const vec3 &clipN, float clipD)
 {
-    std::vector<vec3> out;
-    auto side = [&](const vec3 &p)
-    { return glm::dot(clipN, p) - clipD; };
-    for (size_t i = 0, n = in.size(); i < n; ++i)
+    // the side of every point first, a plain loop the compiler can vectorize
+    bool allFront = true, allBehind = true;
+    for (int i = 0; i < in.count; i++)
+    {
+        sides[i] = glm::dot(clipN, in.points[i]) - clipD;
+        allFront &= sides[i] > 0;
+        allBehind &= sides[i] < -CLIP_EPSILON;
+    }
+
+    // nothing crosses the plane
+    if (allFront)
+        return &in;
+    out.count = 0;
+    if (allBehind)
+        return &out;
+
+    for (int i = 0, n = in.count; i < n; ++i)
     {
-        const vec3 &P = in[i];
-        const vec3 &Q = in[(i + 1) % n];
-        float sP = side(P), sQ = side(Q);
-        if (sP >= -eps)
-            out.push_back(P);
-        if ((sP > 0) != (sQ > 0))
+        int j = i + 1 < n ? i + 1 : 0;
+        const vec3 &P = in.points[i];
+        const vec3 &Q = in.points[j];
+        float sP = sides[i], sQ = sides[j];
+        bool crosses = (sP > 0) != (sQ > 0);
+
+        if (out.count + (sP >= -CLIP_EPSILON) + crosses > out.capacity)
+            return nullptr;
+
+        if (sP >= -CLIP_EPSILON)
+            out.points[out.count++] = P;
+        if (crosses)
         {
             // edge crosses plane → compute intersection
             float t = sP / (sP - sQ);
-            out.push_back(P + t * (Q - P));
+            out.points[out.count++] = P + t * (Q - P);
         }
     }
-    return out;
+    return &out;
 }
 
-void Brush::CalculateGeometry()
+// Builds the winding of a face and clips it against every other plane of
+// the brush, a face on the same plane leaves the winding as it is. Both
+// windings need the same capacity and sides as many floats. Returns the
+// winding, empty if nothing is left, or null if it outgrew the capacity.
+static const Winding *ClipFace(const PlaneTable &planes, Span<const Face> faces, const Face &face,
+                               Winding windings[2], float *sides)
 {
-    vertices.clear();
+    WindingForFace(planes.Normal(face.plane), planes.Distance(face.plane), windings[0]);
+    const Winding *poly = &windings[0];
+
+    for (const Face &other : faces)
+    {
+        if (other.plane == face.plane)
+            continue;
+
+        Winding &spare = poly == &windings[0] ? windings[1] : windings[0];
+        poly = ClipToPlane(*poly, spare, sides, planes.Normal(other.plane), planes.Distance(other.plane));
+        if (!poly || poly->count == 0)
+            break;
+    }
+    return poly;
+}
+
+void Brush::CalculateGeometry(Map &map)
+{
+    CalculateGeometry(map, map.vertices, map.faceIndices);
+}
+
+void Brush::CalculateGeometry(Map &map, std::vector<vec3> &vertices, std::vector<int> &indices)
+{
+    const PlaneTable &planes = map.planes;
+    Span<Face> faces = map.GetFaces(*this);
+
+    firstVertex = (int)vertices.size();
+    vertexCount = 0;
+
+    // one per thread, its table is reused from brush to brush
+    static thread_local VertexWelder welder;
+    welder.Begin(vertices);
+
+    // windings live on the stack unless the brush has too many faces for
+    // it. The heap buffers are per thread and kept from brush to brush.
+    vec3 stackPoints[2][MAX_WINDING_POINTS];
+    float stackSides[MAX_WINDING_POINTS];
+    static thread_local std::vector<vec3> heapPoints;
+    static thread_local std::vector<float> heapSides;
 
     // for each face, build & clip its winding
     for (Face &face : faces)
     {
-        // 1) start with huge quad in this face’s plane
-        auto poly = WindingForFace(face);
+        vec3 normal = planes.Normal(face.plane);
+
+        // 1) & 2) start with a huge quad in this face's plane and clip it
+        //    against the other planes. Points on a clip plane can add a
+        //    near duplicate, so a winding that still outgrows its buffer
+        //    is redone with twice the room rather than dropped.
+        Winding windings[2];
+        const Winding *poly = nullptr;
+        for (int capacity = (int)faces.size + 4; !poly; capacity *= 2)
+        {
+            float *sides = stackSides;
+            windings[0].points = stackPoints[0];
+            windings[1].points = stackPoints[1];
+            if (capacity > MAX_WINDING_POINTS)
+            {
+                if (heapSides.size() < (size_t)capacity)
+                {
+                    heapPoints.resize((size_t)capacity * 2);
+                    heapSides.resize(capacity);
+                }
+                sides = heapSides.data();
+                windings[0].points = heapPoints.data();
+                windings[1].points = heapPoints.data() + capacity;
+            }
+            windings[0].capacity = windings[1].capacity = capacity;
 
-        // 2) clip against every *other* brush plane
-        for (Face &other : faces)
-            if (&other != &face)
-                poly = ClipToPlane(poly,
-                                   other.GetNormal(),
-                                   other.GetDistance());
+            poly = ClipFace(planes, {faces.data, faces.size}, face, windings, sides);
+        }
 
         // 3) collect each remaining vertex
-        face.vertices.clear();
-        for (auto &p : poly)
+        face.firstIndex = (int)indices.size();
+        face.indexCount = 0;
+        for (int i = 0; i < poly->count; i++)
         {
             // add to brush‐wide unique list
-            auto it = std::find_if(vertices.begin(), vertices.end(),
-                                   [&](const vec3 &v)
-                                   { return glm::length(v - p) < 1e-3f; });
-            int idx;
-
-            if (it == vertices.end())
-            {
-                idx = vertices.size();
-                vertices.push_back(p);
-            }
-            else
-            {
-                idx = int(std::distance(vertices.begin(), it));
-            }
-
-            face.vertices.push_back(idx);
+            indices.push_back(welder.Weld(poly->points[i]));
         }
 
-        if (face.vertices.size() >= 3) {
-            auto polyVerts = face.GetVertices();
+        face.indexCount = (int)indices.size() - face.firstIndex;
+
+        if (face.indexCount >= 3) {
+            int *winding = &indices[face.firstIndex];
             // grab three consecutive points in your wound polygon
-            const vec3 &v0 = polyVerts[0];
-            const vec3 &v1 = polyVerts[1];
-            const vec3 &v2 = polyVerts[2];
+            const vec3 &v0 = vertices[winding[0]];
+            const vec3 &v1 = vertices[winding[1]];
+            const vec3 &v2 = vertices[winding[2]];
         
             // compute the winding-normal of that little triangle
             vec3 windingNormal = glm::normalize( glm::cross(v1 - v0, v2 - v0) );
         
             // compare against the face’s true plane normal
-            if (glm::dot(windingNormal, face.GetNormal()) > 0.0f) {
+            if (glm::dot(windingNormal, normal) > 0.0f) {
                 // it’s backwards — flip the entire loop
-                std::reverse(face.vertices.begin(), face.vertices.end());
+                std::reverse(winding, winding + face.indexCount);
             }
         }
     }
+
+    vertexCount = (int)vertices.size() - firstVertex;
+
+    center = vec3(0.0f);
+    aabb = {vec3(0.0f), vec3(0.0f)};
+    if (vertexCount > 0)
+    {
+        aabb = {vertices[firstVertex], vertices[firstVertex]};
+        for (int i = firstVertex; i < firstVertex + vertexCount; i++)
+        {
+            center += vertices[i];
+            aabb.min = glm::min(aabb.min, vertices[i]);
+            aabb.max = glm::max(aabb.max, vertices[i]);
+        }
+        center /= static_cast<float>(vertexCount);
+    }
 }
@@ -0,0 +1,545 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "CompiledMap.hpp"
+#include "Parser.hpp"
+#include "../FS/Hash.hpp"
+
+enum CompiledSection
+{
+    SECTION_STRINGS,
+    SECTION_TEXTURES,
+    SECTION_MODELS,
+    SECTION_ENTITIES,
+    SECTION_PROPERTIES,
+    SECTION_BRUSHES,
+    SECTION_PLANES,
+    SECTION_FACES,
+    SECTION_FACE_INDICES,
+    SECTION_VERTICES,
+    SECTION_FACE_UVS,
+    SECTION_PATCHES,
+    SECTION_PATCH_VERTS,
+    SECTION_COUNT
+};
+
+// Element size of every section, bounds its count by the file size on open
+static const size_t sectionElementSizes[SECTION_COUNT] = {
+    sizeof(char),
+    sizeof(CompiledString),
+    sizeof(CompiledString),
+    sizeof(CompiledEntity),
+    sizeof(CompiledProperty),
+    sizeof(CompiledBrush),
+    sizeof(CompiledPlane),
+    sizeof(CompiledFace),
+    sizeof(uint32_t),
+    sizeof(vec3),
+    sizeof(vec2),
+    sizeof(CompiledPatch),
+    sizeof(PatchVert),
+};
+
+// Sections start on this boundary so every array can be used in place
+static const size_t SECTION_ALIGNMENT = 16;
+
+static const char MAGIC[4] = {'C', 'M', 'A', 'P'};
+
+struct CompiledHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+
+    struct
+    {
+        uint64_t offset, count;
+    } sections[SECTION_COUNT];
+};
+
+static_assert(sizeof(vec3) == 12 && sizeof(vec2) == 8, "vectors must be tightly packed");
+static_assert(sizeof(PatchVert) == 32, "PatchVert must be tightly packed");
+
+CompiledMap::CompiledMap(CompiledMap &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+CompiledMap &CompiledMap::operator=(CompiledMap &&other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        file = std::move(other.file);
+        buffer = std::move(other.buffer);
+        data = other.data;
+        size = other.size;
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    return *this;
+}
+
+bool CompiledMap::Load(const char *mapFile, const char *cacheFile, CompiledMap &out)
+{
+    ParseContext context;
+    return Load(mapFile, cacheFile, out, context);
+}
+
+bool CompiledMap::Load(const char *mapFile, const char *cacheFile, CompiledMap &out, ParseContext &context)
+{
+    uint64_t hash;
+    if (!HashSource(mapFile, hash))
+    {
+        reportOpenError(context, mapFile);
+        return false;
+    }
+
+    if (out.Open(cacheFile, hash))
+        return true;
+
+    Map map;
+    if (!Map::Load(mapFile, map, context))
+        return false;
+
+    map.CalculateGeometry();
+    out.Compile(map, hash);
+
+    if (!out.Save(cacheFile))
+        fprintf(stderr, "Failed to write map cache %s\n", cacheFile);
+
+    return true;
+}
+
+bool CompiledMap::HashSource(const char *fileName, uint64_t &hash)
+{
+    FS::MappedFile source;
+    if (!source.Open(fileName))
+        return false;
+
+    hash = FS::Hash64(source.Data(), source.Size());
+    return true;
+}
+
+bool CompiledMap::Open(const char *fileName, uint64_t sourceHash)
+{
+    Close();
+
+    // a missing cache is the normal first run, not an error worth printing
+    FILE *exists = fopen(fileName, "rb");
+    if (!exists)
+        return false;
+    fclose(exists);
+
+    FS::MappedFile mapped;
+    if (!mapped.Open(fileName) || mapped.Size() < sizeof(CompiledHeader))
+        return false;
+
+    CompiledHeader header;
+    memcpy(&header, mapped.Data(), sizeof(header));
+
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+        header.sourceHash != sourceHash)
+        return false;
+
+    // every section has to fit in the file
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        uint64_t offset = header.sections[i].offset;
+        uint64_t count = header.sections[i].count;
+
+        if (offset % SECTION_ALIGNMENT != 0 || offset > mapped.Size() ||
+            count > (mapped.Size() - offset) / sectionElementSizes[i])
+            return false;
+    }
+
+    file = std::move(mapped);
+    data = file.Data();
+    size = file.Size();
+
+    // and what the sections refer to has to be in them
+    if (!Validate())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+// True if [first, first + count) is inside an array of the given size
+static bool InRange(uint64_t first, uint64_t count, size_t size)
+{
+    return first <= size && count <= size - first;
+}
+
+bool CompiledMap::Validate() const
+{
+    CompiledArray<char> strings = Section<char>(SECTION_STRINGS);
+    CompiledArray<CompiledString> textures = Textures();
+    CompiledArray<CompiledString> models = Models();
+    CompiledArray<CompiledEntity> entities = Entities();
+    CompiledArray<CompiledProperty> properties = Properties();
+    CompiledArray<CompiledBrush> brushes = Brushes();
+    CompiledArray<CompiledPlane> planes = Planes();
+    CompiledArray<CompiledFace> faces = Faces();
+    CompiledArray<uint32_t> faceIndices = FaceIndices();
+    CompiledArray<vec3> vertices = Vertices();
+    CompiledArray<vec2> faceUVs = FaceUVs();
+    CompiledArray<CompiledPatch> patches = Patches();
+    CompiledArray<PatchVert> patchVerts = PatchVerts();
+
+    // strings are followed by their NUL
+    auto validString = [&](CompiledString string)
+    {
+        return InRange(string.offset, (uint64_t)string.length + 1, strings.size) &&
+               strings[string.offset + string.length] == '\0';
+    };
+    for (const CompiledString &string : textures)
+    {
+        if (!validString(string))
+            return false;
+    }
+    for (const CompiledString &string : models)
+    {
+        if (!validString(string))
+            return false;
+    }
+    for (const CompiledProperty &property : properties)
+    {
+        if (!validString(property.key) || !validString(property.value))
+            return false;
+    }
+
+    for (const CompiledEntity &entity : entities)
+    {
+        if (!InRange(entity.firstProperty, entity.propertyCount, properties.size) ||
+            !InRange(entity.firstBrush, entity.brushCount, brushes.size) ||
+            !InRange(entity.firstPatch, entity.patchCount, patches.size))
+            return false;
+    }
+
+    for (const CompiledBrush &brush : brushes)
+    {
+        if (brush.entity >= entities.size || !InRange(brush.firstFace, brush.faceCount, faces.size) ||
+            !InRange(brush.firstVertex, brush.vertexCount, vertices.size))
+            return false;
+    }
+
+    // planes come in pairs, the opposite of plane i is i ^ 1
+    if (planes.size % 2 != 0)
+        return false;
+
+    for (const CompiledFace &face : faces)
+    {
+        if (face.brush >= brushes.size || face.plane >= planes.size || face.texture >= textures.size ||
+            !InRange(face.firstIndex, face.indexCount, faceIndices.size))
+            return false;
+    }
+
+    // one UV per face index
+    if (faceUVs.size != faceIndices.size)
+        return false;
+    for (uint32_t index : faceIndices)
+    {
+        if (index >= vertices.size)
+            return false;
+    }
+
+    for (const CompiledPatch &patch : patches)
+    {
+        if (patch.entity >= entities.size || patch.texture >= textures.size || patch.width < 0 ||
+            patch.height < 0 || patch.rows < 0 || patch.columns < 0 ||
+            !InRange(patch.firstControlPoint, (uint64_t)patch.width * (uint64_t)patch.height, patchVerts.size) ||
+            !InRange(patch.firstVertex, (uint64_t)patch.rows * (uint64_t)patch.columns, patchVerts.size))
+            return false;
+    }
+
+    return true;
+}
+
+void CompiledMap::Close()
+{
+    file.Close();
+    buffer.clear();
+    buffer.shrink_to_fit();
+    data = nullptr;
+    size = 0;
+}
+
+// Appends an array to the file image as the given section
+template <typename T>
+static void WriteSection(std::vector<char> &out, CompiledHeader &header, int section, const std::vector<T> &items)
+{
+    size_t offset = (out.size() + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    size_t bytes = items.size() * sizeof(T);
+
+    out.resize(offset + bytes);
+    if (bytes)
+        memcpy(&out[offset], items.data(), bytes);
+
+    header.sections[section].offset = offset;
+    header.sections[section].count = items.size();
+}
+
+// Collects the arrays of the file while walking the map
+struct CompileState
+{
+    std::vector<char> strings;
+    std::vector<CompiledString> textures;
+    std::vector<CompiledString> models;
+    std::vector<CompiledEntity> entities;
+    std::vector<CompiledProperty> properties;
+    std::vector<CompiledBrush> brushes;
+    std::vector<CompiledPlane> planes;
+    std::vector<CompiledFace> faces;
+    std::vector<uint32_t> faceIndices;
+    std::vector<vec3> vertices;
+    std::vector<vec2> faceUVs;
+    std::vector<CompiledPatch> patches;
+    std::vector<PatchVert> patchVerts;
+
+    CompiledString AddString(const std::string &text)
+    {
+        CompiledString string = {(uint32_t)strings.size(), (uint32_t)text.size()};
+        strings.insert(strings.end(), text.begin(), text.end());
+        strings.push_back('\0');
+        return string;
+    }
+
+    void AddFace(const Map &map, const Face &face, uint32_t brush, uint32_t firstVertex, int mapFirstVertex)
+    {
+        CompiledFace out;
+        out.brush = brush;
+        out.plane = (uint32_t)face.plane;
+        out.texture = (uint32_t)face.textureId;
+        out.firstIndex = (uint32_t)faceIndices.size();
+        out.indexCount = (uint32_t)face.indexCount;
+        out.projectionType = (int32_t)face.projectionType;
+        out.textureProjection = face.textureProjection;
+        out.p1 = face.p1;
+        out.p2 = face.p2;
+        out.p3 = face.p3;
+        out.flagCount = face.flagCount;
+        for (int i = 0; i < 3; i++)
+            out.flags[i] = face.flags[i];
+
+        // UVs for a 1x1 texture are in texels, the real size is divided in
+        // once the texture is known. Brush primitive UVs are already final.
+        Span<const int> winding = map.GetIndices(face);
+        for (int index : winding)
+            faceIndices.push_back(firstVertex + (uint32_t)(index - mapFirstVertex));
+
+        size_t firstUV = faceUVs.size();
+        faceUVs.resize(firstUV + winding.size);
+        face.GetTextureMatrix(map.GetNormal(face), vec2(1.0f))
+            .Apply(map.vertices.data(), winding.data, (int)winding.size, faceUVs.data() + firstUV);
+        faces.push_back(out);
+    }
+
+    void AddBrush(Map &map, const Brush &brush, uint32_t entity)
+    {
+        CompiledBrush out;
+        out.id = brush.id;
+        out.entity = entity;
+        out.firstFace = (uint32_t)faces.size();
+        out.faceCount = (uint32_t)brush.faceCount;
+        out.firstVertex = (uint32_t)vertices.size();
+        out.vertexCount = (uint32_t)brush.vertexCount;
+        out.center = brush.center;
+        out.mins = brush.aabb.min;
+        out.maxs = brush.aabb.max;
+
+        Span<const vec3> brushVertices = map.GetVertices(brush);
+        vertices.insert(vertices.end(), brushVertices.begin(), brushVertices.end());
+        brushes.push_back(out);
+
+        uint32_t brushIndex = (uint32_t)brushes.size() - 1;
+        for (const Face &face : map.GetFaces(brush))
+            AddFace(map, face, brushIndex, out.firstVertex, brush.firstVertex);
+    }
+
+    void AddPatch(const Map &map, const Patch &patch, uint32_t entity)
+    {
+        CompiledPatch out;
+        out.id = patch.id;
+        out.entity = entity;
+        out.texture = (uint32_t)patch.textureId;
+        out.width = patch.width;
+        out.height = patch.height;
+        for (int i = 0; i < 3; i++)
+            out.flags[i] = patch.flags[i];
+
+        out.firstControlPoint = (uint32_t)patchVerts.size();
+        Span<const PatchVert> controlPoints = map.GetControlPoints(patch);
+        patchVerts.insert(patchVerts.end(), controlPoints.begin(), controlPoints.end());
+
+        out.firstVertex = (uint32_t)patchVerts.size();
+        out.rows = (int32_t)patch.rows;
+        out.columns = (int32_t)patch.columns;
+        Span<const PatchVert> grid = map.GetPatchVertices(patch);
+        patchVerts.insert(patchVerts.end(), grid.begin(), grid.end());
+
+        patches.push_back(out);
+    }
+
+    void AddEntity(Map &map, const Entity &entity)
+    {
+        CompiledEntity out;
+        out.id = entity.id;
+        out.firstProperty = (uint32_t)properties.size();
+        out.propertyCount = (uint32_t)entity.properties.size();
+        out.firstBrush = (uint32_t)brushes.size();
+        out.brushCount = (uint32_t)entity.brushCount;
+        out.firstPatch = (uint32_t)patches.size();
+        out.patchCount = (uint32_t)entity.patchCount;
+
+        for (const auto &pair : entity.properties)
+            properties.push_back({AddString(pair.first), AddString(pair.second)});
+
+        uint32_t entityIndex = (uint32_t)entities.size();
+        entities.push_back(out);
+
+        for (const Brush &brush : map.GetBrushes(entity))
+            AddBrush(map, brush, entityIndex);
+        for (const Patch &patch : map.GetPatches(entity))
+            AddPatch(map, patch, entityIndex);
+    }
+};
+
+void CompiledMap::Compile(Map &map, uint64_t sourceHash)
+{
+    Close();
+
+    CompileState state;
+
+    // the map's plane table as is, compiled faces keep their plane indices
+    state.planes.reserve(map.planes.Count());
+    for (int i = 0; i < (int)map.planes.Count(); i++)
+        state.planes.push_back({map.planes.Normal(i), map.planes.Distance(i)});
+
+    for (Entity &entity : map.entities)
+        state.AddEntity(map, entity);
+
+    // compiled texture IDs are the map's
+    for (const std::string &texture : map.textures)
+        state.textures.push_back(state.AddString(texture));
+    for (const std::string &model : map.models)
+        state.models.push_back(state.AddString(model));
+
+    CompiledHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.sourceHash = sourceHash;
+
+    buffer.resize(sizeof(header));
+    WriteSection(buffer, header, SECTION_STRINGS, state.strings);
+    WriteSection(buffer, header, SECTION_TEXTURES, state.textures);
+    WriteSection(buffer, header, SECTION_MODELS, state.models);
+    WriteSection(buffer, header, SECTION_ENTITIES, state.entities);
+    WriteSection(buffer, header, SECTION_PROPERTIES, state.properties);
+    WriteSection(buffer, header, SECTION_BRUSHES, state.brushes);
+    WriteSection(buffer, header, SECTION_PLANES, state.planes);
+    WriteSection(buffer, header, SECTION_FACES, state.faces);
+    WriteSection(buffer, header, SECTION_FACE_INDICES, state.faceIndices);
+    WriteSection(buffer, header, SECTION_VERTICES, state.vertices);
+    WriteSection(buffer, header, SECTION_FACE_UVS, state.faceUVs);
+    WriteSection(buffer, header, SECTION_PATCHES, state.patches);
+    WriteSection(buffer, header, SECTION_PATCH_VERTS, state.patchVerts);
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    data = buffer.data();
+    size = buffer.size();
+}
+
+bool CompiledMap::Save(const char *fileName) const
+{
+    if (!data)
+        return false;
+
+    // written next to the target and renamed over it, so a reader never sees
+    // a partial file
+    std::string tempName = std::string(fileName) + ".tmp";
+    FILE *out = fopen(tempName.c_str(), "wb");
+    if (!out)
+        return false;
+
+    bool ok = fwrite(data, 1, size, out) == size;
+    ok = fclose(out) == 0 && ok;
+
+    if (ok)
+    {
+        remove(fileName);
+        ok = rename(tempName.c_str(), fileName) == 0;
+    }
+
+    if (!ok)
+        remove(tempName.c_str());
+
+    return ok;
+}
+
+uint64_t CompiledMap::SourceHash() const
+{
+    if (!data)
+        return 0;
+
+    CompiledHeader header;
+    memcpy(&header, data, sizeof(header));
+    return header.sourceHash;
+}
+
+template <typename T>
+CompiledArray<T> CompiledMap::Section(int section) const
+{
+    CompiledArray<T> array;
+    if (!data)
+        return array;
+
+    const CompiledHeader *header = (const CompiledHeader *)data;
+    array.data = (const T *)(data + header->sections[section].offset);
+    array.size = (size_t)header->sections[section].count;
+    return array;
+}
+
+CompiledArray<CompiledString> CompiledMap::Textures() const { return Section<CompiledString>(SECTION_TEXTURES); }
+CompiledArray<CompiledString> CompiledMap::Models() const { return Section<CompiledString>(SECTION_MODELS); }
+CompiledArray<CompiledEntity> CompiledMap::Entities() const { return Section<CompiledEntity>(SECTION_ENTITIES); }
+CompiledArray<CompiledProperty> CompiledMap::Properties() const { return Section<CompiledProperty>(SECTION_PROPERTIES); }
+CompiledArray<CompiledBrush> CompiledMap::Brushes() const { return Section<CompiledBrush>(SECTION_BRUSHES); }
+CompiledArray<CompiledPlane> CompiledMap::Planes() const { return Section<CompiledPlane>(SECTION_PLANES); }
+CompiledArray<CompiledFace> CompiledMap::Faces() const { return Section<CompiledFace>(SECTION_FACES); }
+CompiledArray<uint32_t> CompiledMap::FaceIndices() const { return Section<uint32_t>(SECTION_FACE_INDICES); }
+CompiledArray<vec3> CompiledMap::Vertices() const { return Section<vec3>(SECTION_VERTICES); }
+CompiledArray<vec2> CompiledMap::FaceUVs() const { return Section<vec2>(SECTION_FACE_UVS); }
+CompiledArray<CompiledPatch> CompiledMap::Patches() const { return Section<CompiledPatch>(SECTION_PATCHES); }
+CompiledArray<PatchVert> CompiledMap::PatchVerts() const { return Section<PatchVert>(SECTION_PATCH_VERTS); }
+
+std::string_view CompiledMap::String(CompiledString string) const
+{
+    CompiledArray<char> strings = Section<char>(SECTION_STRINGS);
+    if (string.offset > strings.size || string.length > strings.size - string.offset)
+        return std::string_view();
+
+    return std::string_view(strings.data + string.offset, string.length);
+}
+
+std::string_view CompiledMap::TextureName(uint32_t texture) const
+{
+    CompiledArray<CompiledString> textures = Textures();
+    return texture < textures.size ? String(textures[texture]) : std::string_view();
+}
+
+std::string_view CompiledMap::GetProperty(const CompiledEntity &entity, std::string_view key) const
+{
+    CompiledArray<CompiledProperty> properties = Properties();
+
+    for (uint32_t i = 0; i < entity.propertyCount; i++)
+    {
+        const CompiledProperty &property = properties[entity.firstProperty + i];
+        if (String(property.key) == key)
+            return String(property.value);
+    }
+
+    return std::string_view();
+}
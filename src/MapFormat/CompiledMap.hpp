@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "map.hpp"
+#include "../FS/MappedFile.hpp"
+
+// A map with its geometry already built, stored as flat arrays that are used
+// straight from the mapped file. Everything refers to other records by index,
+// so the data can live at any address. The file is little endian and only
+// used on the machine that wrote it.
+
+// String in the string table, always followed by a NUL
+struct CompiledString
+{
+    uint32_t offset, length;
+};
+
+struct CompiledEntity
+{
+    int32_t id;
+    uint32_t firstProperty, propertyCount;
+    uint32_t firstBrush, brushCount;
+    uint32_t firstPatch, patchCount;
+};
+
+struct CompiledProperty
+{
+    CompiledString key, value;
+};
+
+struct CompiledBrush
+{
+    int32_t id;
+    uint32_t entity;
+    uint32_t firstFace, faceCount;
+    uint32_t firstVertex, vertexCount; // welded vertices of the brush
+    vec3 center;
+    vec3 mins, maxs;
+};
+
+// The map's deduplicated planes, plane i ^ 1 is the opposite of plane i
+struct CompiledPlane
+{
+    vec3 normal;
+    float distance;
+};
+
+struct CompiledFace
+{
+    uint32_t brush;
+    uint32_t plane;
+    uint32_t texture;
+    // range of the face's winding in the index and UV arrays, the indices
+    // point into the vertex array
+    uint32_t firstIndex, indexCount;
+
+    int32_t projectionType;
+    TextureProjection textureProjection;
+    vec3 p1, p2, p3;
+    int32_t flags[3];
+    int32_t flagCount;
+};
+
+struct CompiledPatch
+{
+    int32_t id;
+    uint32_t entity;
+    uint32_t texture;
+    int32_t width, height;
+    int32_t flags[3];
+    uint32_t firstControlPoint;  // width * height, row-major
+    uint32_t firstVertex;        // tessellated grid, row-major
+    int32_t rows, columns;
+};
+
+// Read only view of one of the arrays
+template <typename T>
+struct CompiledArray
+{
+    const T *data = nullptr;
+    size_t size = 0;
+
+    const T *begin() const { return data; }
+    const T *end() const { return data + size; }
+    const T &operator[](size_t i) const { return data[i]; }
+};
+
+class CompiledMap
+{
+public:
+    // Bump whenever the layout of the file or what's baked into it changes,
+    // older caches are rebuilt. 2: patch grids tessellated by curvature,
+    // 3: brushDef brushes, 4: deduplicated plane table with opposite planes
+    // paired, faces index it.
+    static const uint32_t VERSION = 4;
+
+    CompiledMap() = default;
+    CompiledMap(CompiledMap &&other) noexcept;
+    CompiledMap &operator=(CompiledMap &&other) noexcept;
+    CompiledMap(const CompiledMap &) = delete;
+    CompiledMap &operator=(const CompiledMap &) = delete;
+
+    // Loads a map through its cache file. The cache is used if it was built
+    // from the same source contents, otherwise the map is parsed and compiled
+    // and the cache rewritten. Failing to write the cache is only a warning.
+    static bool Load(const char *mapFile, const char *cacheFile, CompiledMap &out);
+    static bool Load(const char *mapFile, const char *cacheFile, CompiledMap &out, ParseContext &context);
+
+    // Content hash of a map source, the key of its cache
+    static bool HashSource(const char *fileName, uint64_t &hash);
+
+    // Maps a cache file, fails if it isn't a valid cache of this source hash
+    bool Open(const char *fileName, uint64_t sourceHash);
+
+    // Compiles a map in memory, its geometry must have been calculated
+    void Compile(Map &map, uint64_t sourceHash);
+
+    bool Save(const char *fileName) const;
+    void Close();
+
+    bool IsOpen() const { return data != nullptr; }
+    uint64_t SourceHash() const;
+
+    CompiledArray<CompiledString> Textures() const;
+    CompiledArray<CompiledString> Models() const;
+    CompiledArray<CompiledEntity> Entities() const;
+    CompiledArray<CompiledProperty> Properties() const;
+    CompiledArray<CompiledBrush> Brushes() const;
+    CompiledArray<CompiledPlane> Planes() const;
+    CompiledArray<CompiledFace> Faces() const;
+    CompiledArray<uint32_t> FaceIndices() const;
+    CompiledArray<vec3> Vertices() const;
+    // one per face index, in texels: divide by the texture size. Brush
+    // primitive faces are already in texture units.
+    CompiledArray<vec2> FaceUVs() const;
+    CompiledArray<CompiledPatch> Patches() const;
+    CompiledArray<PatchVert> PatchVerts() const;
+
+    std::string_view String(CompiledString string) const;
+    std::string_view TextureName(uint32_t texture) const;
+    // Value of an entity's key, empty if it doesn't have it
+    std::string_view GetProperty(const CompiledEntity &entity, std::string_view key) const;
+
+private:
+    FS::MappedFile file;
+    std::vector<char> buffer; // compiled in memory instead of mapped
+    const char *data = nullptr;
+    size_t size = 0;
+
+    template <typename T>
+    CompiledArray<T> Section(int section) const;
+    // Checks every index and range a record holds against the arrays it
+    // points into, the accessors and their users follow them unchecked
+    bool Validate() const;
+};
@@ -4,62 +4,21 @@
 #include <glm/gtc/epsilon.hpp>
 #include "map.hpp"
 
-vec3 Face::GetNormal()
-{
-    if (glm::length(normal) < 1e-6f)
-    {
-        vec3 e1 = p2 - p1;
-        vec3 e2 = p3 - p1;
-        normal = glm::normalize(glm::cross(e1, e2));
-    }
-
-    return normal;
-}
-
-float Face::GetDistance()
-{
-    if (std::fabs(distance) < 1e-6f)
-    {
-        vec3 n = GetNormal();
-        distance = glm::dot(n, p1);
-    }
-
-    return distance;
-}
-
-vec3 Face::GetCenter()
-{
-    if (glm::length(center) < 1e-6f)
-    {
-        center = (p1 + p2 + p3) / 3.0f;
-    }
-
-    return center;
-}
-
-std::vector<vec3> Face::GetVertices()
-{
-    std::vector<vec3> verts = {};
-
-    for (auto &idx : vertices)
-    {
-        verts.push_back(parentBrush->vertices[idx]);
-    }
-
-    return verts;
-}
-
 float Deg2Rad(float degrees)
 {
     return degrees * (M_PI / 180.0f);
 }
 
-vec2 GetStandardUV(vec3 &vertex, Face *face)
+static void SetRow(float row[4], const vec3 &axis, float offset)
 {
-    vec2 ret;
-    vec2 textureSize = face->textureSize.x == 0.0f ? vec2(512.0f, 512.0f) : face->textureSize;
-    vec3 normal = face->GetNormal();
+    row[0] = axis.x;
+    row[1] = axis.y;
+    row[2] = axis.z;
+    row[3] = offset;
+}
 
+static TextureMatrix GetStandardMatrix(const vec3 &normal, const StandardUV &projection, vec2 textureSize)
+{
     vec3 UP_VECTOR = vec3(0.0f, 0.0f, 1.0f);
     vec3 RIGHT_VECTOR = vec3(0.0f, 1.0f, 0.0f);
     vec3 FORWARD_VECTOR = vec3(1.0f, 0.0f, 1.0f);
@@ -68,63 +27,104 @@ vec2 GetStandardUV(vec3 &vertex, Face *face)
     float dr = std::fabs(glm::dot(normal, RIGHT_VECTOR));
     float df = std::fabs(glm::dot(normal, FORWARD_VECTOR));
 
+    // the two vertex coordinates the face is projected on, as axes
+    vec3 s(0.0f), t(0.0f);
     if (du >= dr && du >= df)
     {
-        ret = vec2(vertex.x, -vertex.y);
+        s = vec3(1.0f, 0.0f, 0.0f);
+        t = vec3(0.0f, -1.0f, 0.0f);
     }
     else if (dr >= du && dr >= df)
     {
-        ret = vec2(vertex.x, -vertex.z);
+        s = vec3(1.0f, 0.0f, 0.0f);
+        t = vec3(0.0f, 0.0f, -1.0f);
     }
     else if (df >= du && df >= dr)
     {
-        ret = vec2(vertex.y, -vertex.z);
+        s = vec3(0.0f, 1.0f, 0.0f);
+        t = vec3(0.0f, 0.0f, -1.0f);
     }
 
-    float angle = Deg2Rad(face->textureProjection.standard.rotation);
-    ret = vec2(
-        ret.x * cos(angle) - ret.y * sin(angle),
-        ret.x * sin(angle) + ret.y * cos(angle));
+    float angle = Deg2Rad(projection.rotation);
+    float c = cos(angle), sn = sin(angle);
+
+    TextureMatrix m;
+    SetRow(m.u, (s * c - t * sn) / (textureSize.x * projection.xScale), projection.xOffset / textureSize.x);
+    SetRow(m.v, (s * sn + t * c) / (textureSize.y * projection.yScale), projection.yOffset / textureSize.y);
+    return m;
+}
+
+static TextureMatrix GetValve220Matrix(const Valve220 &projection, vec2 textureSize)
+{
+    TextureMatrix m;
+    SetRow(m.u, projection.uAxis / (textureSize.x * projection.xScale), projection.xOffset / textureSize.x);
+    SetRow(m.v, projection.vAxis / (textureSize.y * projection.yScale), projection.yOffset / textureSize.y);
+    return m;
+}
 
-    ret.x /= textureSize.x;
-    ret.y /= textureSize.y;
+// Texture axes of a brush primitive face, as q3map2 builds them from the
+// plane normal
+static void ComputeAxisBase(vec3 normal, vec3 &texS, vec3 &texT)
+{
+    // almost zero components would flip the angles
+    for (int i = 0; i < 3; i++)
+    {
+        if (std::fabs(normal[i]) < 1e-6f)
+            normal[i] = 0.0f;
+    }
 
-    ret.x /= face->textureProjection.standard.xScale;
-    ret.y /= face->textureProjection.standard.yScale;
+    float rotY = -std::atan2(normal.z, std::sqrt(normal.y * normal.y + normal.x * normal.x));
+    float rotZ = std::atan2(normal.y, normal.x);
 
-    ret.x += face->textureProjection.standard.xOffset / textureSize.x;
-    ret.y += face->textureProjection.standard.yOffset / textureSize.y;
+    texS = vec3(-std::sin(rotZ), std::cos(rotZ), 0.0f);
+    texT = vec3(-std::sin(rotY) * std::cos(rotZ), -std::sin(rotY) * std::sin(rotZ), -std::cos(rotY));
+}
 
-    return ret;
+static TextureMatrix GetBrushPrimitiveMatrix(const vec3 &normal, const BrushPrimitiveUV &projection)
+{
+    vec3 texS, texT;
+    ComputeAxisBase(normal, texS, texT);
+
+    const float(*matrix)[3] = projection.matrix;
+    TextureMatrix m;
+    SetRow(m.u, texS * matrix[0][0] + texT * matrix[0][1], matrix[0][2]);
+    SetRow(m.v, texS * matrix[1][0] + texT * matrix[1][1], matrix[1][2]);
+    return m;
 }
 
-vec2 GetValve220UV(vec3 &vertex, Face *face)
+void TextureMatrix::Apply(const vec3 *points, const int *indices, int count, vec2 *uvs) const
 {
-    vec2 textureSize = face->textureSize.x == 0.0f ? vec2(512.0f, 512.0f) : face->textureSize;
+    // the rows are loaded once, the loop is only multiply-adds
+    float u0 = u[0], u1 = u[1], u2 = u[2], u3 = u[3];
+    float v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
 
-    return vec2(
-        dot(vertex, face->textureProjection.valve220.uAxis) / (textureSize.x * face->textureProjection.valve220.xScale) +
-            (face->textureProjection.valve220.xOffset / textureSize.x),
-        dot(vertex, face->textureProjection.valve220.vAxis) / (textureSize.y * face->textureProjection.valve220.yScale) +
-            (face->textureProjection.valve220.yOffset / textureSize.y));
+    for (int i = 0; i < count; i++)
+    {
+        const vec3 &p = points[indices[i]];
+        uvs[i].x = u0 * p.x + u1 * p.y + u2 * p.z + u3;
+        uvs[i].y = v0 * p.x + v1 * p.y + v2 * p.z + v3;
+    }
 }
 
-vec2 Face::GetUV(vec3 &vert)
+TextureMatrix Face::GetTextureMatrix(const vec3 &normal, vec2 textureSize) const
 {
-    vec2 uv;
+    if (textureSize.x == 0.0f)
+        textureSize = vec2(512.0f, 512.0f);
 
     switch (projectionType)
     {
     case TextureProjectionType::Standard:
-        uv = GetStandardUV(vert, this);
-        break;
+        return GetStandardMatrix(normal, textureProjection.standard, textureSize);
     case TextureProjectionType::Valve220:
-        uv = GetValve220UV(vert, this);
-        break;
+        return GetValve220Matrix(textureProjection.valve220, textureSize);
+    case TextureProjectionType::BrushPrimitive:
+        return GetBrushPrimitiveMatrix(normal, textureProjection.brushPrimitive);
     default:
-        uv = vec2(0.0f);
-        break;
+        return TextureMatrix{};
     }
+}
 
-    return uv;
+vec2 Face::GetUV(const vec3 &vert, const vec3 &normal, vec2 textureSize) const
+{
+    return GetTextureMatrix(normal, textureSize).Apply(vert);
 }
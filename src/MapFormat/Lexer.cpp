@@ -1,9 +1,169 @@
 #include "Lexer.hpp"
-#include <cctype>
+#include <cstdint>
 #include <cstring>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEXER_SIMD_SSE2
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+static inline int countTrailingZeros(uint64_t mask)
+{
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+}
+
+static inline int popCount(uint64_t mask)
+{
+    return (int)__popcnt64(mask);
+}
+#else
+static inline int countTrailingZeros(uint64_t mask)
+{
+    return __builtin_ctzll(mask);
+}
+
+static inline int popCount(uint64_t mask)
+{
+    return __builtin_popcountll(mask);
+}
+#endif
+
+// Byte classes. Whitespace matches std::isspace in the "C" locale, delimiters
+// are everything that ends a word. NUL is a delimiter so the zero padding of
+// the last window stops every scan at the end of the input.
+enum : unsigned char
+{
+    CHAR_WHITESPACE = 1,
+    CHAR_DELIMITER = 2,
+    CHAR_NEWLINE = 4
+};
+
+struct CharTable
+{
+    unsigned char classes[256];
+
+    CharTable() : classes()
+    {
+        for (unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+            classes[c] = CHAR_WHITESPACE | CHAR_DELIMITER;
+
+        for (unsigned char c : {'{', '}', '(', ')', '[', ']', '"', '\0'})
+            classes[c] = CHAR_DELIMITER;
+
+        classes['\n'] |= CHAR_NEWLINE;
+    }
+};
+
+static const CharTable charTable;
+
+#if defined(LEXER_SIMD_AVX2)
+static inline uint64_t equalMask(__m256i lo, __m256i hi, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    uint32_t maskLo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle));
+    uint32_t maskHi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle));
+    return (uint64_t)maskLo | ((uint64_t)maskHi << 32);
+}
+
+static inline uint32_t whitespaceMask(__m256i bytes)
+{
+    // '\t'..'\r' are contiguous, shift them down to 0..4 and do one unsigned range check
+    __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i inRange = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+    __m256i space = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(inRange, space));
+}
+
+static void classifyWindow(const char *src, LexerWindow &window)
+{
+    __m256i lo = _mm256_loadu_si256((const __m256i *)src);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(src + 32));
+
+    window.whitespace = (uint64_t)whitespaceMask(lo) | ((uint64_t)whitespaceMask(hi) << 32);
+    window.newlines = equalMask(lo, hi, '\n');
+    window.delimiters = window.whitespace |
+                        equalMask(lo, hi, '{') | equalMask(lo, hi, '}') |
+                        equalMask(lo, hi, '(') | equalMask(lo, hi, ')') |
+                        equalMask(lo, hi, '[') | equalMask(lo, hi, ']') |
+                        equalMask(lo, hi, '"') | equalMask(lo, hi, '\0');
+}
+#elif defined(LEXER_SIMD_SSE2)
+static inline uint64_t equalMask(const __m128i bytes[4], char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++)
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes[i], needle)) << (16 * i);
+    return mask;
+}
+
+static inline uint64_t whitespaceMask(const __m128i bytes[4])
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        // '\t'..'\r' are contiguous, shift them down to 0..4 and do one unsigned range check
+        __m128i shifted = _mm_sub_epi8(bytes[i], _mm_set1_epi8('\t'));
+        __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        __m128i space = _mm_cmpeq_epi8(bytes[i], _mm_set1_epi8(' '));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_or_si128(inRange, space)) << (16 * i);
+    }
+    return mask;
+}
+
+static void classifyWindow(const char *src, LexerWindow &window)
+{
+    __m128i bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+
+    window.whitespace = whitespaceMask(bytes);
+    window.newlines = equalMask(bytes, '\n');
+    window.delimiters = window.whitespace |
+                        equalMask(bytes, '{') | equalMask(bytes, '}') |
+                        equalMask(bytes, '(') | equalMask(bytes, ')') |
+                        equalMask(bytes, '[') | equalMask(bytes, ']') |
+                        equalMask(bytes, '"') | equalMask(bytes, '\0');
+}
+#else
+static void classifyWindow(const char *src, LexerWindow &window)
+{
+    window.whitespace = window.delimiters = window.newlines = 0;
+
+    for (int i = 0; i < LexerWindow::SIZE; i++)
+    {
+        unsigned char classes = charTable.classes[(unsigned char)src[i]];
+        window.whitespace |= (uint64_t)((classes & CHAR_WHITESPACE) != 0) << i;
+        window.delimiters |= (uint64_t)((classes & CHAR_DELIMITER) != 0) << i;
+        window.newlines |= (uint64_t)((classes & CHAR_NEWLINE) != 0) << i;
+    }
+}
+#endif
+
+// the NUL search only covers the bytes before c
+const char *findOrNul(const char *src, size_t length, char c)
+{
+    const char *found = (const char *)memchr(src, c, length);
+    size_t span = found ? (size_t)(found - src) : length;
+    const char *nul = (const char *)memchr(src, '\0', span);
+    return nul ? nul : found;
+}
+
+Lexer::Lexer(const char *source, size_t length, int firstLine)
+    : _src(source), _length(length), _line(firstLine), _pos(0), _hasPushback(false)
+{
+}
+
 Lexer::Lexer(const char *source)
-    : _src(source), _pos(0), _hasPushback(false)
+    : Lexer(source, strlen(source))
 {
 }
 
@@ -17,7 +177,7 @@ Token Lexer::next()
 
     skipWhitespaceAndComments();
 
-    if (_src[_pos] == '\0')
+    if (_pos >= _length || _src[_pos] == '\0')
     {
         return Token{TokenType::END, ""};
     }
@@ -57,42 +217,94 @@ void Lexer::pushBack(const Token &tok)
     _pushbackTok = tok;
 }
 
+void Lexer::loadWindow()
+{
+    size_t start = _pos & ~(size_t)(LexerWindow::SIZE - 1);
+
+    if (start == _window.start)
+        return;
+
+    _window.start = start;
+
+    if (start + LexerWindow::SIZE <= _length)
+    {
+        classifyWindow(&_src[start], _window);
+    }
+    else
+    {
+        // the last partial window is classified from a zero padded copy
+        char padded[LexerWindow::SIZE] = {};
+        memcpy(padded, &_src[start], _length - start);
+        classifyWindow(padded, _window);
+    }
+}
+
 void Lexer::skipWhitespaceAndComments()
 {
-    while (_src[_pos]) {
-        if (_src[_pos] == '\n') {
-            _line++;
-            _pos++;
-        }
-        else if (std::isspace(_src[_pos])) {
-            _pos++;
+    while (_pos < _length)
+    {
+        loadWindow();
+
+        int offset = (int)(_pos - _window.start);
+        uint64_t solid = ~_window.whitespace >> offset;
+        uint64_t newlines = _window.newlines >> offset;
+
+        if (solid == 0)
+        {
+            // the rest of the window is whitespace
+            _line += popCount(newlines);
+            _pos = _window.start + LexerWindow::SIZE;
+            continue;
         }
-        else if (_src[_pos] == '/' && _src[_pos + 1] == '/') {
-            _pos += 2;
-            while (_src[_pos] && _src[_pos] != '\n') _pos++;
+
+        int skip = countTrailingZeros(solid);
+        _line += popCount(newlines & ((1ull << skip) - 1));
+        _pos += skip;
+
+        if (_pos + 1 < _length && _src[_pos] == '/' && _src[_pos + 1] == '/')
+        {
+            // the newline itself is left for the next pass to count
+            const char *newline = findOrNul(&_src[_pos + 2], _length - _pos - 2, '\n');
+            _pos = newline ? newline - _src : _length;
         }
-        else {
+        else
+        {
             break;
         }
     }
+
+    if (_pos > _length)
+        _pos = _length;
 }
 
 int Lexer::getLine() const {
     return _line;
 }
 
+std::string_view Lexer::remaining() const
+{
+    if (_hasPushback)
+        return std::string_view();
+
+    return std::string_view(_src + _pos, _length - _pos);
+}
+
+void Lexer::skipToEnd()
+{
+    _hasPushback = false;
+    _pos = _length;
+}
+
 Token Lexer::readQuotedString()
 {
     _pos++; // skip opening quote
     size_t start = _pos;
 
-    while (_src[_pos] && _src[_pos] != '"')
-    {
-        _pos++;
-    }
+    const char *quote = findOrNul(&_src[_pos], _length - _pos, '"');
+    _pos = quote ? quote - _src : _length;
 
-    std::string text(&_src[start], _pos - start);
-    if (_src[_pos] == '"')
+    std::string_view text(&_src[start], _pos - start);
+    if (_pos < _length && _src[_pos] == '"')
         _pos++;
 
     return Token{TokenType::QUOTED_STRING, text};
@@ -102,12 +314,23 @@ Token Lexer::readWord()
 {
     size_t start = _pos;
 
-    while (_src[_pos] && !std::isspace(_src[_pos]) && !strchr("{}()[]\"", _src[_pos]))
+    for (;;)
     {
-        _pos++;
+        loadWindow();
+
+        int offset = (int)(_pos - _window.start);
+        uint64_t delimiters = _window.delimiters >> offset;
+
+        if (delimiters)
+        {
+            _pos += countTrailingZeros(delimiters);
+            break;
+        }
+
+        _pos = _window.start + LexerWindow::SIZE;
     }
 
-    std::string text(&_src[start], _pos - start);
+    std::string_view text(&_src[start], _pos - start);
 
     return Token{TokenType::WORD, text};
 }
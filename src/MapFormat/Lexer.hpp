@@ -1,6 +1,8 @@
 #pragma once
 
-#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
 
 // Token types emitted by the lexer
 enum class TokenType
@@ -17,17 +19,40 @@ enum class TokenType
     UNKNOWN        // any unrecognized token
 };
 
-// Single token representation
+// Single token representation. The text is a view into the lexer's source
+// buffer (or a string literal), so it is only valid while that buffer is alive.
+// Copy it into a std::string when the value needs to be stored.
 struct Token
 {
     TokenType type;
-    std::string text;
+    std::string_view text;
 };
 
+// Bit masks classifying a 64 byte window of the source, one bit per byte.
+// The lexer scans whole windows at once (with SIMD where available) and then
+// finds token boundaries with bit operations instead of testing each byte.
+struct LexerWindow
+{
+    static const int SIZE = 64;
+
+    size_t start = SIZE_MAX;
+    uint64_t whitespace;
+    uint64_t delimiters;
+    uint64_t newlines;
+};
+
+// First c or NUL in src[0, length), null if there's neither. Quoted strings
+// and comments end at it, a NUL ends the input there like between tokens.
+const char *findOrNul(const char *src, size_t length, char c);
+
 // Lexer class responsible for tokenizing the input source
 class Lexer
 {
 public:
+    // Lexes source[0, length). The source doesn't need to be NUL-terminated,
+    // but a NUL byte inside it is treated as the end of the input.
+    // firstLine is the line number of source[0].
+    Lexer(const char *source, size_t length, int firstLine = 1);
     explicit Lexer(const char *source);
 
     // Fetch the next token, skipping whitespace and comments
@@ -38,13 +63,23 @@ public:
 
     int getLine() const;
 
+    // The part of the source that hasn't been lexed yet, empty while a token
+    // is pushed back
+    std::string_view remaining() const;
+
+    // Consumes the rest of the input, next() returns END from now on
+    void skipToEnd();
+
 private:
     const char *_src;
+    size_t _length;
     int _line = 1;
     size_t _pos;
     bool _hasPushback;
     Token _pushbackTok;
+    LexerWindow _window;
 
+    void loadWindow();
     void skipWhitespaceAndComments();
     Token readQuotedString();
     Token readWord();
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <string.h>
 #include "Parser.hpp"
+#include "../FS/MappedFile.hpp"
+#include "../Jobs/Jobs.hpp"
 #include "map.hpp"
 
 std::string BaseName(const char *path)
@@ -14,42 +17,245 @@ std::string BaseName(const char *path)
 
 bool Map::Load(const char *fileName, Map &map)
 {
-    FILE *file;
-    file = fopen(fileName, "rb");
+    ParseContext context;
+    return Load(fileName, map, context);
+}
+
+bool Map::Load(const char *fileName, Map &map, ParseContext &context)
+{
+    // the lexer runs directly over the mapped file, tokens are views into it
+    FS::MappedFile file;
+    if (!file.Open(fileName))
+    {
+        reportOpenError(context, fileName);
+        return false;
+    }
 
-    if (!file)
+    Lexer lexer(file.Data(), file.Size());
+    if (!parseMap(lexer, &map, context))
     {
-        perror("Failed to open file");
+        if (context.printErrors)
+            fprintf(stderr, "Parsing failed.\n");
         return false;
     }
 
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    return true;
+}
+
+// Parsed parts of a streamed file are released in steps of this size
+static const size_t STREAM_RELEASE_STEP = 4 * 1024 * 1024;
+
+// Forwards parser events to another visitor and releases the pages of the
+// file that have been parsed. Checked after every brush, patch and entity,
+// when no token is pushed back and everything before the lexer is done.
+class ReleasingVisitor : public MapVisitor
+{
+public:
+    ReleasingVisitor(MapVisitor &target, FS::MappedFile &file, Lexer &lexer)
+        : target(target), file(file), lexer(lexer) {}
 
-    char *buffer = (char *)malloc(size + 1);
-    if (fread(buffer, 1, size, file) != size)
+    bool wantsGeometry() const override { return target.wantsGeometry(); }
+
+    void onEntityBegin(int entityId) override { target.onEntityBegin(entityId); }
+    void onKeyValue(std::string_view key, std::string_view value) override { target.onKeyValue(key, value); }
+    void onBrushBegin(int brushId) override { target.onBrushBegin(brushId); }
+    void onBrushFace(const FaceDef &face) override { target.onBrushFace(face); }
+
+    void onBrushEnd() override
+    {
+        target.onBrushEnd();
+        releaseParsed();
+    }
+
+    void onPatch(int patchId, const PatchDef &patch) override
     {
-        perror("Failed to read file");
-        fclose(file);
-        free(buffer);
+        target.onPatch(patchId, patch);
+        releaseParsed();
+    }
+
+    void onEntityEnd() override
+    {
+        target.onEntityEnd();
+        releaseParsed();
+    }
+
+private:
+    MapVisitor &target;
+    FS::MappedFile &file;
+    Lexer &lexer;
+    size_t released = 0;
+
+    void releaseParsed()
+    {
+        std::string_view rest = lexer.remaining();
+        if (!rest.data())
+            return;
+
+        size_t parsed = rest.data() - file.Data();
+        if (parsed - released >= STREAM_RELEASE_STEP)
+        {
+            file.Release(parsed);
+            released = parsed;
+        }
+    }
+};
+
+bool Map::Stream(const char *fileName, MapVisitor &visitor)
+{
+    ParseContext context;
+    return Stream(fileName, visitor, context);
+}
+
+bool Map::Stream(const char *fileName, MapVisitor &visitor, ParseContext &context)
+{
+    FS::MappedFile file;
+    if (!file.Open(fileName))
+    {
+        reportOpenError(context, fileName);
         return false;
     }
-    buffer[size] = '\0';
-    fclose(file);
 
-    Lexer lexer(buffer);
-    if (!parseMap(lexer, &map))
+    Lexer lexer(file.Data(), file.Size());
+    ReleasingVisitor releasing(visitor, file, lexer);
+
+    if (!parseMap(lexer, releasing, context))
     {
-        fprintf(stderr, "Parsing failed.\n");
-        free(buffer);
+        if (context.printErrors)
+            fprintf(stderr, "Parsing failed.\n");
         return false;
     }
 
-    free(buffer);
     return true;
 }
 
+int Map::InternTexture(std::string_view name)
+{
+    textureLookup.assign(name);
+
+    auto result = textureIds.try_emplace(textureLookup, (int)textures.size());
+    if (result.second)
+    {
+        textures.push_back(textureLookup);
+        textureSizes.push_back(vec2(0.0f));
+    }
+
+    return result.first->second;
+}
+
+int Map::FindTexture(std::string_view name) const
+{
+    auto it = textureIds.find(std::string(name));
+    return it == textureIds.end() ? -1 : it->second;
+}
+
+void Map::BuildPlanes()
+{
+    planes.Clear();
+    for (Face &face : faces)
+        face.plane = planes.FromPoints(face.p1, face.p2, face.p3);
+}
+
+// Brushes or patches built by one task
+static const size_t GEOMETRY_BATCH_SIZE = 256;
+
+// A run of brushes or patches built into its own buffers, then copied into
+// the map's pools at the base offsets
+struct GeometryBatch
+{
+    size_t firstBrush = 0, brushCount = 0;
+    size_t firstPatch = 0, patchCount = 0;
+
+    std::vector<vec3> vertices;
+    std::vector<int> faceIndices;
+    std::vector<PatchVert> patchVertices;
+
+    size_t vertexBase = 0, indexBase = 0, patchVertexBase = 0;
+};
+
+void Map::CalculateGeometry()
+{
+    // maps that didn't come from the parser
+    if (planes.Count() == 0 && !faces.empty())
+        BuildPlanes();
+
+    vertices.clear();
+    faceIndices.clear();
+    patchVertices.clear();
+
+    if (Jobs::ThreadCount() == 1)
+    {
+        for (Brush &b : brushes)
+            b.CalculateGeometry(*this);
+        for (Patch &p : patches)
+            p.CalculateGeometry(*this);
+        return;
+    }
+
+    // every brush and patch only writes its own ranges, so the batches
+    // run in any order. Brush batches come first, like in the pools.
+    std::vector<GeometryBatch> batches;
+    for (size_t i = 0; i < brushes.size(); i += GEOMETRY_BATCH_SIZE)
+    {
+        GeometryBatch &batch = batches.emplace_back();
+        batch.firstBrush = i;
+        batch.brushCount = std::min(GEOMETRY_BATCH_SIZE, brushes.size() - i);
+    }
+    for (size_t i = 0; i < patches.size(); i += GEOMETRY_BATCH_SIZE)
+    {
+        GeometryBatch &batch = batches.emplace_back();
+        batch.firstPatch = i;
+        batch.patchCount = std::min(GEOMETRY_BATCH_SIZE, patches.size() - i);
+    }
+
+    Jobs::ParallelFor(batches.size(), [&](size_t i)
+    {
+        GeometryBatch &batch = batches[i];
+        for (size_t b = batch.firstBrush; b < batch.firstBrush + batch.brushCount; b++)
+            brushes[b].CalculateGeometry(*this, batch.vertices, batch.faceIndices);
+        for (size_t p = batch.firstPatch; p < batch.firstPatch + batch.patchCount; p++)
+            patches[p].CalculateGeometry(*this, batch.patchVertices);
+    });
+
+    // the batches land in the pools in map order, the same place building
+    // the brushes and patches one by one puts them
+    size_t vertexCount = 0, indexCount = 0, patchVertexCount = 0;
+    for (GeometryBatch &batch : batches)
+    {
+        batch.vertexBase = vertexCount;
+        batch.indexBase = indexCount;
+        batch.patchVertexBase = patchVertexCount;
+        vertexCount += batch.vertices.size();
+        indexCount += batch.faceIndices.size();
+        patchVertexCount += batch.patchVertices.size();
+    }
+
+    vertices.resize(vertexCount);
+    faceIndices.resize(indexCount);
+    patchVertices.resize(patchVertexCount);
+
+    Jobs::ParallelFor(batches.size(), [&](size_t i)
+    {
+        GeometryBatch &batch = batches[i];
+        int vertexBase = (int)batch.vertexBase;
+        int indexBase = (int)batch.indexBase;
+
+        for (size_t b = batch.firstBrush; b < batch.firstBrush + batch.brushCount; b++)
+        {
+            brushes[b].firstVertex += vertexBase;
+            for (Face &face : GetFaces(brushes[b]))
+                face.firstIndex += indexBase;
+        }
+        for (size_t p = batch.firstPatch; p < batch.firstPatch + batch.patchCount; p++)
+            patches[p].firstVertex += (int)batch.patchVertexBase;
+
+        std::copy(batch.vertices.begin(), batch.vertices.end(), vertices.begin() + batch.vertexBase);
+        std::transform(batch.faceIndices.begin(), batch.faceIndices.end(), faceIndices.begin() + batch.indexBase,
+                       [vertexBase](int index) { return index + vertexBase; });
+        std::copy(batch.patchVertices.begin(), batch.patchVertices.end(),
+                  patchVertices.begin() + batch.patchVertexBase);
+    });
+}
+
 std::string Map::Stringify()
 {
     std::string result;
@@ -62,17 +268,17 @@ std::string Map::Stringify()
         {
             result += "\"" + pair.first + "\" \"" + pair.second + "\"\n";
         }
-        for (const Brush &b : e.brushes)
+        for (const Brush &b : GetBrushes(e))
         {
             result += "{\n";
-            for (const Face &f : b.faces)
+            for (const Face &f : GetFaces(b))
             {
                 result += "( " + std::to_string(f.p1.x) + " " + std::to_string(f.p1.y) + " " + std::to_string(f.p1.z) + " ) "
                                                                                                                         "( " +
                           std::to_string(f.p2.x) + " " + std::to_string(f.p2.y) + " " + std::to_string(f.p2.z) + " ) "
                                                                                                                  "( " +
                           std::to_string(f.p3.x) + " " + std::to_string(f.p3.y) + " " + std::to_string(f.p3.z) + " ) ";
-                f.texture;
+                result += textures[f.textureId] + " ";
 
                 switch (f.projectionType)
                 {
@@ -84,6 +290,7 @@ std::string Map::Stringify()
                     break;
                 }
                 case TextureProjectionType::Valve220:
+                {
                     Valve220 vp = f.textureProjection.valve220;
                     result += "[ " + std::to_string(vp.uAxis.x) + " " + std::to_string(vp.uAxis.y) + " " + std::to_string(vp.uAxis.z) + " " +
                               std::to_string(vp.xOffset) + " ] [ " +
@@ -94,6 +301,15 @@ std::string Map::Stringify()
                               std::to_string(vp.yScale) + "\n";
                     break;
                 }
+                case TextureProjectionType::BrushPrimitive:
+                {
+                    const float(*bp)[3] = f.textureProjection.brushPrimitive.matrix;
+                    result += "( ( " + std::to_string(bp[0][0]) + " " + std::to_string(bp[0][1]) + " " + std::to_string(bp[0][2]) +
+                              " ) ( " + std::to_string(bp[1][0]) + " " + std::to_string(bp[1][1]) + " " + std::to_string(bp[1][2]) +
+                              " ) )\n";
+                    break;
+                }
+                }
 
                 result += std::to_string(f.flags[0]) + " " + std::to_string(f.flags[1]) + " " + std::to_string(f.flags[2]) + "\n";
             }
@@ -101,16 +317,18 @@ std::string Map::Stringify()
             result += "}\n";
         }
 
-        for (const Patch &p : e.patches)
+        for (const Patch &p : GetPatches(e))
         {
-            result += "{\npatchDef2\n{\n" + p.texture + "\n( " + std::to_string(p.height) + " " + std::to_string(p.width) + " " +
+            result += "{\npatchDef2\n{\n" + textures[p.textureId] + "\n( " + std::to_string(p.height) + " " + std::to_string(p.width) + " " +
                       std::to_string(p.flags[0]) + " " + std::to_string(p.flags[1]) + " " + std::to_string(p.flags[2]) + " )\n(\n";
 
-            for (const auto &row : p.controlPoints)
+            Span<const PatchVert> controlPoints = GetControlPoints(p);
+            for (int i = 0; i < p.height && !controlPoints.empty(); i++)
             {
                 result += "( ";
-                for (const PatchVert &v : row)
+                for (int j = 0; j < p.width; j++)
                 {
+                    const PatchVert &v = controlPoints[(size_t)i * p.width + j];
                     result += "( " + std::to_string(v.position.x) + " " + std::to_string(v.position.y) + " " +
                               std::to_string(v.position.z) + " " +
                               std::to_string(v.uv.x) + " " +
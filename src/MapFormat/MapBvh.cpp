@@ -0,0 +1,558 @@
+#include <algorithm>
+#include <cmath>
+#include "MapBvh.hpp"
+#include "../Jobs/Jobs.hpp"
+
+// Leaves up to this size are kept when splitting doesn't pay off
+static const int MAX_LEAF_SIZE = 4;
+
+// Centroid bins tried along each axis
+static const int BIN_COUNT = 16;
+
+// Cost of visiting a node against testing one primitive
+static const float TRAVERSAL_COST = 1.0f;
+
+// Below this depth splits fall back to halves, which keeps the traversal
+// stack small on degenerate input
+static const int MAX_SAH_DEPTH = 64;
+static const int MAX_STACK_DEPTH = 128;
+
+// Subtrees this big are built on another thread
+static const int PARALLEL_BUILD_SIZE = 4096;
+
+// Rays closer to parallel than this to a plane don't cross it
+static const float PARALLEL_EPSILON = 1e-12f;
+
+struct MapBvh::BuildState
+{
+    const Map &map;
+    const std::vector<AABB> &patchBounds;
+
+    const AABB &Bounds(int item) const { return item >= 0 ? map.brushes[item].aabb : patchBounds[~item]; }
+    vec3 Centroid(int item) const
+    {
+        const AABB &box = Bounds(item);
+        return (box.min + box.max) * 0.5f;
+    }
+};
+
+static float SurfaceArea(const vec3 &min, const vec3 &max)
+{
+    vec3 size = glm::max(max - min, vec3(0.0f));
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void Grow(AABB &box, const AABB &other)
+{
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static const AABB EMPTY_BOX = {vec3(INFINITY), vec3(-INFINITY)};
+
+void MapBvh::Build(const Map &map)
+{
+    this->map = &map;
+    nodes.clear();
+    items.clear();
+    patchBounds.clear();
+    depth = 0;
+
+    for (size_t b = 0; b < map.brushes.size(); b++)
+    {
+        // brushes without geometry have nothing to hit
+        if (map.brushes[b].vertexCount > 0)
+            items.push_back((int)b);
+    }
+
+    patchBounds.resize(map.patches.size());
+
+    Jobs::ParallelFor(map.patches.size(), [&](size_t p)
+    {
+        AABB box = EMPTY_BOX;
+        for (const PatchVert &vert : map.GetPatchVertices(map.patches[p]))
+        {
+            box.min = glm::min(box.min, vert.position);
+            box.max = glm::max(box.max, vert.position);
+        }
+        patchBounds[p] = box;
+    });
+    for (size_t p = 0; p < map.patches.size(); p++)
+    {
+        if (map.patches[p].rows >= 2 && map.patches[p].columns >= 2)
+            items.push_back(~(int)p);
+    }
+
+    if (items.empty())
+        return;
+
+    BuildState state = {map, patchBounds};
+    nodes.reserve(2 * items.size() / MAX_LEAF_SIZE + 1);
+    depth = BuildNode(state, nodes, 0, (int)items.size(), 1);
+}
+
+int MapBvh::BuildNode(BuildState &state, std::vector<Node> &out, int first, int count, int level)
+{
+    AABB bounds = EMPTY_BOX, centroids = EMPTY_BOX;
+    for (int i = first; i < first + count; i++)
+    {
+        Grow(bounds, state.Bounds(items[i]));
+        vec3 c = state.Centroid(items[i]);
+        Grow(centroids, {c, c});
+    }
+
+    int index = (int)out.size();
+    out.push_back({bounds.min, first, bounds.max, count});
+    if (count <= 1)
+        return 1;
+
+    // binned surface area heuristic over the centroids
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = INFINITY;
+    if (level < MAX_SAH_DEPTH)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float lo = centroids.min[axis], extent = centroids.max[axis] - lo;
+            if (!(extent > 0.0f))
+                continue;
+
+            AABB binBounds[BIN_COUNT];
+            int binCounts[BIN_COUNT] = {};
+            std::fill(binBounds, binBounds + BIN_COUNT, EMPTY_BOX);
+
+            float scale = BIN_COUNT / extent;
+            for (int i = first; i < first + count; i++)
+            {
+                int bin = std::min(BIN_COUNT - 1, (int)((state.Centroid(items[i])[axis] - lo) * scale));
+                binCounts[bin]++;
+                Grow(binBounds[bin], state.Bounds(items[i]));
+            }
+
+            // areas of everything left of each split, then sweep from the right
+            float leftArea[BIN_COUNT - 1];
+            int leftCount[BIN_COUNT - 1];
+            AABB box = EMPTY_BOX;
+            int total = 0;
+            for (int split = 0; split < BIN_COUNT - 1; split++)
+            {
+                Grow(box, binBounds[split]);
+                total += binCounts[split];
+                leftArea[split] = SurfaceArea(box.min, box.max);
+                leftCount[split] = total;
+            }
+
+            box = EMPTY_BOX;
+            total = 0;
+            for (int split = BIN_COUNT - 2; split >= 0; split--)
+            {
+                Grow(box, binBounds[split + 1]);
+                total += binCounts[split + 1];
+                if (leftCount[split] == 0 || total == 0)
+                    continue;
+
+                float cost = leftArea[split] * leftCount[split] + SurfaceArea(box.min, box.max) * total;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+    }
+
+    float area = SurfaceArea(bounds.min, bounds.max);
+    float splitCost = bestAxis >= 0 && area > 0.0f ? TRAVERSAL_COST + bestCost / area : INFINITY;
+    if (count <= MAX_LEAF_SIZE && splitCost >= (float)count)
+        return 1;
+
+    int mid = first + count / 2;
+    if (bestAxis >= 0)
+    {
+        float lo = centroids.min[bestAxis];
+        float scale = BIN_COUNT / (centroids.max[bestAxis] - lo);
+        int *split = std::partition(&items[first], &items[first] + count, [&](int item)
+        {
+            return std::min(BIN_COUNT - 1, (int)((state.Centroid(item)[bestAxis] - lo) * scale)) <= bestSplit;
+        });
+        mid = (int)(split - items.data());
+    }
+    else
+    {
+        // every centroid in one spot, or too deep: halves along the longest axis
+        vec3 extent = bounds.max - bounds.min;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        std::nth_element(&items[first], &items[mid], &items[first] + count,
+                         [&](int a, int b) { return state.Centroid(a)[axis] < state.Centroid(b)[axis]; });
+    }
+
+    out[index].count = 0;
+
+    int leftDepth, rightDepth;
+    if (count >= PARALLEL_BUILD_SIZE && Jobs::ThreadCount() > 1)
+    {
+        // the right subtree goes into its own buffer and is moved in after
+        // the left one, where the serial build would have put it
+        std::vector<Node> right;
+        Jobs::TaskGroup group;
+        group.Run([&]
+        {
+            rightDepth = BuildNode(state, right, mid, first + count - mid, level + 1);
+        });
+        leftDepth = BuildNode(state, out, first, mid - first, level + 1);
+        group.Wait();
+
+        int offset = (int)out.size();
+        out[index].rightOrFirst = offset;
+        for (Node node : right)
+        {
+            if (node.count == 0)
+                node.rightOrFirst += offset;
+            out.push_back(node);
+        }
+    }
+    else
+    {
+        leftDepth = BuildNode(state, out, first, mid - first, level + 1);
+        out[index].rightOrFirst = (int)out.size();
+        rightDepth = BuildNode(state, out, mid, first + count - mid, level + 1);
+    }
+
+    return 1 + std::max(leftDepth, rightDepth);
+}
+
+float MapBvh::Cost() const
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    float rootArea = SurfaceArea(nodes[0].min, nodes[0].max);
+    if (!(rootArea > 0.0f))
+        return (float)items.size();
+
+    float cost = 0.0f;
+    for (const Node &node : nodes)
+    {
+        float area = SurfaceArea(node.min, node.max) / rootArea;
+        cost += node.count == 0 ? TRAVERSAL_COST * area : node.count * area;
+    }
+    return cost;
+}
+
+// Distance along the ray to the box, INFINITY if it misses it before tMax
+static float IntersectBox(const vec3 &min, const vec3 &max, const vec3 &origin, const vec3 &inverse, float tMax)
+{
+    vec3 t0 = (min - origin) * inverse;
+    vec3 t1 = (max - origin) * inverse;
+    vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : INFINITY;
+}
+
+bool MapBvh::RaycastBrush(int brush, const Ray &ray, RayHit &hit) const
+{
+    // brush planes face inwards, the ray is inside between entering the
+    // last plane it crosses going in and leaving the first going out
+    const PlaneTable &planes = map->planes;
+    float enter = -INFINITY, exit = std::min(ray.maxDistance, hit.distance);
+    int enterFace = -1;
+
+    const Brush &b = map->brushes[brush];
+    for (int f = b.firstFace; f < b.firstFace + b.faceCount; f++)
+    {
+        int plane = map->faces[f].plane;
+        vec3 normal = planes.Normal(plane);
+        float start = glm::dot(normal, ray.origin) - planes.Distance(plane);
+        float along = glm::dot(normal, ray.direction);
+
+        if (std::fabs(along) < PARALLEL_EPSILON)
+        {
+            if (start < 0.0f)
+                return false;
+            continue;
+        }
+
+        float t = -start / along;
+        if (along > 0.0f)
+        {
+            if (t > enter)
+            {
+                enter = t;
+                enterFace = f;
+            }
+        }
+        else
+        {
+            exit = std::min(exit, t);
+        }
+
+        if (enter > exit)
+            return false;
+    }
+
+    if (enterFace == -1 || enter < 0.0f)
+        return false;
+
+    hit.brush = brush;
+    hit.face = enterFace;
+    hit.patch = -1;
+    hit.distance = enter;
+    hit.point = ray.origin + ray.direction * enter;
+    return true;
+}
+
+bool MapBvh::RaycastPatch(int patch, const Ray &ray, RayHit &hit) const
+{
+    const Patch &p = map->patches[patch];
+    Span<const PatchVert> grid = map->GetPatchVertices(p);
+    bool found = false;
+
+    // the two triangles of every quad, split like Scene::BuildGrid
+    auto triangle = [&](const vec3 &a, const vec3 &b, const vec3 &c)
+    {
+        vec3 ab = b - a, ac = c - a;
+        vec3 h = glm::cross(ray.direction, ac);
+        float det = glm::dot(ab, h);
+        if (std::fabs(det) < PARALLEL_EPSILON)
+            return;
+
+        float inverse = 1.0f / det;
+        vec3 s = ray.origin - a;
+        float u = glm::dot(s, h) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return;
+
+        vec3 q = glm::cross(s, ab);
+        float v = glm::dot(ray.direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return;
+
+        float t = glm::dot(ac, q) * inverse;
+        if (t < 0.0f || t > ray.maxDistance || t >= hit.distance)
+            return;
+
+        hit.brush = -1;
+        hit.face = -1;
+        hit.patch = patch;
+        hit.distance = t;
+        hit.point = ray.origin + ray.direction * t;
+        found = true;
+    };
+
+    for (int i = 0; i + 1 < p.rows; i++)
+    {
+        const PatchVert *top = &grid[(size_t)i * p.columns];
+        const PatchVert *bottom = top + p.columns;
+        for (int j = 0; j + 1 < p.columns; j++)
+        {
+            triangle(top[j].position, bottom[j].position, top[j + 1].position);
+            triangle(top[j + 1].position, bottom[j].position, bottom[j + 1].position);
+        }
+    }
+
+    return found;
+}
+
+bool MapBvh::Raycast(const Ray &ray, RayHit &hit) const
+{
+    hit = RayHit();
+    if (nodes.empty())
+        return false;
+
+    vec3 inverse = 1.0f / ray.direction;
+    int stack[MAX_STACK_DEPTH];
+    int top = 0;
+    int node = 0;
+
+    if (IntersectBox(nodes[0].min, nodes[0].max, ray.origin, inverse, ray.maxDistance) == INFINITY)
+        return false;
+
+    while (true)
+    {
+        const Node &n = nodes[node];
+        if (n.count > 0)
+        {
+            for (int i = n.rightOrFirst; i < n.rightOrFirst + n.count; i++)
+            {
+                if (items[i] >= 0)
+                    RaycastBrush(items[i], ray, hit);
+                else
+                    RaycastPatch(~items[i], ray, hit);
+            }
+        }
+        else
+        {
+            // nearer child first, the other one waits on the stack
+            float tMax = std::min(ray.maxDistance, hit.distance);
+            int left = node + 1, right = n.rightOrFirst;
+            float tLeft = IntersectBox(nodes[left].min, nodes[left].max, ray.origin, inverse, tMax);
+            float tRight = IntersectBox(nodes[right].min, nodes[right].max, ray.origin, inverse, tMax);
+            if (tRight < tLeft)
+            {
+                std::swap(left, right);
+                std::swap(tLeft, tRight);
+            }
+
+            if (tLeft != INFINITY)
+            {
+                if (tRight != INFINITY)
+                    stack[top++] = right;
+                node = left;
+                continue;
+            }
+        }
+
+        // pop the next node that can still be closer than the hit
+        bool next = false;
+        while (top > 0)
+        {
+            node = stack[--top];
+            if (IntersectBox(nodes[node].min, nodes[node].max, ray.origin, inverse,
+                             std::min(ray.maxDistance, hit.distance)) != INFINITY)
+            {
+                next = true;
+                break;
+            }
+        }
+        if (!next)
+            break;
+    }
+
+    return hit.Hit();
+}
+
+static bool Contains(const vec3 &min, const vec3 &max, const vec3 &point)
+{
+    return point.x >= min.x && point.y >= min.y && point.z >= min.z &&
+           point.x <= max.x && point.y <= max.y && point.z <= max.z;
+}
+
+static bool Overlaps(const vec3 &min, const vec3 &max, const AABB &box)
+{
+    return box.min.x <= max.x && box.min.y <= max.y && box.min.z <= max.z &&
+           box.max.x >= min.x && box.max.y >= min.y && box.max.z >= min.z;
+}
+
+bool MapBvh::BrushContains(int brush, const vec3 &point) const
+{
+    const PlaneTable &planes = map->planes;
+    const Brush &b = map->brushes[brush];
+    for (int f = b.firstFace; f < b.firstFace + b.faceCount; f++)
+    {
+        int plane = map->faces[f].plane;
+        if (glm::dot(planes.Normal(plane), point) - planes.Distance(plane) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+bool MapBvh::BrushOverlaps(int brush, const AABB &box) const
+{
+    // the box is outside if even its corner furthest into the brush is
+    // behind one of the planes
+    const PlaneTable &planes = map->planes;
+    const Brush &b = map->brushes[brush];
+    for (int f = b.firstFace; f < b.firstFace + b.faceCount; f++)
+    {
+        int plane = map->faces[f].plane;
+        vec3 normal = planes.Normal(plane);
+        vec3 corner(normal.x >= 0.0f ? box.max.x : box.min.x, normal.y >= 0.0f ? box.max.y : box.min.y,
+                    normal.z >= 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(normal, corner) - planes.Distance(plane) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Calls fn(item) for the items of every leaf whose bounds pass test(min, max),
+// until fn returns true. Returns whether it did.
+template <typename Nodes, typename TestFn, typename ItemFn>
+static bool VisitLeaves(const Nodes &nodes, const std::vector<int> &items, TestFn test, ItemFn fn)
+{
+    if (nodes.empty())
+        return false;
+
+    int stack[MAX_STACK_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+        int node = stack[--top];
+        const auto &n = nodes[node];
+        if (!test(n.min, n.max))
+            continue;
+
+        if (n.count == 0)
+        {
+            stack[top++] = n.rightOrFirst;
+            stack[top++] = node + 1;
+            continue;
+        }
+
+        for (int i = n.rightOrFirst; i < n.rightOrFirst + n.count; i++)
+        {
+            if (fn(items[i]))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool MapBvh::IsInSolid(const vec3 &point) const
+{
+    return VisitLeaves(nodes, items, [&](const vec3 &min, const vec3 &max) { return Contains(min, max, point); },
+                       [&](int item) { return item >= 0 && BrushContains(item, point); });
+}
+
+void MapBvh::BrushesAt(const vec3 &point, std::vector<int> &brushes) const
+{
+    VisitLeaves(nodes, items, [&](const vec3 &min, const vec3 &max) { return Contains(min, max, point); },
+                [&](int item)
+                {
+                    if (item >= 0 && BrushContains(item, point))
+                        brushes.push_back(item);
+                    return false;
+                });
+}
+
+void MapBvh::Overlapping(const AABB &box, std::vector<int> &brushes, std::vector<int> &patches) const
+{
+    VisitLeaves(nodes, items, [&](const vec3 &min, const vec3 &max) { return Overlaps(min, max, box); },
+                [&](int item)
+                {
+                    if (item < 0)
+                    {
+                        const AABB &bounds = patchBounds[~item];
+                        if (Overlaps(bounds.min, bounds.max, box))
+                            patches.push_back(~item);
+                    }
+                    else
+                    {
+                        const AABB &bounds = map->brushes[item].aabb;
+                        if (Overlaps(bounds.min, bounds.max, box) && BrushOverlaps(item, box))
+                            brushes.push_back(item);
+                    }
+                    return false;
+                });
+}
+
+void MapBvh::Raycast(const Ray *rays, size_t count, RayHit *hits) const
+{
+    Jobs::ParallelFor(count, [&](size_t i)
+    {
+        Raycast(rays[i], hits[i]);
+    });
+}
+
+void MapBvh::IsInSolid(const vec3 *points, size_t count, bool *inside) const
+{
+    Jobs::ParallelFor(count, [&](size_t i)
+    {
+        inside[i] = IsInSolid(points[i]);
+    });
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "map.hpp"
+
+struct Ray
+{
+    vec3 origin;
+    vec3 direction;
+    float maxDistance = INFINITY; // in lengths of direction
+};
+
+// Nearest thing a ray hits, brush faces or patch triangles
+struct RayHit
+{
+    int brush = -1; // index into the map's brushes, or -1
+    int face = -1;  // index into the map's faces when a brush was hit
+    int patch = -1; // index into the map's patches, or -1
+    float distance = INFINITY;
+    vec3 point = vec3(0.0f);
+
+    bool Hit() const { return brush != -1 || patch != -1; }
+};
+
+// Bounding volume hierarchy over the brushes and patches of a map, split by
+// the surface area heuristic. Brushes are tested against their planes, so
+// hits and point queries are exact for the convex solids, patches against
+// their tessellated triangles. The map must have its geometry calculated
+// and must outlive the tree without changing.
+class MapBvh
+{
+public:
+    // Builds the tree on the job pool, the result is the same for any
+    // thread count
+    void Build(const Map &map);
+
+    // Nearest hit along the ray, false if there's none. Brushes the ray
+    // starts inside of are not hit.
+    bool Raycast(const Ray &ray, RayHit &hit) const;
+
+    // Whether the point is inside or on a brush
+    bool IsInSolid(const vec3 &point) const;
+    // Brushes the point is inside or on, appended to brushes
+    void BrushesAt(const vec3 &point, std::vector<int> &brushes) const;
+
+    // Brushes the box overlaps and patches whose bounds it overlaps
+    void Overlapping(const AABB &box, std::vector<int> &brushes, std::vector<int> &patches) const;
+
+    // The queries for many inputs at once, spread over the job pool
+    void Raycast(const Ray *rays, size_t count, RayHit *hits) const;
+    void IsInSolid(const vec3 *points, size_t count, bool *inside) const;
+
+    size_t NodeCount() const { return nodes.size(); }
+    int Depth() const { return depth; }
+    // Expected cost of a query under the surface area heuristic, in
+    // primitive tests
+    float Cost() const;
+
+private:
+    // Internal nodes have count 0, their left child follows them and
+    // rightOrFirst is the right child. Leaves have count items starting at
+    // rightOrFirst.
+    struct Node
+    {
+        vec3 min;
+        int rightOrFirst;
+        vec3 max;
+        int count;
+    };
+
+    struct BuildState;
+
+    const Map *map = nullptr;
+    std::vector<Node> nodes;
+    std::vector<int> items; // brush index, or ~patch index
+    std::vector<AABB> patchBounds;
+    int depth = 0;
+
+    int BuildNode(BuildState &state, std::vector<Node> &out, int first, int count, int level);
+
+    bool RaycastBrush(int brush, const Ray &ray, RayHit &hit) const;
+    bool RaycastPatch(int patch, const Ray &ray, RayHit &hit) const;
+    bool BrushContains(int brush, const vec3 &point) const;
+    bool BrushOverlaps(int brush, const AABB &box) const;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string_view>
+#include "map.hpp"
+
+// One brush face as written in the map file
+struct FaceDef
+{
+    vec3 p1, p2, p3;
+    std::string_view texture;
+
+    TextureProjectionType projectionType;
+    TextureProjection textureProjection;
+
+    int flags[3] = {0, 0, 0};
+    int flagCount = 0;
+};
+
+// One patchDef2 as written in the map file. The control points are stored
+// row-major, height rows of width points.
+struct PatchDef
+{
+    std::string_view texture;
+    int width, height;
+    int flags[3];
+    const PatchVert *controlPoints;
+};
+
+// Receives the contents of a map file in file order, see parseMap and
+// Map::Stream. Strings and pointers passed to the callbacks are only valid
+// for the duration of the call.
+class MapVisitor
+{
+public:
+    virtual ~MapVisitor() = default;
+
+    // When false, brush and patch numbers are checked but not kept and
+    // FaceDef/PatchDef only carry the texture name and flags. The same
+    // files parse either way.
+    virtual bool wantsGeometry() const { return true; }
+
+    virtual void onEntityBegin(int /*entityId*/) {}
+    virtual void onKeyValue(std::string_view /*key*/, std::string_view /*value*/) {}
+    virtual void onBrushBegin(int /*brushId*/) {}
+    virtual void onBrushFace(const FaceDef & /*face*/) {}
+    virtual void onBrushEnd() {}
+    virtual void onPatch(int /*patchId*/, const PatchDef & /*patch*/) {}
+    virtual void onEntityEnd() {}
+};
@@ -0,0 +1,142 @@
+#include "Number.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Every power of ten up to 1e10 is exactly representable as a float
+static const float POWERS_OF_TEN[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+static inline bool isDigit(char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+// Reference conversion for the rare inputs std::from_chars rejects but strtof
+// accepts (hex floats, out of range values), so both stay bit-identical.
+static bool strtofFallback(std::string_view text, float &out)
+{
+    char buffer[64];
+    if (text.empty() || text.size() >= sizeof(buffer))
+        return false;
+
+    memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = '\0';
+
+    char *endptr = nullptr;
+    float value = std::strtof(buffer, &endptr);
+    if (endptr == buffer || *endptr != '\0')
+        return false;
+
+    out = value;
+    return true;
+}
+
+static bool strtolFallback(std::string_view text, int &out)
+{
+    char buffer[64];
+    if (text.empty() || text.size() >= sizeof(buffer))
+        return false;
+
+    memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = '\0';
+
+    char *endptr = nullptr;
+    int value = std::strtol(buffer, &endptr, 10);
+    if (endptr == buffer || *endptr != '\0')
+        return false;
+
+    out = value;
+    return true;
+}
+
+bool parseFloat(std::string_view text, float &out)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // fast path: [sign] digits [. digits], no exponent. If the digits form an
+    // integer below 2^24 and there are at most 10 fraction digits, both the
+    // integer and the power of ten are exact floats, so a single IEEE division
+    // gives the correctly rounded result, same as strtof.
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fractionDigits = 0;
+
+    while (p != end && isDigit(*p) && digits < 19)
+    {
+        mantissa = mantissa * 10 + (*p++ - '0');
+        digits++;
+    }
+
+    if (p != end && *p == '.')
+    {
+        p++;
+        while (p != end && isDigit(*p) && digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p++ - '0');
+            digits++;
+            fractionDigits++;
+        }
+    }
+
+    if (p == end && digits > 0 && mantissa <= (1u << 24) && fractionDigits <= 10)
+    {
+        float value = (float)mantissa / POWERS_OF_TEN[fractionDigits];
+        out = negative ? -value : value;
+        return true;
+    }
+
+    // general case, from_chars doesn't take a leading '+' (but strtof does)
+    const char *first = text.data();
+    bool plus = first != end && *first == '+';
+    if (plus)
+        first++;
+
+    float value;
+    std::from_chars_result result = std::from_chars(first, end, value);
+    if (result.ec == std::errc() && result.ptr == end && !(plus && *first == '-'))
+    {
+        out = value;
+        return true;
+    }
+
+    return strtofFallback(text, out);
+}
+
+bool parseInt(std::string_view text, int &out)
+{
+    const char *p = text.data();
+    const char *end = p + text.size();
+
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // up to 9 digits can't overflow an int
+    if (p != end && end - p <= 9)
+    {
+        int value = 0;
+        while (p != end && isDigit(*p))
+            value = value * 10 + (*p++ - '0');
+
+        if (p == end)
+        {
+            out = negative ? -value : value;
+            return true;
+        }
+    }
+
+    return strtolFallback(text, out);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string_view>
+
+// Locale independent number parsing for map tokens. The whole text has to be
+// a number, the result is only written on success.
+//
+// parseFloat gives the same bits as std::strtof for every input strtof accepts.
+// Plain integers and short decimals (what Radiant writes) are converted with an
+// exact fast path, anything else goes through std::from_chars.
+bool parseFloat(std::string_view text, float &out);
+
+// Same as (int)std::strtol(text, &end, 10)
+bool parseInt(std::string_view text, int &out);
@@ -1,65 +1,224 @@
 #include "Parser.hpp"
-#include <cstdlib>
+#include "Number.hpp"
+#include "../Jobs/Jobs.hpp"
+#include <cerrno>
+#include <cstdarg>
 #include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
-static int entityCounter = 0;
-static int geoCounter = 0;
-
-#define EXPECT_TOKEN(lexer, token, expectedType, context)                                              \
-    do                                                                                                 \
-    {                                                                                                  \
-        Token __token = (token);                                                                       \
-        if ((__token).type != (expectedType))                                                          \
-        {                                                                                              \
-            printf("[Parse error] Expected %s in %s on line %d, got '%s' (TOKEN TYPE: %i)\n",          \
-                   #expectedType, context, (lexer).getLine(), (__token).text.c_str(), (__token).type); \
-            return false;                                                                              \
-        }                                                                                              \
+// Maps smaller than this aren't worth splitting up
+static const size_t PARALLEL_PARSE_MIN_SIZE = 256 * 1024;
+
+// Per-parse state. A parallel parse gives every entity its own state, which
+// are merged in file order afterwards.
+struct ParseState
+{
+    MapVisitor *visitor;
+    ParseContext *context;
+    bool geometry;
+    int entityCounter = 0;
+    int geoCounter = 0;
+
+    // reused between patches
+    std::vector<PatchVert> controlPoints;
+
+    ParseState(MapVisitor &visitor, ParseContext &context)
+        : visitor(&visitor), context(&context), geometry(visitor.wantsGeometry()) {}
+};
+
+// Records the first error of a parse in its context and prints it if asked to
+static void parseError(ParseState &state, int line, const char *format, ...)
+{
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    ParseContext &context = *state.context;
+    if (context.error.empty())
+    {
+        context.error = message;
+        context.errorLine = line;
+    }
+
+    if (context.printErrors)
+        printf("[Parse error] %s\n", message);
+}
+
+void reportOpenError(ParseContext &context, const char *fileName)
+{
+    const char *reason = strerror(errno);
+    context.error = std::string("Could not open file: ") + reason;
+    if (context.printErrors)
+        fprintf(stderr, "Failed to open %s: %s\n", fileName, reason);
+}
+
+// Builds the Map object graph from parser events
+class MapBuilder : public MapVisitor
+{
+public:
+    // first-seen order of models, used to merge entity maps
+    std::vector<std::string> models;
+
+    MapBuilder(Map *map, bool recordOrder) : map(map), recordOrder(recordOrder) {}
+
+    void onEntityBegin(int entityId) override
+    {
+        map->entities.emplace_back(entityId);
+        Entity &entity = map->entities.back();
+        entity.firstBrush = (int)map->brushes.size();
+        entity.firstPatch = (int)map->patches.size();
+    }
+
+    void onKeyValue(std::string_view key, std::string_view value) override
+    {
+        map->entities.back().properties[std::string(key)] = std::string(value);
+
+        if (key == "model")
+            addModel(value);
+    }
+
+    void onBrushBegin(int brushId) override
+    {
+        map->brushes.emplace_back(brushId, (int)map->entities.size() - 1, (int)map->faces.size());
+        map->entities.back().brushCount++;
+    }
+
+    void onBrushFace(const FaceDef &def) override
+    {
+        map->faces.emplace_back((int)map->brushes.size() - 1);
+        map->brushes.back().faceCount++;
+        Face &face = map->faces.back();
+
+        face.p1 = def.p1;
+        face.p2 = def.p2;
+        face.p3 = def.p3;
+        face.textureId = textureId(def.texture);
+        face.projectionType = def.projectionType;
+        face.textureProjection = def.textureProjection;
+        face.flagCount = def.flagCount;
+        for (int i = 0; i < 3; i++)
+            face.flags[i] = def.flags[i];
+    }
+
+    void onPatch(int patchId, const PatchDef &def) override
+    {
+        map->patches.emplace_back(patchId, (int)map->entities.size() - 1);
+        map->entities.back().patchCount++;
+        Patch &patch = map->patches.back();
+
+        patch.textureId = textureId(def.texture);
+        patch.width = def.width;
+        patch.height = def.height;
+        for (int i = 0; i < 3; i++)
+            patch.flags[i] = def.flags[i];
+
+        patch.firstControlPoint = (int)map->controlPoints.size();
+        if (def.width > 0 && def.height > 0)
+            map->controlPoints.insert(map->controlPoints.end(), def.controlPoints,
+                                      def.controlPoints + (size_t)def.width * def.height);
+    }
+
+private:
+    Map *map;
+    bool recordOrder;
+    int lastTexture = -1;
+
+    int textureId(std::string_view texture)
+    {
+        // faces of a brush mostly share their texture, skip the hash lookup
+        if (lastTexture >= 0 && map->textures[lastTexture] == texture)
+            return lastTexture;
+
+        lastTexture = map->InternTexture(texture);
+        return lastTexture;
+    }
+
+    void addModel(std::string_view model)
+    {
+        std::string name(model);
+        if (map->models.insert(name).second && recordOrder)
+            models.push_back(name);
+    }
+};
+
+#define EXPECT_TOKEN(lexer, token, expectedType, context)                                                            \
+    do                                                                                                               \
+    {                                                                                                                \
+        const Token &__token = (token);                                                                              \
+        if ((__token).type != (expectedType))                                                                        \
+        {                                                                                                            \
+            parseError(state, (lexer).getLine(), "Expected %s in %s on line %d, got '%.*s' (TOKEN TYPE: %i)",        \
+                       #expectedType, context, (lexer).getLine(), (int)(__token).text.size(), (__token).text.data(), \
+                       (int)(__token).type);                                                                         \
+            return false;                                                                                            \
+        }                                                                                                            \
     } while (0)
 
-#define ASSIGN_FLOAT(token, var, context)                                                                                              \
-    do                                                                                                                                 \
-    {                                                                                                                                  \
-        Token _tok = (token);                                                                                                          \
-        char *_endptr = nullptr;                                                                                                       \
-        float _val = std::strtof(_tok.text.c_str(), &_endptr);                                                                         \
-        if (_tok.text.empty() || _endptr == _tok.text.c_str() || *_endptr != '\0')                                                     \
-        {                                                                                                                              \
-            printf("[Parse error] Expected numeric string in %s on line %d, got '%s'\n", context, lexer.getLine(), _tok.text.c_str()); \
-            return false;                                                                                                              \
-        }                                                                                                                              \
-        (var) = _val;                                                                                                                  \
+#define ASSIGN_FLOAT(token, var, context)                                                                       \
+    do                                                                                                          \
+    {                                                                                                           \
+        const Token &_tok = (token);                                                                            \
+        float _skipped; /* without geometry the number is checked, not kept */                                  \
+        if (!parseFloat(_tok.text, state.geometry ? (var) : _skipped))                                          \
+        {                                                                                                       \
+            parseError(state, lexer.getLine(), "Expected numeric string in %s on line %d, got '%.*s'", context, \
+                       lexer.getLine(), (int)_tok.text.size(), _tok.text.data());                               \
+            return false;                                                                                       \
+        }                                                                                                       \
     } while (0)
 
-#define ASSIGN_INT(token, var, context)                                                                                                \
-    do                                                                                                                                 \
-    {                                                                                                                                  \
-        Token _tok = (token);                                                                                                          \
-        char *_endptr = nullptr;                                                                                                       \
-        int _val = std::strtol(_tok.text.c_str(), &_endptr, 10);                                                                       \
-        if (_tok.text.empty() || _endptr == _tok.text.c_str() || *_endptr != '\0')                                                     \
-        {                                                                                                                              \
-            printf("[Parse error] Expected numeric string in %s on line %d, got '%s'\n", context, lexer.getLine(), _tok.text.c_str()); \
-            return false;                                                                                                              \
-        }                                                                                                                              \
-        (var) = _val;                                                                                                                  \
+#define ASSIGN_INT(token, var, context)                                                                         \
+    do                                                                                                          \
+    {                                                                                                           \
+        const Token &_tok = (token);                                                                            \
+        if (!parseInt(_tok.text, (var)))                                                                        \
+        {                                                                                                       \
+            parseError(state, lexer.getLine(), "Expected numeric string in %s on line %d, got '%.*s'", context, \
+                       lexer.getLine(), (int)_tok.text.size(), _tok.text.data());                               \
+            return false;                                                                                       \
+        }                                                                                                       \
     } while (0)
 
-static bool parseBrush(Lexer &lexer, Brush *brush)
+// Brush primitive matrix of a brushDef face: ( ( a b c ) ( d e f ) )
+static bool parseBrushPrimitive(Lexer &lexer, ParseState &state, BrushPrimitiveUV &projection)
+{
+    Token tok;
+    EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "brushDef");
+
+    for (int row = 0; row < 2; row++)
+    {
+        EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "brushDef");
+        for (int col = 0; col < 3; col++)
+        {
+            EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "brushDef");
+            ASSIGN_FLOAT(tok, projection.matrix[row][col], "brushDef");
+        }
+        EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RPAREN, "brushDef");
+    }
+
+    EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RPAREN, "brushDef");
+    return true;
+}
+
+// Faces up to the brush's closing brace. brushDef faces have a brush
+// primitive matrix between the points and the texture.
+static bool parseBrush(Lexer &lexer, ParseState &state, bool primitive)
 {
     Token tok;
 
     while ((tok = lexer.next()).type != TokenType::RBRACE)
     {
-        brush->faces.emplace_back(brush);
-        Face &face = brush->faces.back();
-        face.parentBrush = brush;
+        FaceDef face;
 
         for (int i = 0; i < 3; i++)
         {
             EXPECT_TOKEN(lexer, tok, TokenType::LPAREN, "brush");
 
-            float x, y, z;
+            float x = 0.0f, y = 0.0f, z = 0.0f;
             EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "brush");
             ASSIGN_FLOAT(tok, x, "brush");
             EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "brush");
@@ -85,18 +244,26 @@ static bool parseBrush(Lexer &lexer, Brush *brush)
             tok = lexer.next();
         }
 
+        if (primitive)
+        {
+            lexer.pushBack(tok);
+            face.projectionType = TextureProjectionType::BrushPrimitive;
+            if (!parseBrushPrimitive(lexer, state, face.textureProjection.brushPrimitive))
+                return false;
+            tok = lexer.next();
+        }
+
         if (tok.type != TokenType::WORD && tok.type != TokenType::QUOTED_STRING)
         {
             EXPECT_TOKEN(lexer, tok, TokenType::WORD, "brush");
         }
 
         face.texture = tok.text;
-        face.parentBrush->parentEntity->parentMap->textureSizes[face.texture] = vec2(0.0f);
 
         tok = lexer.next();
         lexer.pushBack(tok);
 
-        if (tok.type == TokenType::LBRACKET)
+        if (!primitive && tok.type == TokenType::LBRACKET)
         {
             face.projectionType = TextureProjectionType::Valve220;
 
@@ -104,7 +271,7 @@ static bool parseBrush(Lexer &lexer, Brush *brush)
             {
                 EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LBRACKET, "brush");
 
-                float x, y, z, w;
+                float x = 0.0f, y = 0.0f, z = 0.0f, w = 0.0f;
                 EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "brush");
                 ASSIGN_FLOAT(tok, x, "brush");
                 EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "brush");
@@ -133,7 +300,7 @@ static bool parseBrush(Lexer &lexer, Brush *brush)
             ASSIGN_FLOAT(tok = lexer.next(), face.textureProjection.valve220.xScale, "brush");
             ASSIGN_FLOAT(tok = lexer.next(), face.textureProjection.valve220.yScale, "brush");
         }
-        else
+        else if (!primitive)
         {
             face.projectionType = TextureProjectionType::Standard;
 
@@ -148,49 +315,57 @@ static bool parseBrush(Lexer &lexer, Brush *brush)
 
         while (tok.type != TokenType::LPAREN && tok.type != TokenType::RBRACE)
         {
-            ASSIGN_INT(tok, face.flags[face.flagCount++], "brush");
+            int flag;
+            ASSIGN_INT(tok, flag, "brush");
+
+            // Quake 3 faces have three flags, any extra ones are dropped
+            if (face.flagCount < 3)
+                face.flags[face.flagCount++] = flag;
+
             tok = lexer.next();
         }
 
         lexer.pushBack(tok);
+        state.visitor->onBrushFace(face);
     }
 
     EXPECT_TOKEN(lexer, tok, TokenType::RBRACE, "brush");
     return true;
 }
 
-static bool parsePatch(Lexer &lexer, Patch *patch)
+static bool parsePatch(Lexer &lexer, ParseState &state, PatchDef &patch)
 {
     Token tok;
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LBRACE, "patch");
 
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::WORD, "patch");
-    patch->texture = tok.text;
-    patch->parentEntity->parentMap->textureSizes[patch->texture] = vec2(0.0f);
+    patch.texture = tok.text;
 
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "patch");
 
-    ASSIGN_INT(tok = lexer.next(), patch->height, "patch");
-    ASSIGN_INT(tok = lexer.next(), patch->width, "patch");
+    ASSIGN_INT(tok = lexer.next(), patch.height, "patch");
+    ASSIGN_INT(tok = lexer.next(), patch.width, "patch");
 
-    ASSIGN_INT(tok = lexer.next(), patch->flags[0], "patch");
-    ASSIGN_INT(tok = lexer.next(), patch->flags[1], "patch");
-    ASSIGN_INT(tok = lexer.next(), patch->flags[2], "patch");
+    ASSIGN_INT(tok = lexer.next(), patch.flags[0], "patch");
+    ASSIGN_INT(tok = lexer.next(), patch.flags[1], "patch");
+    ASSIGN_INT(tok = lexer.next(), patch.flags[2], "patch");
 
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RPAREN, "patch");
 
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "patch");
 
-    patch->controlPoints.reserve(patch->width);
+    std::vector<PatchVert> &controlPoints = state.controlPoints;
+    controlPoints.clear();
+    if (patch.width > 0 && patch.height > 0)
+        controlPoints.resize((size_t)patch.width * patch.height);
 
-    for (int i = 0; i < patch->height; i++)
+    for (int i = 0; i < patch.height; i++)
     {
-        std::vector<PatchVert> row(patch->width);
         EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "patch");
 
-        for (int j = 0; j < patch->width; j++)
+        for (int j = 0; j < patch.width; j++)
         {
-            PatchVert cp;
+            PatchVert &cp = controlPoints[(size_t)i * patch.width + j];
 
             EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LPAREN, "patch");
 
@@ -202,12 +377,8 @@ static bool parsePatch(Lexer &lexer, Patch *patch)
             ASSIGN_FLOAT(tok = lexer.next(), cp.uv.y, "patch");
 
             EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RPAREN, "patch");
-
-            row[j] = cp;
         }
 
-        patch->controlPoints.push_back(std::move(row));
-
         EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RPAREN, "patch");
     }
 
@@ -216,26 +387,26 @@ static bool parsePatch(Lexer &lexer, Patch *patch)
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RBRACE, "patch");
     EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RBRACE, "patch");
 
+    patch.controlPoints = controlPoints.data();
     return true;
 }
 
-static bool parseEntity(Lexer &lexer, Entity *entity)
+static bool parseEntity(Lexer &lexer, ParseState &state)
 {
     Token tok;
 
     while ((tok = lexer.next()).type != TokenType::RBRACE)
     {
-        if (tok.type == TokenType::QUOTED_STRING)
+        if (tok.type == TokenType::END)
+        {
+            // unterminated entity
+            EXPECT_TOKEN(lexer, tok, TokenType::RBRACE, "entity");
+        }
+        else if (tok.type == TokenType::QUOTED_STRING)
         {
-            std::string key = tok.text;
+            std::string_view key = tok.text;
             EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::QUOTED_STRING, "entity");
-            std::string value = tok.text;
-            entity->properties[key] = value;
-
-            if (key == "model")
-            {
-                entity->parentMap->models.insert(value);
-            }
+            state.visitor->onKeyValue(key, tok.text);
         }
         else if (tok.type == TokenType::LBRACE)
         {
@@ -243,22 +414,34 @@ static bool parseEntity(Lexer &lexer, Entity *entity)
 
             if (tok.type == TokenType::LPAREN)
             {
-                entity->brushes.emplace_back(geoCounter++, entity);
-                Brush &brush = entity->brushes.back();
-                brush.parentEntity = entity;
                 lexer.pushBack(tok);
+                state.visitor->onBrushBegin(state.geoCounter++);
 
-                if (!parseBrush(lexer, &brush))
+                if (!parseBrush(lexer, state, false))
                     return false;
+
+                state.visitor->onBrushEnd();
+            }
+            else if (tok.type == TokenType::WORD && tok.text == "brushDef")
+            {
+                EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::LBRACE, "brushDef");
+                state.visitor->onBrushBegin(state.geoCounter++);
+
+                if (!parseBrush(lexer, state, true))
+                    return false;
+
+                state.visitor->onBrushEnd();
+                EXPECT_TOKEN(lexer, tok = lexer.next(), TokenType::RBRACE, "brushDef");
             }
             else if (tok.type == TokenType::WORD && tok.text == "patchDef2")
             {
-                entity->patches.emplace_back(geoCounter++, entity);
-                Patch &patch = entity->patches.back();
-                patch.parentEntity = entity;
+                int patchId = state.geoCounter++;
+                PatchDef patch;
 
-                if (!parsePatch(lexer, &patch))
+                if (!parsePatch(lexer, state, patch))
                     return false;
+
+                state.visitor->onPatch(patchId, patch);
             }
         }
     }
@@ -266,41 +449,283 @@ static bool parseEntity(Lexer &lexer, Entity *entity)
     return true;
 }
 
-bool parseMap(Lexer &lexer, Map *map)
+static bool parseEntities(Lexer &lexer, ParseState &state)
 {
     Token tok;
 
     while ((tok = lexer.next()).type != TokenType::END)
     {
         EXPECT_TOKEN(lexer, tok, TokenType::LBRACE, "map file");
-        map->entities.emplace_back(entityCounter++, map);
-        Entity &entity = map->entities.back();
-        entity.parentMap = map;
+        state.visitor->onEntityBegin(state.entityCounter++);
 
-        if (!parseEntity(lexer, &entity))
+        if (!parseEntity(lexer, state))
             return false;
 
+        state.visitor->onEntityEnd();
         EXPECT_TOKEN(lexer, tok, TokenType::LBRACE, "map file");
     }
 
-    // Re-assign parents for entities, brushes etc. to avoid potential dangling pointers
-    // this is a temporary fix until we can refactor the code to use a better solution
-    for (auto &entity : map->entities)
+    return true;
+}
+
+// Byte range of one top-level entity, from its '{' to just past its '}'
+struct EntityChunk
+{
+    size_t begin, end;
+    int line;
+};
+
+// Bytes that end a word, same as the lexer's delimiters
+struct WordEndTable
+{
+    bool ends[256];
+
+    WordEndTable() : ends()
     {
-        entity.parentMap = map;
-        for (auto &brush : entity.brushes)
+        for (unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r', '{', '}', '(', ')', '[', ']', '"', '\0'})
+            ends[c] = true;
+    }
+};
+
+static const WordEndTable wordEnds;
+
+// Finds the top-level entities with a light scan that follows the lexer's
+// rules for whitespace, comments, quoted strings and words, including which
+// newlines it counts. Returns false if anything but entities and comments is
+// found at the top level or the braces don't balance, the serial parser then
+// handles (and reports) it.
+static bool findEntityChunks(std::string_view source, int line, std::vector<EntityChunk> &chunks)
+{
+    const char *src = source.data();
+    size_t length = source.size();
+    size_t pos = 0;
+    int depth = 0;
+
+    while (pos < length && src[pos] != '\0')
+    {
+        char c = src[pos];
+
+        switch (c)
         {
-            brush.parentEntity = &entity;
-            for (auto &face : brush.faces)
+        case '\n':
+            line++;
+            pos++;
+            break;
+        case ' ':
+        case '\t':
+        case '\v':
+        case '\f':
+        case '\r':
+            pos++;
+            break;
+        case '{':
+            if (depth++ == 0)
+                chunks.push_back({pos, 0, line});
+            pos++;
+            break;
+        case '}':
+            if (--depth < 0)
+                return false;
+            if (depth == 0)
+                chunks.back().end = pos + 1;
+            pos++;
+            break;
+        case '"':
+        {
+            // strings only belong inside entities, the serial parser reports
+            // a stray one
+            if (depth == 0)
+                return false;
+
+            // the lexer doesn't count newlines inside quoted strings
+            // a NUL in it ends the input like in the lexer, the loop stops there
+            const char *quote = findOrNul(&src[pos + 1], length - pos - 1, '"');
+            pos = !quote ? length : *quote == '"' ? quote - src + 1 : quote - src;
+            break;
+        }
+        default:
+            if (c == '/' && pos + 1 < length && src[pos + 1] == '/')
             {
-                face.parentBrush = &brush;
+                const char *newline = findOrNul(&src[pos + 2], length - pos - 2, '\n');
+                pos = newline ? newline - src : length;
+                break;
             }
+
+            if (depth == 0)
+                return false;
+
+            if (c == '(' || c == ')' || c == '[' || c == ']')
+            {
+                pos++;
+                break;
+            }
+
+            // a word, comments can't start inside one
+            while (pos < length && !wordEnds.ends[(unsigned char)src[pos]])
+                pos++;
+            break;
+        }
+    }
+
+    return depth == 0;
+}
+
+struct ChunkResult
+{
+    Map map;
+    int geoCount = 0;
+    std::vector<std::string> models;
+    bool ok = false;
+};
+
+// Parses every entity chunk with its own lexer and map, then moves the
+// entities into the map in file order. IDs are assigned as the serial parser
+// would. Returns false if any chunk doesn't parse cleanly, nothing is added to
+// the map in that case.
+static bool parseChunks(std::string_view source, const std::vector<EntityChunk> &chunks, int geoCounter, Map *map)
+{
+    std::vector<ChunkResult> results(chunks.size());
+
+    Jobs::ParallelFor(chunks.size(), [&](size_t i)
+    {
+        const EntityChunk &chunk = chunks[i];
+        ChunkResult &result = results[i];
+
+        // errors are left to the serial parser, which reports them in order
+        ParseContext context;
+        context.printErrors = false;
+
+        MapBuilder builder(&result.map, true);
+        ParseState state(builder, context);
+
+        Lexer lexer(source.data() + chunk.begin, chunk.end - chunk.begin, chunk.line);
+        result.ok = parseEntities(lexer, state) && result.map.entities.size() == 1;
+        result.geoCount = state.geoCounter;
+        result.models = std::move(builder.models);
+    });
+
+    for (const ChunkResult &result : results)
+    {
+        if (!result.ok)
+            return false;
+    }
+
+    size_t entityCount = 0, brushCount = 0, faceCount = 0, patchCount = 0, controlPointCount = 0;
+    for (const ChunkResult &result : results)
+    {
+        entityCount += result.map.entities.size();
+        brushCount += result.map.brushes.size();
+        faceCount += result.map.faces.size();
+        patchCount += result.map.patches.size();
+        controlPointCount += result.map.controlPoints.size();
+    }
+
+    map->entities.reserve(map->entities.size() + entityCount);
+    map->brushes.reserve(map->brushes.size() + brushCount);
+    map->faces.reserve(map->faces.size() + faceCount);
+    map->patches.reserve(map->patches.size() + patchCount);
+    map->controlPoints.reserve(map->controlPoints.size() + controlPointCount);
+
+    std::vector<int> textureIds;
+
+    // every chunk holds one entity, its pools are appended with the indices
+    // shifted to where they land in the map
+    for (ChunkResult &result : results)
+    {
+        Map &chunk = result.map;
+
+        // chunk texture IDs to map IDs, interned in the chunk's first-seen
+        // order so they come out as the serial parser numbers them
+        textureIds.clear();
+        for (const std::string &texture : chunk.textures)
+            textureIds.push_back(map->InternTexture(texture));
+
+        int entityIndex = (int)map->entities.size();
+        int brushBase = (int)map->brushes.size();
+        int faceBase = (int)map->faces.size();
+        int patchBase = (int)map->patches.size();
+        int controlPointBase = (int)map->controlPoints.size();
+
+        Entity &entity = chunk.entities[0];
+        entity.id = entityIndex;
+        entity.firstBrush += brushBase;
+        entity.firstPatch += patchBase;
+        map->entities.push_back(std::move(entity));
+
+        for (Brush &brush : chunk.brushes)
+        {
+            brush.id += geoCounter;
+            brush.entity = entityIndex;
+            brush.firstFace += faceBase;
+            map->brushes.push_back(brush);
+        }
+        for (Face &face : chunk.faces)
+        {
+            face.brush += brushBase;
+            face.textureId = textureIds[face.textureId];
+            map->faces.push_back(face);
         }
-        for (auto &patch : entity.patches)
+        for (Patch &patch : chunk.patches)
         {
-            patch.parentEntity = &entity;
+            patch.id += geoCounter;
+            patch.entity = entityIndex;
+            patch.textureId = textureIds[patch.textureId];
+            patch.firstControlPoint += controlPointBase;
+            map->patches.push_back(patch);
         }
+        map->controlPoints.insert(map->controlPoints.end(), chunk.controlPoints.begin(), chunk.controlPoints.end());
+        geoCounter += result.geoCount;
+
+        for (std::string &model : result.models)
+            map->models.emplace(std::move(model));
     }
 
     return true;
 }
+
+bool parseMap(Lexer &lexer, MapVisitor &visitor, ParseContext &context)
+{
+    ParseState state(visitor, context);
+    return parseEntities(lexer, state);
+}
+
+bool parseMap(Lexer &lexer, MapVisitor &visitor)
+{
+    ParseContext context;
+    return parseMap(lexer, visitor, context);
+}
+
+bool parseMap(Lexer &lexer, Map *map, ParseContext &context)
+{
+    MapBuilder builder(map, false);
+    ParseState state(builder, context);
+    state.entityCounter = (int)map->entities.size();
+
+    state.geoCounter = (int)(map->brushes.size() + map->patches.size());
+
+    // split large maps into entities and parse those in parallel, anything
+    // unusual (or an error) goes through the serial parser for exact output
+    std::string_view source = lexer.remaining();
+    std::vector<EntityChunk> chunks;
+    bool parsed = false;
+
+    if (context.parallel && source.size() >= PARALLEL_PARSE_MIN_SIZE && Jobs::ThreadCount() > 1 &&
+        findEntityChunks(source, lexer.getLine(), chunks) && chunks.size() > 1 &&
+        parseChunks(source, chunks, state.geoCounter, map))
+    {
+        lexer.skipToEnd();
+        parsed = true;
+    }
+
+    if (!parsed && !parseEntities(lexer, state))
+        return false;
+
+    map->BuildPlanes();
+    return true;
+}
+
+bool parseMap(Lexer &lexer, Map *map)
+{
+    ParseContext context;
+    return parseMap(lexer, map, context);
+}
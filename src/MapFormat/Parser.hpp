@@ -1,8 +1,30 @@
 #pragma once
 
+#include <string>
 #include "Lexer.hpp"
+#include "MapVisitor.hpp"
 #include "map.hpp"
 
+// Settings and results of one parse. The parser keeps no state of its own, so
+// any number of maps can be parsed at once as long as each has its own context.
+struct ParseContext
+{
+    bool parallel = true;    // split large maps up and parse the entities on the job pool
+    bool printErrors = true; // print parse errors to stdout as they happen
+
+    std::string error; // the parse error, empty on success
+    int errorLine = 0;
+};
+
+// Records that a map file couldn't be opened, with the reason from errno, and
+// prints it if the context asks for it
+void reportOpenError(ParseContext &context, const char *fileName);
+
 // Top-level entry point: fills in outMap and returns true on success.
+bool parseMap(Lexer &lx, Map *map, ParseContext &context);
 bool parseMap(Lexer &lx, Map *map);
 
+// Streams the map through a visitor in file order without building a Map.
+// Parsing stops at the first error, in which case false is returned.
+bool parseMap(Lexer &lx, MapVisitor &visitor, ParseContext &context);
+bool parseMap(Lexer &lx, MapVisitor &visitor);
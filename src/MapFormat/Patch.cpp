@@ -1,117 +1,188 @@
 #include "map.hpp"
 #include <glm/glm.hpp>
-#include <glm/gtc/constants.hpp>
-#include <glm/gtc/epsilon.hpp>
 #include <vector>
 #include <algorithm>
 #include <cmath>
 
-// Evaluate 1D quadratic Bezier (same as yours)
-static float BezierQuad1D(float b0, float b1, float b2, float t)
+// Most steps a 3x3 sub-patch is split into along each side
+static const int MAX_SUBDIVISIONS = 1 << Patch::MAX_LOD_LEVEL;
+
+// Quadratic Bernstein weights and their derivatives at t = k / N, for each
+// subdivision level N
+struct BezierBasis
 {
-    float it = 1.0f - t;
-    return b0 * (it * it) + 2.0f * b1 * (it * t) + b2 * (t * t);
-}
+    float weights[MAX_SUBDIVISIONS + 1][3];
+    float derivatives[MAX_SUBDIVISIONS + 1][3];
+};
 
-// A lightweight evaluator that only computes pos+uv (no normal, no recursion).
-static PatchVert EvaluatePatchPoint(
-    const PatchVert cp[3][3],
-    float u, float v)
+static const BezierBasis *GetBasis(int subdivisions)
 {
-    // first across U
-    PatchVert tmp[3];
-    for (int i = 0; i < 3; ++i)
+    static const std::vector<BezierBasis> levels = []
     {
-        tmp[i].position.x = BezierQuad1D(cp[i][0].position.x, cp[i][1].position.x, cp[i][2].position.x, u);
-        tmp[i].position.y = BezierQuad1D(cp[i][0].position.y, cp[i][1].position.y, cp[i][2].position.y, u);
-        tmp[i].position.z = BezierQuad1D(cp[i][0].position.z, cp[i][1].position.z, cp[i][2].position.z, u);
-        tmp[i].uv.x       = BezierQuad1D(cp[i][0].uv.x,       cp[i][1].uv.x,       cp[i][2].uv.x,       u);
-        tmp[i].uv.y       = BezierQuad1D(cp[i][0].uv.y,       cp[i][1].uv.y,       cp[i][2].uv.y,       u);
-    }
+        std::vector<BezierBasis> result(MAX_SUBDIVISIONS + 1);
+        for (int n = 1; n <= MAX_SUBDIVISIONS; n++)
+        {
+            for (int k = 0; k <= n; k++)
+            {
+                float t = float(k) / float(n);
+                float it = 1.0f - t;
+
+                result[n].weights[k][0] = it * it;
+                result[n].weights[k][1] = 2.0f * it * t;
+                result[n].weights[k][2] = t * t;
+
+                result[n].derivatives[k][0] = -2.0f * it;
+                result[n].derivatives[k][1] = 2.0f * (it - t);
+                result[n].derivatives[k][2] = 2.0f * t;
+            }
+        }
+        return result;
+    }();
 
-    // then across V
-    PatchVert out;
-    out.position.x = BezierQuad1D(tmp[0].position.x, tmp[1].position.x, tmp[2].position.x, v);
-    out.position.y = BezierQuad1D(tmp[0].position.y, tmp[1].position.y, tmp[2].position.y, v);
-    out.position.z = BezierQuad1D(tmp[0].position.z, tmp[1].position.z, tmp[2].position.z, v);
-    out.uv.x       = BezierQuad1D(tmp[0].uv.x,       tmp[1].uv.x,       tmp[2].uv.x,       v);
-    out.uv.y       = BezierQuad1D(tmp[0].uv.y,       tmp[1].uv.y,       tmp[2].uv.y,       v);
-    return out;
+    return &levels[subdivisions];
 }
 
-// Now the full patch evaluator that also computes a normal by finite‐difference
-static PatchVert EvaluateQuadPatch(
-    const std::vector<std::vector<PatchVert>> &cpGrid,
-    float u, float v)
+// One column of control points blended down a row of sub-patches
+struct BlendedColumn
 {
-    // pull out the 3×3 block into a fixed‐size array for speed & simplicity
-    PatchVert cp[3][3];
-    for (int i = 0; i < 3; ++i)
-        for (int j = 0; j < 3; ++j)
-            cp[i][j] = cpGrid[i][j];
-
-    // central sample
-    PatchVert center = EvaluatePatchPoint(cp, u, v);
-
-    // sample offsets for normal
-    const float d = 0.001f;
-    float u1 = glm::clamp(u + d, 0.0f, 1.0f);
-    float v1 = glm::clamp(v + d, 0.0f, 1.0f);
+    vec3 position;
+    vec2 uv;
+    vec3 dv; // derivative across the rows
+};
 
-    PatchVert pu = EvaluatePatchPoint(cp, u1, v);
-    PatchVert pv = EvaluatePatchPoint(cp, u, v1);
+// Where an output column samples: its first control column and weights
+struct ColumnStep
+{
+    int firstColumn;
+    const float *weights;
+    const float *derivatives;
+};
 
-    glm::vec3 du = pu.position - center.position;
-    glm::vec3 dv = pv.position - center.position;
+float Patch::Curvature(const PatchVert *controlPoints, int width, int height)
+{
+    // second differences down the columns and across the rows of every
+    // sub-patch, and its twist
+    float curvature = 0.0f;
+    for (int row = 0; row + 2 < height; row += 2)
+    {
+        for (int col = 0; col + 2 < width; col += 2)
+        {
+            const PatchVert *cp = controlPoints + (size_t)row * width + col;
+            float across = 0.0f, down = 0.0f;
+            for (int k = 0; k < 3; k++)
+            {
+                const PatchVert *r = cp + (size_t)k * width;
+                across = std::max(across, glm::length(r[0].position - 2.0f * r[1].position + r[2].position));
+                down = std::max(down, glm::length(cp[k].position - 2.0f * cp[width + k].position +
+                                                  cp[2 * width + k].position));
+            }
+            float twist = glm::length(cp[0].position - cp[2].position - cp[2 * width].position +
+                                      cp[2 * width + 2].position);
+            curvature = std::max(curvature, across + down + twist);
+        }
+    }
+    return curvature;
+}
 
-    center.normal = glm::normalize(glm::cross(du, dv));
-    return center;
+int Patch::RequiredLevel(float curvature)
+{
+    int level = 0;
+    while (level < MAX_LOD_LEVEL && LevelError(curvature, level) > MAX_ERROR)
+        level++;
+    return level;
 }
 
-void Patch::CalculateGeometry()
+void Patch::Tessellate(const PatchVert *controlPoints, int width, int height, int steps,
+                       std::vector<PatchVert> &grid, int &rows, int &columns)
 {
-    vertices.clear();
-    if (controlPoints.empty()) return;
-
-    int rows = (int)controlPoints.size();
-    int cols = (int)controlPoints[0].size();
-    int pV   = (rows - 1) / 2;
-    int pU   = (cols - 1) / 2;
-    if (pV < 1 || pU < 1) return;
-
-    // determine subdivisions dynamically
-    glm::vec3 c00 = controlPoints[0][0].position;
-    glm::vec3 cNN = controlPoints[rows-1][cols-1].position;
-    float diag = glm::length(cNN - c00);
-    int rawN = int(diag * 0.1f);
-    int N = std::clamp(rawN, 1, 5);
+    rows = columns = 0;
+
+    int cpRows = height;
+    int cpCols = width;
+    int pV   = (cpRows - 1) / 2;
+    int pU   = (cpCols - 1) / 2;
+    if (!controlPoints || pV < 1 || pU < 1) return;
+
+    int N = std::clamp(steps, 1, MAX_SUBDIVISIONS);
     int nV = pV * N;
     int nU = pU * N;
+    const BezierBasis &basis = *GetBasis(N);
+
+    size_t first = grid.size();
+    rows = nV + 1;
+    columns = nU + 1;
+    grid.resize(grid.size() + (size_t)rows * columns);
+    PatchVert *out = &grid[first];
+    // per thread so tessellating stays off the heap
+    static thread_local std::vector<BlendedColumn> blended;
+    static thread_local std::vector<ColumnStep> columnSteps;
+    blended.resize(cpCols);
+    columnSteps.resize(columns);
+    BlendedColumn *blend = blended.data();
+    ColumnStep *step = columnSteps.data();
+
+    // the sub-patch column and the step inside it are the same on every row,
+    // the last column is the end of the last sub-patch
+    for (int j = 0; j <= nU; ++j)
+    {
+        int subU = std::min(pU - 1, j / N);
+        step[j] = {subU * 2, basis.weights[j - subU * N], basis.derivatives[j - subU * N]};
+    }
 
-    vertices.resize(nV+1);
     for (int i = 0; i <= nV; ++i)
     {
-        float vParam  = float(i) / float(nV);
-        float vScaled = vParam * float(pV);
-        int   subV    = std::min(pV-1, int(std::floor(vScaled)));
-        float vLocal  = vScaled - float(subV);
+        // sub-patch row and the step inside it, the last row is the end of
+        // the last sub-patch
+        int subV = std::min(pV - 1, i / N);
+        const float *bv = basis.weights[i - subV * N];
+        const float *dbv = basis.derivatives[i - subV * N];
+
+        // blend the three control rows once, every vertex of the row then
+        // only blends across
+        const PatchVert *cp0 = controlPoints + (size_t)(subV * 2) * cpCols;
+        const PatchVert *cp1 = cp0 + cpCols;
+        const PatchVert *cp2 = cp1 + cpCols;
+        for (int c = 0; c < cpCols; ++c)
+        {
+            blend[c].position = bv[0] * cp0[c].position + bv[1] * cp1[c].position + bv[2] * cp2[c].position;
+            blend[c].uv = bv[0] * cp0[c].uv + bv[1] * cp1[c].uv + bv[2] * cp2[c].uv;
+            blend[c].dv = dbv[0] * cp0[c].position + dbv[1] * cp1[c].position + dbv[2] * cp2[c].position;
+        }
 
-        vertices[i].resize(nU+1);
+        PatchVert *row = out + (size_t)i * columns;
         for (int j = 0; j <= nU; ++j)
         {
-            float uParam  = float(j) / float(nU);
-            float uScaled = uParam * float(pU);
-            int   subU    = std::min(pU-1, int(std::floor(uScaled)));
-            float uLocal  = uScaled - float(subU);
-
-            // build a 3×3 control‐point block
-            std::vector<std::vector<PatchVert>> block(3, std::vector<PatchVert>(3));
-            for (int vv = 0; vv < 3; ++vv)
-                for (int uu = 0; uu < 3; ++uu)
-                    block[vv][uu] = controlPoints[subV*2 + vv][subU*2 + uu];
-
-            // evaluate
-            vertices[i][j] = EvaluateQuadPatch(block, uLocal, vLocal);
+            const float *bu = step[j].weights;
+            const float *dbu = step[j].derivatives;
+            const BlendedColumn *q = blend + step[j].firstColumn;
+
+            PatchVert &vert = row[j];
+            vert.position = bu[0] * q[0].position + bu[1] * q[1].position + bu[2] * q[2].position;
+            vert.uv = bu[0] * q[0].uv + bu[1] * q[1].uv + bu[2] * q[2].uv;
+
+            // exact normal from the partial derivatives, zero where the
+            // patch is pinched to a point
+            vec3 du = dbu[0] * q[0].position + dbu[1] * q[1].position + dbu[2] * q[2].position;
+            vec3 dv = bu[0] * q[0].dv + bu[1] * q[1].dv + bu[2] * q[2].dv;
+            vec3 normal = glm::cross(du, dv);
+            float lengthSq = glm::dot(normal, normal);
+            vert.normal = lengthSq > 1e-12f ? normal / std::sqrt(lengthSq) : vec3(0.0f);
         }
     }
 }
+
+void Patch::CalculateGeometry(Map &map)
+{
+    CalculateGeometry(map, map.patchVertices);
+}
+
+void Patch::CalculateGeometry(const Map &map, std::vector<PatchVert> &grid)
+{
+    Span<const PatchVert> controlPoints = map.GetControlPoints(*this);
+
+    // at the level needed to stay within the error, flat patches stay at
+    // one step per sub-patch
+    firstVertex = (int)grid.size();
+    int level = controlPoints.empty() ? 0 : RequiredLevel(Curvature(controlPoints.data, width, height));
+    Tessellate(controlPoints.data, width, height, 1 << level, grid, rows, columns);
+}
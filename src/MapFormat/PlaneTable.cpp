@@ -0,0 +1,110 @@
+#include <cmath>
+#include <cstdint>
+#include "map.hpp"
+
+// Planes closer than this are the same plane
+static const float NORMAL_EPSILON = 1e-5f;
+static const float DIST_EPSILON = 0.01f;
+
+// Cells per unit of a normal component in the hash key
+static const float NORMAL_CELLS = 64.0f;
+
+// Cells a value falls in for hashing, rounded to the nearest multiple of
+// 1 / scale so axis aligned normals and whole distances sit in the middle
+// of a cell. A value within epsilon of a cell border can match planes in
+// the neighbouring cell, that one is the second. Degenerate faces have NaN
+// planes, they never match and share cell 0.
+struct HashCells
+{
+    int cells[2];
+    int count = 1;
+
+    HashCells(float value, float scale, float epsilon)
+    {
+        cells[0] = 0;
+        if (!std::isfinite(value))
+            return;
+
+        float scaled = value * scale + 0.5f;
+        cells[0] = (int)std::floor(scaled);
+        float border = scaled - (float)cells[0];
+        if (border < epsilon * scale)
+            cells[count++] = cells[0] - 1;
+        else if (border > 1.0f - epsilon * scale)
+            cells[count++] = cells[0] + 1;
+    }
+};
+
+// Normal cells fit in 8 bits each, the distance cell takes the rest
+static uint64_t HashKey(int x, int y, int z, int distance)
+{
+    return (uint64_t)(uint32_t)distance << 24 | (uint64_t)((x + 128) & 0xff) << 16 |
+           (uint64_t)((y + 128) & 0xff) << 8 | (uint64_t)((z + 128) & 0xff);
+}
+
+bool PlaneTable::Matches(int plane, const vec3 &normal, float distance) const
+{
+    return std::fabs(normalX[plane] - normal.x) < NORMAL_EPSILON &&
+           std::fabs(normalY[plane] - normal.y) < NORMAL_EPSILON &&
+           std::fabs(normalZ[plane] - normal.z) < NORMAL_EPSILON &&
+           std::fabs(distances[plane] - distance) < DIST_EPSILON;
+}
+
+void PlaneTable::Add(const vec3 &normal, float distance)
+{
+    int plane = (int)distances.size();
+    normalX.push_back(normal.x);
+    normalY.push_back(normal.y);
+    normalZ.push_back(normal.z);
+    distances.push_back(distance);
+
+    HashCells x(normal.x, NORMAL_CELLS, NORMAL_EPSILON), y(normal.y, NORMAL_CELLS, NORMAL_EPSILON),
+        z(normal.z, NORMAL_CELLS, NORMAL_EPSILON), d(distance, 1.0f, DIST_EPSILON);
+    auto head = buckets.emplace(HashKey(x.cells[0], y.cells[0], z.cells[0], d.cells[0]), -1).first;
+    next.push_back(head->second);
+    head->second = plane;
+}
+
+int PlaneTable::Find(const vec3 &normal, float distance)
+{
+    // one bucket, unless the plane is close to a cell border
+    HashCells x(normal.x, NORMAL_CELLS, NORMAL_EPSILON), y(normal.y, NORMAL_CELLS, NORMAL_EPSILON),
+        z(normal.z, NORMAL_CELLS, NORMAL_EPSILON), d(distance, 1.0f, DIST_EPSILON);
+    for (int i = 0; i < x.count; i++)
+    for (int j = 0; j < y.count; j++)
+    for (int k = 0; k < z.count; k++)
+    for (int l = 0; l < d.count; l++)
+    {
+        auto head = buckets.find(HashKey(x.cells[i], y.cells[j], z.cells[k], d.cells[l]));
+        if (head == buckets.end())
+            continue;
+
+        for (int plane = head->second; plane != -1; plane = next[plane])
+        {
+            if (Matches(plane, normal, distance))
+                return plane;
+        }
+    }
+
+    // both sides go in as a pair so Opposite is plane ^ 1
+    int plane = (int)distances.size();
+    Add(normal, distance);
+    Add(-normal, -distance);
+    return plane;
+}
+
+int PlaneTable::FromPoints(const vec3 &p1, const vec3 &p2, const vec3 &p3)
+{
+    vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1));
+    return Find(normal, glm::dot(normal, p1));
+}
+
+void PlaneTable::Clear()
+{
+    normalX.clear();
+    normalY.clear();
+    normalZ.clear();
+    distances.clear();
+    buckets.clear();
+    next.clear();
+}
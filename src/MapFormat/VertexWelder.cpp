@@ -0,0 +1,190 @@
+#include <cmath>
+#include "VertexWelder.hpp"
+
+// Cells are this many times the tolerance, few points are close enough to
+// a border to look at more than one
+static const float CELL_SIZE_IN_TOLERANCES = 256.0f;
+
+static const size_t MIN_TABLE_SIZE = 64;
+
+// Up to this many vertices a linear search is quicker than the grid, most
+// brushes never get past it
+static const int LINEAR_WELD_LIMIT = 32;
+
+static size_t HashCell(int x, int y, int z)
+{
+    return ((size_t)x * 73856093u) ^ ((size_t)y * 19349663u) ^ ((size_t)z * 83492791u);
+}
+
+VertexWelder::VertexWelder(float tolerance)
+    : tolerance(tolerance), cellScale(1.0f / (tolerance * CELL_SIZE_IN_TOLERANCES))
+{
+    table.resize(MIN_TABLE_SIZE, {0, 0, 0, -1});
+}
+
+void VertexWelder::Begin(std::vector<vec3> &out)
+{
+    for (int slot : usedSlots)
+        table[slot].head = -1;
+    usedSlots.clear();
+    next.clear();
+
+    vertices = &out;
+    firstVertex = (int)out.size();
+    hashed = false;
+}
+
+VertexWelder::Cell *VertexWelder::FindCell(int x, int y, int z)
+{
+    size_t mask = table.size() - 1;
+    for (size_t slot = HashCell(x, y, z) & mask;; slot = (slot + 1) & mask)
+    {
+        Cell &cell = table[slot];
+        if (cell.head == -1)
+            return nullptr;
+        if (cell.x == x && cell.y == y && cell.z == z)
+            return &cell;
+    }
+}
+
+VertexWelder::Cell &VertexWelder::AddCell(int x, int y, int z)
+{
+    if ((usedSlots.size() + 1) * 2 > table.size())
+        Grow();
+
+    size_t mask = table.size() - 1;
+    size_t slot = HashCell(x, y, z) & mask;
+    while (table[slot].head != -1)
+        slot = (slot + 1) & mask;
+
+    usedSlots.push_back((int)slot);
+    table[slot] = {x, y, z, -1};
+    return table[slot];
+}
+
+void VertexWelder::Grow()
+{
+    std::vector<Cell> cells;
+    cells.reserve(usedSlots.size());
+    for (int slot : usedSlots)
+        cells.push_back(table[slot]);
+
+    table.assign(table.size() * 2, {0, 0, 0, -1});
+    usedSlots.clear();
+
+    size_t mask = table.size() - 1;
+    for (const Cell &cell : cells)
+    {
+        size_t slot = HashCell(cell.x, cell.y, cell.z) & mask;
+        while (table[slot].head != -1)
+            slot = (slot + 1) & mask;
+
+        usedSlots.push_back((int)slot);
+        table[slot] = cell;
+    }
+}
+
+int VertexWelder::FindLinear(const vec3 &p) const
+{
+    const std::vector<vec3> &verts = *vertices;
+    float toleranceSq = tolerance * tolerance;
+
+    for (int v = firstVertex; v < (int)verts.size(); v++)
+    {
+        vec3 d = verts[v] - p;
+        if (glm::dot(d, d) < toleranceSq)
+            return v;
+    }
+
+    return -1;
+}
+
+int VertexWelder::FindHashed(const vec3 &p)
+{
+    const std::vector<vec3> &verts = *vertices;
+
+    // the cells the tolerance box around p touches, one per axis unless p
+    // is close to a border
+    vec3 low = (p - vec3(tolerance)) * cellScale;
+    vec3 high = (p + vec3(tolerance)) * cellScale;
+    int x0 = (int)std::floor(low.x), x1 = (int)std::floor(high.x);
+    int y0 = (int)std::floor(low.y), y1 = (int)std::floor(high.y);
+    int z0 = (int)std::floor(low.z), z1 = (int)std::floor(high.z);
+
+    float toleranceSq = tolerance * tolerance;
+    int match = -1;
+    for (int x = x0; x <= x1; x++)
+    {
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int z = z0; z <= z1; z++)
+            {
+                Cell *cell = FindCell(x, y, z);
+                if (!cell)
+                    continue;
+
+                for (int v = cell->head; v != -1; v = next[v - firstVertex])
+                {
+                    vec3 d = verts[v] - p;
+                    if (glm::dot(d, d) < toleranceSq && (match == -1 || v < match))
+                        match = v;
+                }
+            }
+        }
+    }
+
+    return match;
+}
+
+void VertexWelder::Insert(int vertex)
+{
+    const vec3 &p = (*vertices)[vertex];
+
+    // a NaN point matches nothing, it's left out of the grid
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+    {
+        next[vertex - firstVertex] = -1;
+        return;
+    }
+
+    vec3 scaled = p * cellScale;
+    int x = (int)std::floor(scaled.x), y = (int)std::floor(scaled.y), z = (int)std::floor(scaled.z);
+    Cell *cell = FindCell(x, y, z);
+    if (!cell)
+        cell = &AddCell(x, y, z);
+
+    next[vertex - firstVertex] = cell->head;
+    cell->head = vertex;
+}
+
+int VertexWelder::Weld(const vec3 &p)
+{
+    std::vector<vec3> &verts = *vertices;
+
+    int match = -1;
+    if (!hashed)
+        match = FindLinear(p);
+    else if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+        match = FindHashed(p);
+
+    if (match != -1)
+        return match;
+
+    int index = (int)verts.size();
+    verts.push_back(p);
+    next.push_back(-1);
+
+    if (hashed)
+    {
+        Insert(index);
+    }
+    else if (index - firstVertex >= LINEAR_WELD_LIMIT)
+    {
+        // big enough for the grid, everything so far goes in
+        hashed = true;
+        for (int v = firstVertex; v <= index; v++)
+            Insert(v);
+    }
+
+    return index;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include "map.hpp"
+
+// Merges points closer than a tolerance into one vertex. Once a set has more
+// than a few vertices they are hashed into a grid of cells much bigger than
+// the tolerance, so a point is only compared with the vertices in its own
+// cell, and in the neighbouring ones when it's within the tolerance of a
+// cell border. Distances are compared squared. Matches are the first vertex
+// in range, like a linear search would find.
+class VertexWelder
+{
+public:
+    explicit VertexWelder(float tolerance = 1e-3f);
+
+    // Starts a new set of welded points, new vertices are appended to vertices
+    void Begin(std::vector<vec3> &vertices);
+
+    // Index in the vertices of the vertex p welds to, p is appended if it's
+    // more than the tolerance away from all of them
+    int Weld(const vec3 &p);
+
+private:
+    struct Cell
+    {
+        int x, y, z;
+        int head; // last vertex added to the cell, -1 for an empty slot
+    };
+
+    float tolerance;
+    float cellScale; // 1 / cell size
+
+    std::vector<vec3> *vertices = nullptr;
+    int firstVertex = 0;
+    bool hashed = false; // small sets are searched linearly
+
+    std::vector<Cell> table;     // open addressing, a power of two in size
+    std::vector<int> usedSlots;  // cleared by Begin
+    std::vector<int> next;       // previous vertex in the same cell, by vertex - firstVertex
+
+    int FindLinear(const vec3 &p) const;
+    int FindHashed(const vec3 &p);
+    void Insert(int vertex);
+    Cell *FindCell(int x, int y, int z);
+    Cell &AddCell(int x, int y, int z);
+    void Grow();
+};
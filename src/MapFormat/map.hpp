@@ -1,8 +1,10 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <string_view>
 #include <glm/glm.hpp>
 
 using vec3 = glm::vec3;
@@ -11,6 +13,8 @@ using vec2 = glm::vec2;
 class Brush;
 class Entity;
 class Map;
+class MapVisitor;
+struct ParseContext;
 
 struct StandardUV
 {
@@ -23,10 +27,18 @@ struct Valve220
     vec3 uAxis, vAxis;
 };
 
+// brushDef faces: texture coordinates from the face's axis base, already
+// divided by the texture size
+struct BrushPrimitiveUV
+{
+    float matrix[2][3];
+};
+
 union TextureProjection
 {
     StandardUV standard;
     Valve220 valve220;
+    BrushPrimitiveUV brushPrimitive;
 };
 
 enum class TextureProjectionType
@@ -36,16 +48,80 @@ enum class TextureProjectionType
     BrushPrimitive
 };
 
+// Any of the projections as a 2x4 matrix, uv = (dot(u, p) + u[3], dot(v, p) + v[3])
+struct TextureMatrix
+{
+    float u[4], v[4];
+
+    vec2 Apply(const vec3 &p) const
+    {
+        return vec2(u[0] * p.x + u[1] * p.y + u[2] * p.z + u[3], v[0] * p.x + v[1] * p.y + v[2] * p.z + v[3]);
+    }
+
+    // UVs of points[indices[i]] for count indices
+    void Apply(const vec3 *points, const int *indices, int count, vec2 *uvs) const;
+};
+
+// Contiguous run of elements in one of the map's pools. Only valid until
+// the pool grows.
+template <typename T>
+struct Span
+{
+    T *data = nullptr;
+    size_t size = 0;
+
+    Span() = default;
+    Span(T *data, size_t size) : data(data), size(size) {}
+
+    T *begin() const { return data; }
+    T *end() const { return data + size; }
+    T &operator[](size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
+};
+
+// Every distinct plane of the map's faces, stored as separate arrays of
+// normal components and distances. Both sides of a plane are added as a
+// pair, so the opposite of plane i is i ^ 1.
+class PlaneTable
+{
+public:
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<float> distances;
+
+    // Index of the plane, added if no plane is close enough to it
+    int Find(const vec3 &normal, float distance);
+    // Same as above for the plane through three points
+    int FromPoints(const vec3 &p1, const vec3 &p2, const vec3 &p3);
+    void Clear();
+
+    size_t Count() const { return distances.size(); }
+    vec3 Normal(int plane) const { return vec3(normalX[plane], normalY[plane], normalZ[plane]); }
+    float Distance(int plane) const { return distances[plane]; }
+    static int Opposite(int plane) { return plane ^ 1; }
+
+private:
+    std::unordered_map<uint64_t, int> buckets; // normal and distance cells to the first plane
+    std::vector<int> next;                // next plane in the same bucket
+
+    bool Matches(int plane, const vec3 &normal, float distance) const;
+    void Add(const vec3 &normal, float distance);
+};
+
+// Brushes, faces and patches live in flat pools on the map and refer to each
+// other by index, which stays valid however the pools grow. Freeing the map
+// frees the pools in one go.
+
 class Face
 {
 public:
-    Brush *parentBrush;
+    int brush; // index into the map's brushes
 
     vec3 p1, p2, p3;
-    std::string texture;
-    vec2 textureSize;
-    std::vector<int> vertices;
-    std::vector<vec2> uvs;
+    int plane = -1; // index into the map's planes, set once the map is parsed
+    int textureId;  // index into the map's textures
+
+    // winding built by CalculateGeometry, a range of the map's faceIndices
+    int firstIndex = 0, indexCount = 0;
 
     TextureProjectionType projectionType;
     TextureProjection textureProjection;
@@ -53,19 +129,13 @@ public:
     int flags[3] = {0, 0, 0};
     int flagCount = 0;
 
-    Face(Brush *parent): parentBrush(parent) {}
-
-    vec3 GetNormal();
-    float GetDistance();
-    vec3 GetCenter();
-    std::vector<vec3> GetVertices();
-    void SortVertices();
-    vec2 GetUV(vec3 &vert);
+    explicit Face(int brush) : brush(brush) {}
 
-private:
-    vec3 normal = vec3(0.0f);
-    vec3 center = vec3(0.0f);
-    float distance = 0.0f;
+    // normal is the face plane's. A zero textureSize falls back to 512x512,
+    // brush primitive UVs don't depend on it.
+    TextureMatrix GetTextureMatrix(const vec3 &normal, vec2 textureSize) const;
+    // One vertex, faces with many should use the matrix
+    vec2 GetUV(const vec3 &vert, const vec3 &normal, vec2 textureSize) const;
 };
 
 struct AABB
@@ -77,19 +147,23 @@ class Brush
 {
 public:
     int id;
-    Entity *parentEntity;
-    std::vector<Face> faces;
-
-    Brush(int brushID, Entity *entity)
-        : id(brushID), parentEntity(entity) {}
-
-    vec3 GetCenter();
-    AABB GetAABB();
-    void CalculateGeometry();
+    int entity; // index into the map's entities
+    int firstFace, faceCount = 0;
 
+    // welded vertices built by CalculateGeometry, a range of the map's vertices
+    int firstVertex = 0, vertexCount = 0;
     vec3 center = vec3(0.0f);
     AABB aabb = {vec3(0.0f), vec3(0.0f)};
-    std::vector<vec3> vertices;
+
+    Brush(int brushID, int entity, int firstFace)
+        : id(brushID), entity(entity), firstFace(firstFace) {}
+
+    // Clips the faces against each other and appends the vertices and
+    // windings to the map's pools
+    void CalculateGeometry(Map &map);
+    // Same as above into other buffers, the ranges and indices are then
+    // relative to those
+    void CalculateGeometry(Map &map, std::vector<vec3> &vertices, std::vector<int> &indices);
 };
 
 struct PatchVert
@@ -103,31 +177,58 @@ class Patch
 {
 public:
     int id;
-    Entity *parentEntity;
-    std::string texture;
-    vec2 textureSize;
+    int entity; // index into the map's entities
+    int textureId; // index into the map's textures
     int width, height;
     int flags[3];
 
-    std::vector<std::vector<PatchVert>> controlPoints;
-    std::vector<std::vector<PatchVert>> vertices;
+    // width * height points of the map's controlPoints, row-major
+    int firstControlPoint;
 
-    Patch(int patchID, Entity *entity)
-        : id(patchID), parentEntity(entity) {}
+    // grid built by CalculateGeometry in the map's patchVertices, row-major
+    int firstVertex = 0, rows = 0, columns = 0;
 
-    void CalculateGeometry();
+    Patch(int patchID, int entity)
+        : id(patchID), entity(entity) {}
+
+    // Level L splits every 3x3 sub-patch into 2^L steps per side
+    static const int MAX_LOD_LEVEL = 3;
+    // Distance in map units a tessellation may be off the surface
+    static constexpr float MAX_ERROR = 1.0f;
+
+    // Tessellates the patch at its finest level and appends the grid to the
+    // map's patchVertices
+    void CalculateGeometry(Map &map);
+    // Same as above into another buffer, firstVertex is then relative to it
+    void CalculateGeometry(const Map &map, std::vector<PatchVert> &vertices);
+
+    // Bend of a control grid, the sum of its largest second differences
+    // across, down and diagonally over the sub-patches
+    static float Curvature(const PatchVert *controlPoints, int width, int height);
+    // How far a level can be off the surface, a bound for quadratic patches
+    static float LevelError(float curvature, int level)
+    {
+        float steps = (float)(1 << level);
+        return curvature / (4.0f * steps * steps);
+    }
+    // Level needed to stay within MAX_ERROR, the coarsest one that does and
+    // at most MAX_LOD_LEVEL. Finer levels are never needed.
+    static int RequiredLevel(float curvature);
+    // Appends the grid of a control grid with every sub-patch split into
+    // steps per side, rows and columns are zero if there's no grid
+    static void Tessellate(const PatchVert *controlPoints, int width, int height, int steps,
+                           std::vector<PatchVert> &grid, int &rows, int &columns);
 };
 
 class Entity
 {
 public:
     int id;
-    Map *parentMap;
     std::unordered_map<std::string, std::string> properties;
-    std::vector<Brush> brushes;
-    std::vector<Patch> patches;
+    int firstBrush = 0, brushCount = 0;
+    int firstPatch = 0, patchCount = 0;
 
-    Entity(int entityID, Map *map) : id(entityID), parentMap(map) {}
+    explicit Entity(int entityID) : id(entityID) {}
 };
 
 class Map
@@ -135,13 +236,64 @@ class Map
 public:
     std::string name;
     std::vector<Entity> entities;
-    std::unordered_map<std::string, vec2> textureSizes;
+    std::vector<Brush> brushes;
+    std::vector<Face> faces;
+    std::vector<Patch> patches;
+    std::vector<PatchVert> controlPoints;
+    PlaneTable planes; // built by BuildPlanes
+
+    // built by CalculateGeometry
+    std::vector<vec3> vertices;
+    std::vector<int> faceIndices; // face windings, indices into vertices
+    std::vector<PatchVert> patchVertices;
+
+    // textures are interned, faces and patches refer to them by ID
+    std::vector<std::string> textures;
+    std::vector<vec2> textureSizes; // zero until the texture is loaded
     std::unordered_set<std::string> models;
 
     bool failed;
 
     Map() = default;
+    // ID of a texture name, added the first time it's seen
+    int InternTexture(std::string_view name);
+    // ID of a texture name, -1 if no face or patch uses it
+    int FindTexture(std::string_view name) const;
     static bool Load(const char *filename, Map &map);
+    // Same as above, with the parse settings and error taken from the context
+    static bool Load(const char *filename, Map &map, ParseContext &context);
+    // Parses a map file straight into a visitor without building a Map,
+    // memory use stays flat regardless of the map size.
+    static bool Stream(const char *filename, MapVisitor &visitor);
+    static bool Stream(const char *filename, MapVisitor &visitor, ParseContext &context);
+    // Fills the plane table from the faces' points and points the faces at
+    // their planes. The parser does this once the map is read.
+    void BuildPlanes();
+    // Builds the vertices of every brush and tessellates every patch, spread
+    // over the job pool. The pools come out the same for any thread count.
+    void CalculateGeometry();
     std::string Stringify();
     void Print();
+
+    Span<Brush> GetBrushes(const Entity &entity) { return {brushes.data() + entity.firstBrush, (size_t)entity.brushCount}; }
+    Span<Patch> GetPatches(const Entity &entity) { return {patches.data() + entity.firstPatch, (size_t)entity.patchCount}; }
+    Span<Face> GetFaces(const Brush &brush) { return {faces.data() + brush.firstFace, (size_t)brush.faceCount}; }
+    Span<const Brush> GetBrushes(const Entity &entity) const { return {brushes.data() + entity.firstBrush, (size_t)entity.brushCount}; }
+    Span<const Patch> GetPatches(const Entity &entity) const { return {patches.data() + entity.firstPatch, (size_t)entity.patchCount}; }
+    Span<const Face> GetFaces(const Brush &brush) const { return {faces.data() + brush.firstFace, (size_t)brush.faceCount}; }
+
+    vec3 GetNormal(const Face &face) const { return planes.Normal(face.plane); }
+    float GetDistance(const Face &face) const { return planes.Distance(face.plane); }
+    Span<const vec3> GetVertices(const Brush &brush) const { return {vertices.data() + brush.firstVertex, (size_t)brush.vertexCount}; }
+    Span<const int> GetIndices(const Face &face) const { return {faceIndices.data() + face.firstIndex, (size_t)face.indexCount}; }
+    Span<const PatchVert> GetControlPoints(const Patch &patch) const
+    {
+        size_t count = patch.width > 0 && patch.height > 0 ? (size_t)patch.width * patch.height : 0;
+        return {controlPoints.data() + patch.firstControlPoint, count};
+    }
+    Span<const PatchVert> GetPatchVertices(const Patch &patch) const { return {patchVertices.data() + patch.firstVertex, (size_t)patch.rows * patch.columns}; }
+
+private:
+    std::unordered_map<std::string, int> textureIds;
+    std::string textureLookup; // reused lookup key
 };
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+#include "Culling.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SIMD_SSE2
+#endif
+
+namespace Scene
+{
+    static glm::vec4 Plane(const vec3 &normal, const vec3 &point)
+    {
+        vec3 n = glm::normalize(normal);
+        return glm::vec4(n, -glm::dot(n, point));
+    }
+
+    Frustum Frustum::FromCamera(const vec3 &position, const vec3 &target, const vec3 &up, float fovY, float aspect,
+                                float nearPlane, float farPlane)
+    {
+        vec3 forward = glm::normalize(target - position);
+        vec3 right = glm::normalize(glm::cross(forward, up));
+        vec3 cameraUp = glm::cross(right, forward);
+
+        // the side planes go through the eye, tilted out by half the field of view
+        float tanY = std::tan(fovY * (float)(M_PI / 180.0) * 0.5f);
+        float tanX = tanY * aspect;
+
+        Frustum frustum;
+        frustum.planes[0] = Plane(forward, position + forward * nearPlane);
+        frustum.planes[1] = Plane(-forward, position + forward * farPlane);
+        frustum.planes[2] = Plane(forward * tanX + right, position);
+        frustum.planes[3] = Plane(forward * tanX - right, position);
+        frustum.planes[4] = Plane(forward * tanY + cameraUp, position);
+        frustum.planes[5] = Plane(forward * tanY - cameraUp, position);
+        return frustum;
+    }
+
+    bool Frustum::Intersects(const AABB &box) const
+    {
+        vec3 center = (box.min + box.max) * 0.5f;
+        vec3 extent = (box.max - box.min) * 0.5f;
+
+        // outside when even the corner furthest along the normal is behind the plane
+        for (const glm::vec4 &plane : planes)
+        {
+            // summed in the same order as the four wide test in Cull
+            float distance = (plane.x * center.x + plane.y * center.y) + (plane.z * center.z + plane.w);
+            float radius = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y +
+                           std::fabs(plane.z) * extent.z;
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    AABB MeshBounds(const MeshData &mesh)
+    {
+        AABB box = {vec3(INFINITY), vec3(-INFINITY)};
+        for (size_t i = 0; i + 2 < mesh.vertices.size(); i += 3)
+        {
+            vec3 p(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+            box.min = glm::min(box.min, p);
+            box.max = glm::max(box.max, p);
+        }
+        return box;
+    }
+
+    AABB ToViewSpace(const AABB &box)
+    {
+        // the axis swap flips y into -z, so the corners trade places
+        vec3 a = ToViewSpace(box.min), b = ToViewSpace(box.max);
+        return {glm::min(a, b), glm::max(a, b)};
+    }
+
+    void ClusterCuller::Build(const std::vector<AABB> &bounds, float cellSize)
+    {
+        // sorting by cell then item keeps the clusters the same run to run
+        struct CellItem
+        {
+            int64_t x, y, z;
+            int item;
+
+            bool operator<(const CellItem &o) const
+            {
+                if (x != o.x)
+                    return x < o.x;
+                if (y != o.y)
+                    return y < o.y;
+                if (z != o.z)
+                    return z < o.z;
+                return item < o.item;
+            }
+        };
+
+        std::vector<CellItem> cells;
+        cells.reserve(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+        {
+            const AABB &box = bounds[i];
+            if (!(box.min.x <= box.max.x && box.min.y <= box.max.y && box.min.z <= box.max.z))
+                continue;
+
+            vec3 center = (box.min + box.max) * 0.5f / cellSize;
+            cells.push_back({(int64_t)std::floor(center.x), (int64_t)std::floor(center.y),
+                             (int64_t)std::floor(center.z), (int)i});
+        }
+        std::sort(cells.begin(), cells.end());
+
+        items.clear();
+        clusterFirst.assign(1, 0);
+        std::vector<AABB> clusterBounds;
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            const AABB &box = bounds[cells[i].item];
+            bool sameCell = i > 0 && cells[i].x == cells[i - 1].x && cells[i].y == cells[i - 1].y &&
+                            cells[i].z == cells[i - 1].z;
+            if (!sameCell)
+            {
+                if (i > 0)
+                    clusterFirst.push_back((int)items.size());
+                clusterBounds.push_back(box);
+            }
+
+            items.push_back(cells[i].item);
+            clusterBounds.back().min = glm::min(clusterBounds.back().min, box.min);
+            clusterBounds.back().max = glm::max(clusterBounds.back().max, box.max);
+        }
+        if (!items.empty())
+            clusterFirst.push_back((int)items.size());
+
+        size_t padded = (clusterBounds.size() + 3) & ~(size_t)3;
+        for (std::vector<float> *v : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+            v->assign(padded, 0.0f);
+
+        for (size_t c = 0; c < clusterBounds.size(); c++)
+        {
+            vec3 center = (clusterBounds[c].min + clusterBounds[c].max) * 0.5f;
+            vec3 extent = (clusterBounds[c].max - clusterBounds[c].min) * 0.5f;
+            centerX[c] = center.x;
+            centerY[c] = center.y;
+            centerZ[c] = center.z;
+            extentX[c] = extent.x;
+            extentY[c] = extent.y;
+            extentZ[c] = extent.z;
+        }
+
+        visible.clear();
+        visibleItems = 0;
+    }
+
+    AABB ClusterCuller::Bounds(int cluster) const
+    {
+        vec3 center(centerX[cluster], centerY[cluster], centerZ[cluster]);
+        vec3 extent(extentX[cluster], extentY[cluster], extentZ[cluster]);
+        return {center - extent, center + extent};
+    }
+
+    const std::vector<int> &ClusterCuller::Cull(const Frustum &frustum)
+    {
+        visible.clear();
+        visibleItems = 0;
+
+        int count = ClusterCount();
+        int c = 0;
+
+#if defined(CULLING_SIMD_SSE2)
+        // the planes are splatted once, each pass tests four clusters against all six
+        __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], w[6];
+        for (int p = 0; p < 6; p++)
+        {
+            const glm::vec4 &plane = frustum.planes[p];
+            nx[p] = _mm_set1_ps(plane.x);
+            ny[p] = _mm_set1_ps(plane.y);
+            nz[p] = _mm_set1_ps(plane.z);
+            ax[p] = _mm_set1_ps(std::fabs(plane.x));
+            ay[p] = _mm_set1_ps(std::fabs(plane.y));
+            az[p] = _mm_set1_ps(std::fabs(plane.z));
+            w[p] = _mm_set1_ps(plane.w);
+        }
+
+        for (; c < count; c += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[c]), cy = _mm_loadu_ps(&centerY[c]), cz = _mm_loadu_ps(&centerZ[c]);
+            __m128 ex = _mm_loadu_ps(&extentX[c]), ey = _mm_loadu_ps(&extentY[c]), ez = _mm_loadu_ps(&extentZ[c]);
+
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)),
+                    _mm_add_ps(_mm_mul_ps(nz[p], cz), w[p]));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)),
+                                           _mm_mul_ps(az[p], ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            }
+
+            // the padding past the last cluster is never visible
+            int mask = ~_mm_movemask_ps(outside) & 15;
+            if (count - c < 4)
+                mask &= (1 << (count - c)) - 1;
+
+            for (int i = 0; mask; i++, mask >>= 1)
+            {
+                if (mask & 1)
+                {
+                    visible.push_back(c + i);
+                    visibleItems += clusterFirst[c + i + 1] - clusterFirst[c + i];
+                }
+            }
+        }
+#else
+        for (; c < count; c++)
+        {
+            if (frustum.Intersects(Bounds(c)))
+            {
+                visible.push_back(c);
+                visibleItems += clusterFirst[c + 1] - clusterFirst[c];
+            }
+        }
+#endif
+
+        return visible;
+    }
+
+    std::vector<int> ClusterCuller::CullScalar(const Frustum &frustum) const
+    {
+        std::vector<int> result;
+        for (int c = 0; c < ClusterCount(); c++)
+        {
+            if (frustum.Intersects(Bounds(c)))
+                result.push_back(c);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Scene.hpp"
+
+namespace Scene
+{
+    // The six planes around what a perspective camera sees. A point is
+    // inside when dot(normal, point) + w >= 0 for every plane, the normals
+    // point inward.
+    struct Frustum
+    {
+        glm::vec4 planes[6]; // near, far, left, right, bottom, top
+
+        // Camera like raylib's, fovY in degrees and aspect as width / height
+        static Frustum FromCamera(const vec3 &position, const vec3 &target, const vec3 &up, float fovY, float aspect,
+                                  float nearPlane, float farPlane);
+
+        // Whether any of the box may be inside. Boxes near a corner of the
+        // frustum can pass without being inside, none inside are rejected.
+        bool Intersects(const AABB &box) const;
+    };
+
+    // Bounds of a mesh's vertices, in the mesh's space
+    AABB MeshBounds(const MeshData &mesh);
+    // Map space bounds to viewer space ones
+    AABB ToViewSpace(const AABB &box);
+
+    // Items grouped into clusters by the cell of a uniform grid their
+    // center falls in, each cluster with the bounds of all its items. A
+    // frame culls the clusters instead of every item, four of them per
+    // frustum plane test where SSE2 is there.
+    class ClusterCuller
+    {
+    public:
+        // Groups items by their bounds, item i has bounds[i]. Empty bounds
+        // (min above max) are left out of every cluster.
+        void Build(const std::vector<AABB> &bounds, float cellSize);
+
+        // Clusters that may be inside the frustum, in cluster order. The
+        // list is reused by the next call.
+        const std::vector<int> &Cull(const Frustum &frustum);
+        // Same with one frustum test per cluster and no SIMD, to check Cull
+        std::vector<int> CullScalar(const Frustum &frustum) const;
+
+        // Items of a cluster, in item order
+        Span<const int> Items(int cluster) const
+        {
+            return {items.data() + clusterFirst[cluster], (size_t)(clusterFirst[cluster + 1] - clusterFirst[cluster])};
+        }
+        AABB Bounds(int cluster) const;
+
+        int ClusterCount() const { return (int)clusterFirst.size() - 1; }
+        int ItemCount() const { return (int)items.size(); }
+        // Counts from the last Cull
+        int VisibleCount() const { return (int)visible.size(); }
+        int VisibleItemCount() const { return visibleItems; }
+
+    private:
+        // Cluster centers and half sizes, padded to a multiple of four
+        // clusters with empty ones that are never visible
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+
+        std::vector<int> clusterFirst = {0}; // items of cluster c start at clusterFirst[c]
+        std::vector<int> items;
+        std::vector<int> visible;
+        int visibleItems = 0;
+    };
+}
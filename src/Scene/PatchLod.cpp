@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include "PatchLod.hpp"
+#include "../FS/Hash.hpp"
+
+namespace Scene
+{
+    // Edges of a rows x columns grid: 0 is the first row, 1 the last row,
+    // 2 the first column and 3 the last column
+    static int EdgeLength(int edge, int rows, int columns)
+    {
+        return edge < 2 ? columns : rows;
+    }
+
+    static size_t EdgeIndex(int edge, int k, int rows, int columns)
+    {
+        switch (edge)
+        {
+        case 0: return (size_t)k;
+        case 1: return (size_t)(rows - 1) * columns + k;
+        case 2: return (size_t)k * columns;
+        default: return (size_t)k * columns + columns - 1;
+        }
+    }
+
+    static size_t GridTriangles(int rows, int columns)
+    {
+        return rows < 2 || columns < 2 ? 0 : 2 * (size_t)(rows - 1) * (columns - 1);
+    }
+
+    int PatchLod::AddPatch(const PatchVert *controlPoints, int width, int height, int textureId)
+    {
+        LodPatch patch;
+        patch.textureId = textureId;
+        patch.curvature = controlPoints ? Patch::Curvature(controlPoints, width, height) : 0.0f;
+        patch.finestLevel = Patch::RequiredLevel(patch.curvature);
+        patch.firstGrid = (int)grids.size();
+        patch.firstControlPoint = (int)controlPositions.size();
+        patch.width = controlPoints ? width : 0;
+        patch.height = controlPoints ? height : 0;
+
+        patch.mins = vec3(INFINITY);
+        patch.maxs = vec3(-INFINITY);
+        for (int i = 0; i < patch.width * patch.height; i++)
+        {
+            const vec3 &p = controlPoints[i].position;
+            patch.mins = glm::min(patch.mins, p);
+            patch.maxs = glm::max(patch.maxs, p);
+            controlPositions.push_back(p);
+        }
+
+        for (int level = 0; level <= patch.finestLevel; level++)
+        {
+            Grid grid;
+            grid.firstVertex = (int)vertices.size();
+            Patch::Tessellate(controlPoints, width, height, 1 << level, vertices, grid.rows, grid.columns);
+            grids.push_back(grid);
+        }
+
+        patches.push_back(patch);
+        return (int)patches.size() - 1;
+    }
+
+    void PatchLod::Finish()
+    {
+        // an edge's control points from its lexically smaller end, so the
+        // same edge walked the other way round compares equal
+        struct EdgeKey
+        {
+            uint64_t hash;
+            int patch, edge;
+        };
+
+        std::vector<EdgeKey> keys;
+        std::vector<std::vector<vec3>> edges;
+        for (int p = 0; p < (int)patches.size(); p++)
+        {
+            const LodPatch &patch = patches[p];
+            const vec3 *cp = controlPositions.data() + patch.firstControlPoint;
+            if (patch.width < 3 || patch.height < 3)
+                continue;
+
+            for (int edge = 0; edge < 4; edge++)
+            {
+                int length = EdgeLength(edge, patch.height, patch.width);
+                std::vector<vec3> points(length);
+                for (int k = 0; k < length; k++)
+                    points[k] = cp[EdgeIndex(edge, k, patch.height, patch.width)];
+
+                // edges pinched to a point match every other pinched edge
+                if (std::all_of(points.begin(), points.end(), [&](const vec3 &p) { return p == points[0]; }))
+                    continue;
+
+                const vec3 &first = points.front(), &last = points.back();
+                if (std::tie(last.x, last.y, last.z) < std::tie(first.x, first.y, first.z))
+                    std::reverse(points.begin(), points.end());
+
+                keys.push_back({FS::Hash64(points.data(), points.size() * sizeof(vec3)), p, edge});
+                edges.push_back(std::move(points));
+            }
+        }
+
+        std::vector<int> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return keys[a].hash < keys[b].hash; });
+
+        // identical edges among the ones with the same hash make a group
+        groupFirst.clear();
+        groupMembers.clear();
+        std::vector<char> grouped(keys.size(), 0);
+        for (size_t i = 0; i < order.size();)
+        {
+            size_t end = i + 1;
+            while (end < order.size() && keys[order[end]].hash == keys[order[i]].hash)
+                end++;
+
+            for (size_t a = i; a < end; a++)
+            {
+                if (grouped[order[a]])
+                    continue;
+
+                size_t first = groupMembers.size();
+                groupMembers.push_back({keys[order[a]].patch, keys[order[a]].edge});
+                for (size_t b = a + 1; b < end; b++)
+                {
+                    if (!grouped[order[b]] && edges[order[a]] == edges[order[b]])
+                    {
+                        grouped[order[b]] = 1;
+                        groupMembers.push_back({keys[order[b]].patch, keys[order[b]].edge});
+                    }
+                }
+
+                // an edge nothing else has needs no group
+                if (groupMembers.size() - first < 2)
+                {
+                    groupMembers.resize(first);
+                    continue;
+                }
+
+                int group = (int)groupFirst.size();
+                groupFirst.push_back((int)first);
+                for (size_t m = first; m < groupMembers.size(); m++)
+                    patches[groupMembers[m].patch].edgeGroups[groupMembers[m].edge] = group;
+            }
+            i = end;
+        }
+        groupFirst.push_back((int)groupMembers.size());
+        groupLevels.assign(groupFirst.size() - 1, 0);
+    }
+
+    void PatchLod::UpdateGroupLevels()
+    {
+        for (size_t g = 0; g + 1 < groupFirst.size(); g++)
+        {
+            int level = Patch::MAX_LOD_LEVEL;
+            for (int m = groupFirst[g]; m < groupFirst[g + 1]; m++)
+                level = std::min(level, patches[groupMembers[m].patch].level);
+            groupLevels[g] = level;
+        }
+    }
+
+    std::vector<int> PatchLod::Select(const vec3 &eye, float fovY, float viewportHeight, float maxPixelError)
+    {
+        // pixels one map unit covers at distance 1
+        float pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+
+        std::vector<char> changed(patches.size(), 0);
+        for (int p = 0; p < (int)patches.size(); p++)
+        {
+            LodPatch &patch = patches[p];
+
+            vec3 outside = glm::max(glm::max(patch.mins - eye, eye - patch.maxs), vec3(0.0f));
+            float distance = glm::length(outside);
+
+            int level = 0;
+            while (level < patch.finestLevel &&
+                   Patch::LevelError(patch.curvature, level) * pixelsPerUnit > maxPixelError * distance)
+                level++;
+
+            changed[p] = level != patch.level;
+            patch.level = level;
+        }
+
+        // a patch's mesh also changes when one of its shared edges does
+        std::vector<int> previousGroupLevels = groupLevels;
+        UpdateGroupLevels();
+
+        std::vector<int> result;
+        for (int p = 0; p < (int)patches.size(); p++)
+        {
+            for (int group : patches[p].edgeGroups)
+            {
+                if (group >= 0 && groupLevels[group] != previousGroupLevels[group])
+                    changed[p] = 1;
+            }
+
+            if (changed[p])
+                result.push_back(p);
+        }
+        return result;
+    }
+
+    void PatchLod::SelectLevel(int level)
+    {
+        for (LodPatch &patch : patches)
+            patch.level = std::clamp(level, 0, patch.finestLevel);
+        UpdateGroupLevels();
+    }
+
+    void PatchLod::GetGrid(int patch, std::vector<PatchVert> &grid, int &rows, int &columns) const
+    {
+        const LodPatch &lod = patches[patch];
+        const Grid &selected = SelectedGrid(patch);
+        rows = selected.rows;
+        columns = selected.columns;
+
+        const PatchVert *first = vertices.data() + selected.firstVertex;
+        grid.assign(first, first + (size_t)rows * columns);
+        if (rows < 2 || columns < 2)
+            return;
+
+        // levels nest, every vertex of a coarser edge is also on this one and
+        // the ones in between go on the line joining them
+        for (int edge = 0; edge < 4; edge++)
+        {
+            int group = lod.edgeGroups[edge];
+            if (group < 0 || groupLevels[group] >= lod.level)
+                continue;
+
+            int edgeLevel = groupLevels[group];
+
+            int stride = 1 << (lod.level - edgeLevel);
+            int length = EdgeLength(edge, rows, columns);
+            for (int k = 0; k < length; k++)
+            {
+                int offset = k % stride;
+                if (offset == 0)
+                    continue;
+
+                const PatchVert &a = grid[EdgeIndex(edge, k - offset, rows, columns)];
+                const PatchVert &b = grid[EdgeIndex(edge, k - offset + stride, rows, columns)];
+                float t = (float)offset / (float)stride;
+
+                PatchVert &vert = grid[EdgeIndex(edge, k, rows, columns)];
+                vert.position = a.position + (b.position - a.position) * t;
+                vert.uv = a.uv + (b.uv - a.uv) * t;
+            }
+        }
+    }
+
+    MeshData PatchLod::BuildMesh(int patch) const
+    {
+        static thread_local std::vector<PatchVert> grid;
+        int rows, columns;
+        GetGrid(patch, grid, rows, columns);
+        return BuildGridMesh(grid.data(), rows, columns, patches[patch].textureId);
+    }
+
+    size_t PatchLod::TriangleCount(int level) const
+    {
+        size_t triangles = 0;
+        for (const LodPatch &patch : patches)
+        {
+            const Grid &grid = grids[patch.firstGrid + std::clamp(level, 0, patch.finestLevel)];
+            triangles += GridTriangles(grid.rows, grid.columns);
+        }
+        return triangles;
+    }
+
+    size_t PatchLod::SelectedTriangleCount() const
+    {
+        size_t triangles = 0;
+        for (int p = 0; p < (int)patches.size(); p++)
+        {
+            if (patches[p].level >= 0)
+                triangles += GridTriangles(SelectedGrid(p).rows, SelectedGrid(p).columns);
+        }
+        return triangles;
+    }
+
+    // Distance from p to the polyline through points
+    static float DistanceToPolyline(const vec3 &p, const std::vector<vec3> &points)
+    {
+        float best = INFINITY;
+        for (size_t i = 0; i + 1 < points.size(); i++)
+        {
+            vec3 ab = points[i + 1] - points[i];
+            float lengthSq = glm::dot(ab, ab);
+            float t = lengthSq > 0.0f ? std::clamp(glm::dot(p - points[i], ab) / lengthSq, 0.0f, 1.0f) : 0.0f;
+            best = std::min(best, glm::length(points[i] + t * ab - p));
+        }
+        return best;
+    }
+
+    float PatchLod::MaxEdgeGap() const
+    {
+        std::vector<PatchVert> grid;
+        std::vector<vec3> reference, other;
+        float gap = 0.0f;
+
+        // every member of a group against the first one, both ways round
+        auto getEdge = [&](const GroupMember &member, std::vector<vec3> &points)
+        {
+            int rows, columns;
+            GetGrid(member.patch, grid, rows, columns);
+            points.clear();
+            for (int k = 0; k < EdgeLength(member.edge, rows, columns); k++)
+                points.push_back(grid[EdgeIndex(member.edge, k, rows, columns)].position);
+        };
+
+        for (size_t g = 0; g + 1 < groupFirst.size(); g++)
+        {
+            getEdge(groupMembers[groupFirst[g]], reference);
+            for (int m = groupFirst[g] + 1; m < groupFirst[g + 1]; m++)
+            {
+                getEdge(groupMembers[m], other);
+                for (const vec3 &p : other)
+                    gap = std::max(gap, DistanceToPolyline(p, reference));
+                for (const vec3 &p : reference)
+                    gap = std::max(gap, DistanceToPolyline(p, other));
+            }
+        }
+
+        return gap;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include "Scene.hpp"
+
+namespace Scene
+{
+    // Every tessellation level of a set of patches, from one step per
+    // sub-patch up to the one Patch::RequiredLevel gives, and the level
+    // each patch is drawn at. Levels are picked by how many pixels their
+    // error covers from the camera. Where a patch shares an edge with a
+    // coarser one its edge vertices are moved onto the coarser edge, so
+    // neighbours meet without cracks whatever their levels.
+    class PatchLod
+    {
+    public:
+        // Adds a patch and tessellates all its levels, returns its index
+        int AddPatch(const PatchVert *controlPoints, int width, int height, int textureId);
+
+        // Finds the edges patches share, call once all of them are added
+        void Finish();
+
+        // Picks the coarsest level of every patch whose error is at most
+        // maxPixelError pixels at its distance from eye, in map units. fovY is
+        // in radians. Returns the patches whose mesh changed since the last
+        // call, all of them the first time.
+        std::vector<int> Select(const vec3 &eye, float fovY, float viewportHeight, float maxPixelError);
+
+        // Puts every patch at level, or at its finest if that's coarser
+        void SelectLevel(int level);
+
+        // Grid of a patch at its selected level with the shared edges fixed
+        // up, only once Select or SelectLevel picked the levels
+        void GetGrid(int patch, std::vector<PatchVert> &grid, int &rows, int &columns) const;
+        MeshData BuildMesh(int patch) const;
+
+        int PatchCount() const { return (int)patches.size(); }
+        int Level(int patch) const { return patches[patch].level; }
+        // Finest level kept for the patch, its Patch::RequiredLevel
+        int FinestLevel(int patch) const { return patches[patch].finestLevel; }
+        float Error(int patch, int level) const { return Patch::LevelError(patches[patch].curvature, level); }
+        // Map space bounds of the patch at any level
+        AABB Bounds(int patch) const { return {patches[patch].mins, patches[patch].maxs}; }
+
+        // Triangles of all patches at level, or at their finest if coarser
+        size_t TriangleCount(int level) const;
+        // Triangles of all patches at their selected levels
+        size_t SelectedTriangleCount() const;
+        // Vertices kept for all the levels
+        size_t CachedVertexCount() const { return vertices.size(); }
+
+        // Largest distance from a shared edge vertex to the neighbour's edge
+        // at the selected levels, 0 when there are no cracks
+        float MaxEdgeGap() const;
+
+    private:
+        struct Grid
+        {
+            int firstVertex;
+            int rows, columns;
+        };
+
+        struct LodPatch
+        {
+            int textureId;
+            float curvature;
+            int finestLevel;
+            int level = -1;
+            int firstGrid;
+            vec3 mins, maxs; // bounds of the control points, the patch is inside
+            int firstControlPoint, width, height;
+            int edgeGroups[4] = {-1, -1, -1, -1};
+        };
+
+        // An edge of a patch in a group of patches that all have it
+        struct GroupMember
+        {
+            int patch, edge;
+        };
+
+        std::vector<LodPatch> patches;
+        std::vector<Grid> grids;          // finestLevel + 1 per patch
+        std::vector<PatchVert> vertices;  // all the grids
+        std::vector<vec3> controlPositions;
+
+        // Shared edges, members of group g are groupMembers[groupFirst[g]]
+        // up to groupFirst[g + 1]. An edge is drawn at its group's level,
+        // the coarsest of its members.
+        std::vector<int> groupFirst;
+        std::vector<GroupMember> groupMembers;
+        std::vector<int> groupLevels;
+
+        const Grid &SelectedGrid(int patch) const { return grids[patches[patch].firstGrid + patches[patch].level]; }
+        void UpdateGroupLevels();
+    };
+}
@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <numeric>
+#include "Scene.hpp"
+#include "../Jobs/Jobs.hpp"
+
+namespace Scene
+{
+    vec3 ToViewSpace(const vec3 &v)
+    {
+        return vec3(v.x / 30.0f, v.z / 30.0f, -v.y / 30.0f);
+    }
+
+    vec3 FromViewSpace(const vec3 &v)
+    {
+        return vec3(v.x * 30.0f, -v.z * 30.0f, v.y * 30.0f);
+    }
+
+    bool IsHiddenTexture(std::string_view texture)
+    {
+        return texture.compare(0, 7, "common/") == 0;
+    }
+
+    // Triangle fan over a face's winding. vertex(i) and uv(i) give the
+    // corners, all of them share the face normal.
+    template <typename VertexFn, typename UVFn>
+    static void BuildFan(MeshData &mesh, int vertexCount, vec3 faceNormal, VertexFn vertex, UVFn uv)
+    {
+        if (vertexCount < 3)
+            return; // need at least a triangle
+
+        // the normal only needs the axis swap
+        vec3 normal(faceNormal.x, faceNormal.z, -faceNormal.y);
+
+        mesh.vertices.reserve(3 * vertexCount);
+        mesh.normals.reserve(3 * vertexCount);
+        mesh.texcoords.reserve(2 * vertexCount);
+
+        for (int i = 0; i < vertexCount; i++)
+        {
+            vec3 p = ToViewSpace(vertex(i));
+            vec2 t = uv(i);
+
+            mesh.vertices.insert(mesh.vertices.end(), {p.x, p.y, p.z});
+            mesh.normals.insert(mesh.normals.end(), {normal.x, normal.y, normal.z});
+            mesh.texcoords.insert(mesh.texcoords.end(), {t.x, t.y});
+        }
+
+        int triangleCount = vertexCount - 2;
+        mesh.indices.reserve(3 * triangleCount);
+        for (int i = 0; i < triangleCount; i++)
+        {
+            mesh.indices.insert(mesh.indices.end(),
+                                {0, (uint32_t)(i + 1), (uint32_t)(i + 2)});
+        }
+    }
+
+    // Two triangles per quad of a tessellated patch, row(i) points to the
+    // columns vertices of row i
+    template <typename RowFn>
+    static void BuildGrid(MeshData &mesh, int rows, int columns, RowFn row)
+    {
+        if (rows < 2 || columns < 2)
+            return; // need at least one quad
+
+        mesh.vertices.reserve(3 * rows * columns);
+        mesh.normals.reserve(3 * rows * columns);
+        mesh.texcoords.reserve(2 * rows * columns);
+
+        for (int i = 0; i < rows; i++)
+        {
+            const PatchVert *verts = row(i);
+
+            for (int j = 0; j < columns; j++)
+            {
+                const PatchVert &pv = verts[j];
+                vec3 p = ToViewSpace(pv.position);
+                vec3 n(pv.normal.x, pv.normal.z, -pv.normal.y);
+
+                mesh.vertices.insert(mesh.vertices.end(), {p.x, p.y, p.z});
+                mesh.normals.insert(mesh.normals.end(), {n.x, n.y, n.z});
+                mesh.texcoords.insert(mesh.texcoords.end(), {pv.uv.x, pv.uv.y});
+            }
+        }
+
+        mesh.indices.reserve(6 * (rows - 1) * (columns - 1));
+        for (int i = 0; i < rows - 1; i++)
+        {
+            for (int j = 0; j < columns - 1; j++)
+            {
+                uint32_t topLeft = i * columns + j;
+                uint32_t bottomLeft = (i + 1) * columns + j;
+                uint32_t topRight = topLeft + 1;
+                uint32_t bottomRight = bottomLeft + 1;
+
+                mesh.indices.insert(mesh.indices.end(), {topLeft, bottomLeft, topRight});
+                mesh.indices.insert(mesh.indices.end(), {topRight, bottomLeft, bottomRight});
+            }
+        }
+    }
+
+    MeshData BuildFaceMesh(const Map &map, const Face &face, vec2 textureSize)
+    {
+        MeshData mesh;
+        mesh.textureId = face.textureId;
+
+        Span<const int> winding = map.GetIndices(face);
+        vec3 normal = map.GetNormal(face);
+
+        // one matrix per face, then all its UVs in one go
+        static thread_local std::vector<vec2> uvs;
+        uvs.resize(winding.size);
+        face.GetTextureMatrix(normal, textureSize).Apply(map.vertices.data(), winding.data, (int)winding.size, uvs.data());
+
+        BuildFan(mesh, (int)winding.size, normal,
+                 [&](int i) { return map.vertices[winding[i]]; },
+                 [&](int i) { return uvs[i]; });
+
+        return mesh;
+    }
+
+    MeshData BuildPatchMesh(const Map &map, const Patch &patch)
+    {
+        return BuildGridMesh(map.GetPatchVertices(patch).data, patch.rows, patch.columns, patch.textureId);
+    }
+
+    MeshData BuildGridMesh(const PatchVert *grid, int rows, int columns, int textureId)
+    {
+        MeshData mesh;
+        mesh.textureId = textureId;
+        BuildGrid(mesh, rows, columns, [&](int i) { return grid + (size_t)i * columns; });
+        return mesh;
+    }
+
+    // What one mesh is built from: a face index, or a patch index as ~index
+    using MeshSource = int;
+
+    std::vector<MeshData> BuildMeshes(Map &map)
+    {
+        std::vector<char> hidden(map.textures.size());
+        for (size_t i = 0; i < map.textures.size(); i++)
+            hidden[i] = IsHiddenTexture(map.textures[i]);
+
+        // the order is fixed up front, the meshes are then built in parallel
+        std::vector<MeshSource> sources;
+        sources.reserve(map.faces.size() + map.patches.size());
+        for (auto &e : map.entities)
+        {
+            for (int b = e.firstBrush; b < e.firstBrush + e.brushCount; b++)
+            {
+                const Brush &brush = map.brushes[b];
+                for (int f = brush.firstFace; f < brush.firstFace + brush.faceCount; f++)
+                {
+                    if (!hidden[map.faces[f].textureId])
+                        sources.push_back(f);
+                }
+            }
+
+            for (int p = e.firstPatch; p < e.firstPatch + e.patchCount; p++)
+                sources.push_back(~p);
+        }
+
+        std::vector<MeshData> meshes(sources.size());
+        Jobs::ParallelFor(sources.size(), [&](size_t i)
+        {
+            if (sources[i] >= 0)
+            {
+                const Face &face = map.faces[sources[i]];
+                meshes[i] = BuildFaceMesh(map, face, map.textureSizes[face.textureId]);
+            }
+            else
+            {
+                meshes[i] = BuildPatchMesh(map, map.patches[~sources[i]]);
+            }
+        });
+
+        return meshes;
+    }
+
+    std::vector<MeshData> BuildMeshes(const CompiledMap &map, const std::vector<vec2> &textureSizes,
+                                      bool withPatches)
+    {
+        CompiledArray<CompiledBrush> brushes = map.Brushes();
+        CompiledArray<CompiledFace> faces = map.Faces();
+        CompiledArray<CompiledPlane> planes = map.Planes();
+        CompiledArray<uint32_t> indices = map.FaceIndices();
+        CompiledArray<vec3> vertices = map.Vertices();
+        CompiledArray<vec2> uvs = map.FaceUVs();
+        CompiledArray<CompiledPatch> patches = map.Patches();
+        CompiledArray<PatchVert> patchVerts = map.PatchVerts();
+
+        std::vector<char> hidden(map.Textures().size);
+        for (uint32_t i = 0; i < hidden.size(); i++)
+            hidden[i] = IsHiddenTexture(map.TextureName(i));
+
+        std::vector<MeshSource> sources;
+        sources.reserve(faces.size + patches.size);
+        for (const CompiledEntity &e : map.Entities())
+        {
+            for (uint32_t b = e.firstBrush; b < e.firstBrush + e.brushCount; b++)
+            {
+                const CompiledBrush &brush = brushes[b];
+                for (uint32_t f = brush.firstFace; f < brush.firstFace + brush.faceCount; f++)
+                {
+                    if (!hidden[faces[f].texture])
+                        sources.push_back((int)f);
+                }
+            }
+
+            for (uint32_t p = e.firstPatch; withPatches && p < e.firstPatch + e.patchCount; p++)
+                sources.push_back(~(int)p);
+        }
+
+        std::vector<MeshData> meshes(sources.size());
+        Jobs::ParallelFor(sources.size(), [&](size_t i)
+        {
+            MeshData &mesh = meshes[i];
+
+            if (sources[i] < 0)
+            {
+                const CompiledPatch &patch = patches[~sources[i]];
+                mesh.textureId = (int)patch.texture;
+                BuildGrid(mesh, patch.rows, patch.columns,
+                          [&](int row) { return &patchVerts[patch.firstVertex + (size_t)row * patch.columns]; });
+                return;
+            }
+
+            const CompiledFace &face = faces[sources[i]];
+            vec2 size = face.texture < textureSizes.size() ? textureSizes[face.texture] : vec2(0.0f);
+            if (size.x == 0.0f)
+                size = vec2(512.0f, 512.0f);
+            if (face.projectionType == (int32_t)TextureProjectionType::BrushPrimitive)
+                size = vec2(1.0f, 1.0f);
+
+            // the compiled UVs are in texels, except brush primitive ones
+            uint32_t first = face.firstIndex;
+            mesh.textureId = (int)face.texture;
+            BuildFan(mesh, (int)face.indexCount, planes[face.plane].normal,
+                     [&](int v) { return vertices[indices[first + v]]; },
+                     [&](int v) { return uvs[first + v] / size; });
+        });
+
+        return meshes;
+    }
+
+    // Copies vertex v of a mesh to the end of another
+    static void AppendVertex(MeshData &to, const MeshData &from, uint32_t v)
+    {
+        to.vertices.insert(to.vertices.end(), &from.vertices[3 * v], &from.vertices[3 * v] + 3);
+        to.normals.insert(to.normals.end(), &from.normals[3 * v], &from.normals[3 * v] + 3);
+        to.texcoords.insert(to.texcoords.end(), &from.texcoords[2 * v], &from.texcoords[2 * v] + 2);
+    }
+
+    std::vector<MeshData> BatchMeshes(const std::vector<MeshData> &meshes, Span<const int> selection,
+                                      int maxVertices)
+    {
+        std::vector<int> order;
+        order.reserve(selection.size);
+        for (int m : selection)
+        {
+            if (!meshes[m].indices.empty())
+                order.push_back(m);
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [&](int a, int b) { return meshes[a].textureId < meshes[b].textureId; });
+
+        std::vector<MeshData> batches;
+        std::vector<int> remap;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const MeshData &mesh = meshes[order[i]];
+            bool newTexture = i == 0 || mesh.textureId != meshes[order[i - 1]].textureId;
+            if (newTexture || batches.back().VertexCount() + mesh.VertexCount() > maxVertices)
+            {
+                batches.emplace_back();
+                batches.back().textureId = mesh.textureId;
+            }
+
+            // the common case, the whole mesh fits behind the others
+            if (mesh.VertexCount() <= maxVertices)
+            {
+                MeshData &batch = batches.back();
+                uint32_t base = (uint32_t)batch.VertexCount();
+                batch.vertices.insert(batch.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+                batch.normals.insert(batch.normals.end(), mesh.normals.begin(), mesh.normals.end());
+                batch.texcoords.insert(batch.texcoords.end(), mesh.texcoords.begin(), mesh.texcoords.end());
+                for (uint32_t index : mesh.indices)
+                    batch.indices.push_back(base + index);
+                continue;
+            }
+
+            // too large on its own, triangles go to the current batch until
+            // their new vertices don't fit, each batch with its own copies
+            remap.assign(mesh.VertexCount(), -1);
+            for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+            {
+                if (batches.back().VertexCount() + 3 > maxVertices)
+                {
+                    batches.emplace_back();
+                    batches.back().textureId = mesh.textureId;
+                    std::fill(remap.begin(), remap.end(), -1);
+                }
+
+                MeshData &batch = batches.back();
+                for (int k = 0; k < 3; k++)
+                {
+                    uint32_t v = mesh.indices[t + k];
+                    if (remap[v] < 0)
+                    {
+                        remap[v] = batch.VertexCount();
+                        AppendVertex(batch, mesh, v);
+                    }
+                    batch.indices.push_back((uint32_t)remap[v]);
+                }
+            }
+        }
+
+        return batches;
+    }
+
+    std::vector<MeshData> BatchMeshes(const std::vector<MeshData> &meshes, int maxVertices)
+    {
+        std::vector<int> all(meshes.size());
+        std::iota(all.begin(), all.end(), 0);
+        return BatchMeshes(meshes, {all.data(), all.size()}, maxVertices);
+    }
+}
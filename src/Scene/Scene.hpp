@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../MapFormat/map.hpp"
+#include "../MapFormat/CompiledMap.hpp"
+
+// CPU side scene building, no window or GPU needed
+namespace Scene
+{
+    // Most vertices one raylib mesh can have, its indices are 16 bit
+    static const int MAX_MESH_VERTICES = 65536;
+
+    // Vertex data of one mesh, laid out like raylib's Mesh arrays. Indices
+    // are 32 bit so large patch grids don't wrap, BatchMeshes splits meshes
+    // down to what 16 bit indices reach.
+    struct MeshData
+    {
+        int textureId = -1;
+        std::vector<float> vertices;  // x, y, z
+        std::vector<float> normals;   // x, y, z
+        std::vector<float> texcoords; // u, v
+        std::vector<uint32_t> indices;
+
+        int VertexCount() const { return (int)(vertices.size() / 3); }
+        int TriangleCount() const { return (int)(indices.size() / 3); }
+    };
+
+    // Map units to viewer units, 30 units per meter with Y up
+    vec3 ToViewSpace(const vec3 &v);
+    vec3 FromViewSpace(const vec3 &v);
+
+    // Tool textures like common/caulk aren't drawn
+    bool IsHiddenTexture(std::string_view texture);
+
+    // Triangle fan over the face's vertices, empty below 3 vertices
+    MeshData BuildFaceMesh(const Map &map, const Face &face, vec2 textureSize);
+
+    // Two triangles per quad of the tessellated patch, empty below 2x2 vertices
+    MeshData BuildPatchMesh(const Map &map, const Patch &patch);
+    // Same for any rows x columns grid of patch vertices
+    MeshData BuildGridMesh(const PatchVert *grid, int rows, int columns, int textureId);
+
+    // One mesh per visible face and patch in map order, face UVs use the
+    // sizes in map.textureSizes. Built on the job pool, the result is the
+    // same for any thread count.
+    std::vector<MeshData> BuildMeshes(Map &map);
+
+    // Same meshes from a compiled map. textureSizes is indexed by texture,
+    // a zero size falls back to 512x512 like Face::GetUV.
+    // Patches are left out when withPatches is false, to be drawn through a
+    // PatchLod instead.
+    std::vector<MeshData> BuildMeshes(const CompiledMap &map, const std::vector<vec2> &textureSizes,
+                                      bool withPatches = true);
+
+    // Merges the selected meshes that share a texture into as few meshes of
+    // at most maxVertices vertices as there can be. Meshes larger than that
+    // are split between triangles. The result is ordered by texture, then
+    // by the order of the selection, and has no empty meshes.
+    std::vector<MeshData> BatchMeshes(const std::vector<MeshData> &meshes, Span<const int> selection,
+                                      int maxVertices = MAX_MESH_VERTICES);
+    // Same for all the meshes
+    std::vector<MeshData> BatchMeshes(const std::vector<MeshData> &meshes, int maxVertices = MAX_MESH_VERTICES);
+}
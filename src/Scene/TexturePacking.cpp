@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <map>
+#include <utility>
+#include "TexturePacking.hpp"
+
+namespace Scene
+{
+    // UVs this close to 0..1 still count as not tiling, the padding around
+    // atlas textures covers them
+    static const float TILE_EPSILON = 1.0f / 1024.0f;
+
+    static int NextPowerOfTwo(int value)
+    {
+        int power = 1;
+        while (power < value)
+            power *= 2;
+        return power;
+    }
+
+    // Shelves of textures tallest first, a new page when one is full. Pages
+    // end up with a single texture are left to the caller.
+    static void PackAtlasPages(TexturePacking &packing, std::vector<int> textures, int maxPageSize)
+    {
+        std::sort(textures.begin(), textures.end(), [&](int a, int b)
+        {
+            const PackedTexture &ta = packing.textures[a], &tb = packing.textures[b];
+            if (ta.height != tb.height)
+                return ta.height > tb.height;
+            if (ta.width != tb.width)
+                return ta.width > tb.width;
+            return a < b;
+        });
+
+        int x = 0, y = 0, shelfHeight = 0;
+        int page = -1;
+        for (int id : textures)
+        {
+            PackedTexture &texture = packing.textures[id];
+            int width = texture.width + 2 * ATLAS_PADDING, height = texture.height + 2 * ATLAS_PADDING;
+
+            if (x + width > maxPageSize)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (page < 0 || y + height > maxPageSize)
+            {
+                page = (int)packing.binds.size();
+                packing.binds.emplace_back();
+                packing.binds.back().kind = TextureBind::Atlas;
+                x = y = shelfHeight = 0;
+            }
+
+            TextureBind &bind = packing.binds[page];
+            texture.bind = page;
+            texture.x = x + ATLAS_PADDING;
+            texture.y = y + ATLAS_PADDING;
+            bind.textures.push_back(id);
+            bind.width = std::max(bind.width, x + width);
+            bind.height = std::max(bind.height, y + height);
+
+            x += width;
+            shelfHeight = std::max(shelfHeight, height);
+        }
+    }
+
+    TexturePacking PackTextures(const std::vector<MeshData> &meshes, const std::vector<vec2> &textureSizes,
+                                int maxPageSize)
+    {
+        TexturePacking packing;
+        packing.textures.resize(textureSizes.size());
+        for (size_t t = 0; t < textureSizes.size(); t++)
+        {
+            packing.textures[t].width = (int)textureSizes[t].x;
+            packing.textures[t].height = (int)textureSizes[t].y;
+        }
+
+        std::vector<char> used(textureSizes.size(), 0);
+        for (const MeshData &mesh : meshes)
+        {
+            if (mesh.indices.empty() || mesh.textureId < 0 || mesh.textureId >= (int)textureSizes.size())
+                continue;
+
+            used[mesh.textureId] = 1;
+            PackedTexture &texture = packing.textures[mesh.textureId];
+            for (size_t i = 0; i < mesh.texcoords.size() && !texture.tiles; i++)
+            {
+                float uv = mesh.texcoords[i];
+                texture.tiles = uv < -TILE_EPSILON || uv > 1.0f + TILE_EPSILON;
+            }
+        }
+
+        // used textures by size, in ID order within a size
+        std::map<std::pair<int, int>, std::vector<int>> bySize;
+        std::vector<int> unsized;
+        for (int t = 0; t < (int)used.size(); t++)
+        {
+            if (!used[t])
+                continue;
+
+            const PackedTexture &texture = packing.textures[t];
+            if (texture.width > 0 && texture.height > 0)
+                bySize[{texture.width, texture.height}].push_back(t);
+            else
+                unsized.push_back(t);
+        }
+
+        // an array keeps tiling and mips of every layer, so textures that
+        // share a size go there first
+        std::vector<int> leftover;
+        for (const auto &size : bySize)
+        {
+            const std::vector<int> &textures = size.second;
+            for (size_t first = 0; first < textures.size(); first += MAX_ARRAY_LAYERS)
+            {
+                size_t count = std::min(textures.size() - first, (size_t)MAX_ARRAY_LAYERS);
+                if (count < 2)
+                {
+                    leftover.push_back(textures[first]);
+                    continue;
+                }
+
+                TextureBind bind;
+                bind.kind = TextureBind::Array;
+                bind.width = size.first.first;
+                bind.height = size.first.second;
+                for (size_t i = 0; i < count; i++)
+                {
+                    PackedTexture &texture = packing.textures[textures[first + i]];
+                    texture.bind = (int)packing.binds.size();
+                    texture.layer = (int)i;
+                    bind.textures.push_back(textures[first + i]);
+                }
+                packing.binds.push_back(std::move(bind));
+            }
+        }
+
+        std::vector<int> atlas, single = unsized;
+        for (int t : leftover)
+        {
+            const PackedTexture &texture = packing.textures[t];
+            bool fits = texture.width + 2 * ATLAS_PADDING <= maxPageSize &&
+                        texture.height + 2 * ATLAS_PADDING <= maxPageSize;
+            if (!texture.tiles && fits)
+                atlas.push_back(t);
+            else
+                single.push_back(t);
+        }
+
+        size_t firstPage = packing.binds.size();
+        PackAtlasPages(packing, atlas, maxPageSize);
+
+        // a page with one texture saves nothing, it's bound on its own.
+        // Pages are cut down to the power of two around what's on them.
+        size_t pages = firstPage;
+        for (size_t b = firstPage; b < packing.binds.size(); b++)
+        {
+            TextureBind &bind = packing.binds[b];
+            if (bind.textures.size() < 2)
+            {
+                single.push_back(bind.textures[0]);
+                continue;
+            }
+
+            bind.width = NextPowerOfTwo(bind.width);
+            bind.height = NextPowerOfTwo(bind.height);
+            for (int t : bind.textures)
+                packing.textures[t].bind = (int)pages;
+            if (pages != b)
+                packing.binds[pages] = std::move(bind);
+            pages++;
+        }
+        packing.binds.resize(pages);
+
+        std::sort(single.begin(), single.end());
+        for (int t : single)
+        {
+            PackedTexture &texture = packing.textures[t];
+            texture.bind = (int)packing.binds.size();
+            texture.layer = texture.x = texture.y = 0;
+
+            TextureBind bind;
+            bind.width = texture.width;
+            bind.height = texture.height;
+            bind.textures.push_back(t);
+            packing.binds.push_back(std::move(bind));
+        }
+
+        return packing;
+    }
+
+    std::vector<int> ApplyPacking(const TexturePacking &packing, std::vector<MeshData> &meshes)
+    {
+        std::vector<int> layers(meshes.size(), 0);
+        for (size_t m = 0; m < meshes.size(); m++)
+        {
+            MeshData &mesh = meshes[m];
+            if (mesh.textureId < 0 || mesh.textureId >= (int)packing.textures.size())
+                continue;
+
+            const PackedTexture &texture = packing.textures[mesh.textureId];
+            if (texture.bind < 0)
+                continue;
+
+            const TextureBind &bind = packing.binds[texture.bind];
+            if (bind.kind == TextureBind::Atlas)
+            {
+                vec2 offset((float)texture.x / bind.width, (float)texture.y / bind.height);
+                vec2 scale((float)texture.width / bind.width, (float)texture.height / bind.height);
+                for (size_t i = 0; i + 1 < mesh.texcoords.size(); i += 2)
+                {
+                    mesh.texcoords[i] = offset.x + mesh.texcoords[i] * scale.x;
+                    mesh.texcoords[i + 1] = offset.y + mesh.texcoords[i + 1] * scale.y;
+                }
+            }
+
+            mesh.textureId = texture.bind;
+            layers[m] = texture.layer;
+        }
+        return layers;
+    }
+
+    int CountBinds(const std::vector<MeshData> &meshes, Span<const int> selection)
+    {
+        std::vector<int> textures;
+        for (int m : selection)
+        {
+            if (!meshes[m].indices.empty())
+                textures.push_back(meshes[m].textureId);
+        }
+        std::sort(textures.begin(), textures.end());
+        return (int)(std::unique(textures.begin(), textures.end()) - textures.begin());
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include "Scene.hpp"
+
+namespace Scene
+{
+    // Most layers one texture array gets, what GL 3 guarantees
+    static const int MAX_ARRAY_LAYERS = 256;
+
+    // Texels kept free around every texture on an atlas page, filtering
+    // and the first few mip levels don't reach the neighbours
+    static const int ATLAS_PADDING = 4;
+
+    // Textures drawn with one bind
+    struct TextureBind
+    {
+        enum Kind
+        {
+            Single, // one texture as it is
+            Array,  // textures of one size, one per layer
+            Atlas   // textures side by side on a page
+        };
+
+        Kind kind = Single;
+        int width = 0, height = 0; // of a layer or the page
+        std::vector<int> textures; // by layer in arrays, in packing order on pages
+    };
+
+    // Where a texture ended up
+    struct PackedTexture
+    {
+        int bind = -1;             // -1 if no mesh uses it
+        int layer = 0;             // in an array
+        int x = 0, y = 0;          // texel corner on an atlas page
+        int width = 0, height = 0; // its own size
+        bool tiles = false;        // some UVs are outside 0..1, an atlas can't repeat it
+    };
+
+    struct TexturePacking
+    {
+        std::vector<PackedTexture> textures; // by texture ID
+        std::vector<TextureBind> binds;      // arrays, then atlas pages, then single textures
+    };
+
+    // Groups the textures the meshes use into as few binds as there can be.
+    // Textures of the same size become texture arrays, the rest that don't
+    // tile are packed onto atlas pages of at most maxPageSize texels a side,
+    // what's left is bound on its own. textureSizes is indexed by texture,
+    // a texture without a size isn't packed. Only the layout is made, the
+    // result is the same for the same meshes and sizes.
+    TexturePacking PackTextures(const std::vector<MeshData> &meshes, const std::vector<vec2> &textureSizes,
+                                int maxPageSize = 2048);
+
+    // Moves the meshes onto their binds: the texture ID becomes the bind
+    // and UVs of atlas textures are moved into their place on the page.
+    // Returns the array layer of every mesh's texture, 0 outside arrays.
+    std::vector<int> ApplyPacking(const TexturePacking &packing, std::vector<MeshData> &meshes);
+
+    // Binds the texture IDs of the selected meshes take, the same count
+    // of binds after ApplyPacking is what drawing them with the packing
+    // takes instead
+    int CountBinds(const std::vector<MeshData> &meshes, Span<const int> selection);
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/Parser.hpp"
+#include "Scene/Scene.hpp"
+
+// Headless batch processing: loads every map, builds its geometry and meshes
+// and reports how long each stage took. Maps are processed in parallel, each
+// with its own parse context.
+
+using Clock = std::chrono::steady_clock;
+
+static double ElapsedMs(Clock::time_point start, Clock::time_point end = Clock::now())
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+struct MapResult
+{
+    bool ok = false;
+    std::string error;
+
+    double loadMs = 0.0;
+    double geometryMs = 0.0;
+    double meshMs = 0.0;
+
+    size_t entities = 0;
+    size_t brushes = 0;
+    size_t patches = 0;
+    size_t meshes = 0;
+    size_t triangles = 0;
+};
+
+static bool IsDirectory(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool HasMapExtension(const std::string &name)
+{
+    if (name.size() < 4)
+        return false;
+
+    std::string ext = name.substr(name.size() - 4);
+    for (char &c : ext)
+        c = (char)tolower((unsigned char)c);
+    return ext == ".map";
+}
+
+// Adds every .map file under a directory, sorted so runs are comparable
+static void FindMaps(const std::string &dirPath, std::vector<std::string> &out)
+{
+    DIR *dir = opendir(dirPath.c_str());
+    if (!dir)
+    {
+        fprintf(stderr, "Failed to open directory %s\n", dirPath.c_str());
+        return;
+    }
+
+    std::vector<std::string> entries;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+            entries.push_back(dirPath + "/" + ent->d_name);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+
+    for (const std::string &path : entries)
+    {
+        if (IsDirectory(path))
+            FindMaps(path, out);
+        else if (HasMapExtension(path))
+            out.push_back(path);
+    }
+}
+
+static MapResult ProcessMap(const std::string &path)
+{
+    MapResult result;
+    Clock::time_point start = Clock::now();
+
+    Map map;
+    ParseContext context;
+    context.printErrors = false;
+
+    if (!Map::Load(path.c_str(), map, context))
+    {
+        result.error = context.error;
+        return result;
+    }
+
+    Clock::time_point loaded = Clock::now();
+    map.CalculateGeometry();
+
+    Clock::time_point built = Clock::now();
+    std::vector<Scene::MeshData> meshes = Scene::BuildMeshes(map);
+    Clock::time_point end = Clock::now();
+
+    result.ok = true;
+    result.loadMs = ElapsedMs(start, loaded);
+    result.geometryMs = ElapsedMs(loaded, built);
+    result.meshMs = ElapsedMs(built, end);
+
+    result.entities = map.entities.size();
+    result.brushes = map.brushes.size();
+    result.patches = map.patches.size();
+
+    for (const Scene::MeshData &mesh : meshes)
+    {
+        if (!mesh.indices.empty())
+            result.meshes++;
+        result.triangles += mesh.TriangleCount();
+    }
+
+    return result;
+}
+
+static void PrintUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-j threads] <mapfile|directory>...\n", program);
+    fprintf(stderr, "  Directories are searched recursively for .map files.\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> paths;
+    int threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        else if (IsDirectory(argv[i]))
+        {
+            FindMaps(argv[i], paths);
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Jobs::SetThreadCount(threads);
+    printf("%zu maps on %d threads\n", paths.size(), Jobs::ThreadCount());
+
+    std::vector<MapResult> results(paths.size());
+    std::mutex printMutex;
+    size_t finished = 0;
+    Clock::time_point start = Clock::now();
+
+    // maps finish in any order, each one is reported as soon as it's done
+    Jobs::ParallelFor(paths.size(), [&](size_t i)
+    {
+        MapResult &r = results[i];
+        r = ProcessMap(paths[i]);
+
+        std::lock_guard<std::mutex> lock(printMutex);
+        finished++;
+
+        if (r.ok)
+        {
+            printf("[%zu/%zu] %s: load %.1f ms, geometry %.1f ms, meshes %.1f ms "
+                   "(%zu entities, %zu brushes, %zu patches, %zu triangles)\n",
+                   finished, paths.size(), paths[i].c_str(), r.loadMs, r.geometryMs, r.meshMs,
+                   r.entities, r.brushes, r.patches, r.triangles);
+        }
+        else
+        {
+            printf("[%zu/%zu] %s: FAILED: %s\n", finished, paths.size(), paths[i].c_str(),
+                   r.error.empty() ? "unknown error" : r.error.c_str());
+        }
+        fflush(stdout);
+    });
+
+    double wallMs = ElapsedMs(start);
+
+    MapResult total;
+    size_t failed = 0;
+    for (const MapResult &r : results)
+    {
+        if (!r.ok)
+        {
+            failed++;
+            continue;
+        }
+
+        total.loadMs += r.loadMs;
+        total.geometryMs += r.geometryMs;
+        total.meshMs += r.meshMs;
+        total.brushes += r.brushes;
+        total.patches += r.patches;
+        total.meshes += r.meshes;
+        total.triangles += r.triangles;
+    }
+
+    printf("\n%zu maps, %zu failed, %.1f ms wall time\n", paths.size(), failed, wallMs);
+    printf("summed stage times: load %.1f ms, geometry %.1f ms, meshes %.1f ms\n",
+           total.loadMs, total.geometryMs, total.meshMs);
+    printf("%zu brushes, %zu patches, %zu meshes, %zu triangles\n",
+           total.brushes, total.patches, total.meshes, total.triangles);
+
+    if (failed > 0)
+    {
+        printf("\nfailed maps:\n");
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            if (!results[i].ok)
+                printf("  %s\n", paths[i].c_str());
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "Bench.hpp"
+#include "MapFormat/Parser.hpp"
+
+// What a tool that only needs the assets of a map collects
+class AssetCollector : public MapVisitor
+{
+public:
+    std::unordered_map<std::string, vec2> textureSizes;
+    std::unordered_set<std::string> models;
+
+    bool wantsGeometry() const override { return false; }
+
+    void onKeyValue(std::string_view key, std::string_view value) override
+    {
+        if (key == "model")
+            models.emplace(value);
+    }
+
+    void onBrushFace(const FaceDef &face) override
+    {
+        addTexture(face.texture);
+    }
+
+    void onPatch(int, const PatchDef &patch) override
+    {
+        addTexture(patch.texture);
+    }
+
+private:
+    std::string lookup;
+
+    void addTexture(std::string_view texture)
+    {
+        lookup.assign(texture);
+        if (textureSizes.find(lookup) == textureSizes.end())
+            textureSizes.emplace(lookup, vec2(0.0f));
+    }
+};
+
+int Bench::RunAssets(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: assets <mapfile> [--stream-only]\n");
+        return 1;
+    }
+
+    bool streamOnly = argc >= 2 && strcmp(argv[1], "--stream-only") == 0;
+
+    size_t allocStart = Bench::AllocationCount();
+    Bench::Clock::time_point start = Bench::Clock::now();
+
+    AssetCollector assets;
+    if (!Map::Stream(argv[0], assets))
+        return 1;
+
+    double streamMs = Bench::ElapsedMs(start);
+    size_t streamAllocations = Bench::AllocationCount() - allocStart;
+
+    printf("%-16s %10.2f ms %10zu allocs %6zu textures %6zu models\n", "Map::Stream", streamMs, streamAllocations,
+           assets.textureSizes.size(), assets.models.size());
+
+    if (streamOnly)
+    {
+        printf("peak memory %.2f MB\n", Bench::PeakMemoryKb() / 1024.0);
+        return 0;
+    }
+
+    allocStart = Bench::AllocationCount();
+    start = Bench::Clock::now();
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    double loadMs = Bench::ElapsedMs(start);
+    size_t loadAllocations = Bench::AllocationCount() - allocStart;
+
+    printf("%-16s %10.2f ms %10zu allocs %6zu textures %6zu models (%.1fx slower)\n", "Map::Load", loadMs,
+           loadAllocations, map.textureSizes.size(), map.models.size(), loadMs / streamMs);
+
+    bool same = map.models == assets.models && map.textureSizes.size() == assets.textureSizes.size();
+    for (const std::string &texture : map.textures)
+        same = same && assets.textureSizes.count(texture);
+
+    if (!same)
+    {
+        printf("MISMATCH: streamed assets differ from the loaded map\n");
+        return 1;
+    }
+
+    return 0;
+}
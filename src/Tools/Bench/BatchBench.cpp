@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include "Bench.hpp"
+#include "FS/Hash.hpp"
+#include "MapFormat/map.hpp"
+#include "Scene/Scene.hpp"
+
+// Triangles of each texture, summed as hashes of their corners so the
+// order they end up in doesn't matter
+struct TextureTriangles
+{
+    size_t count = 0;
+    uint64_t hashSum = 0;
+};
+
+static void AddTriangles(const Scene::MeshData &mesh, std::map<int, TextureTriangles> &textures)
+{
+    TextureTriangles &triangles = textures[mesh.textureId];
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+    {
+        float corners[24];
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = mesh.indices[t + k];
+            std::copy(&mesh.vertices[3 * v], &mesh.vertices[3 * v] + 3, corners + 8 * k);
+            std::copy(&mesh.normals[3 * v], &mesh.normals[3 * v] + 3, corners + 8 * k + 3);
+            std::copy(&mesh.texcoords[2 * v], &mesh.texcoords[2 * v] + 2, corners + 8 * k + 6);
+        }
+        triangles.count++;
+        triangles.hashSum += FS::Hash64(corners, sizeof(corners));
+    }
+}
+
+// Merges the meshes of a map by texture, counts the draw calls before and
+// after and checks that every triangle is still there with its texture
+int Bench::RunBatches(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: batches <mapfile> [max vertices]\n");
+        return 1;
+    }
+
+    int maxVertices = argc >= 2 ? atoi(argv[1]) : Scene::MAX_MESH_VERTICES;
+    if (maxVertices < 3)
+        maxVertices = Scene::MAX_MESH_VERTICES;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+    map.CalculateGeometry();
+
+    std::vector<Scene::MeshData> meshes = Scene::BuildMeshes(map);
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    std::vector<Scene::MeshData> batches = Scene::BatchMeshes(meshes, maxVertices);
+    double batchMs = Bench::ElapsedMs(start);
+
+    size_t drawnMeshes = 0, largest = 0, largestBefore = 0;
+    std::map<int, TextureTriangles> before, after;
+    for (const Scene::MeshData &mesh : meshes)
+    {
+        drawnMeshes += !mesh.indices.empty();
+        largestBefore = std::max(largestBefore, (size_t)mesh.VertexCount());
+        AddTriangles(mesh, before);
+    }
+
+    bool valid = true;
+    for (const Scene::MeshData &batch : batches)
+    {
+        largest = std::max(largest, (size_t)batch.VertexCount());
+        valid = valid && batch.VertexCount() <= maxVertices;
+        for (uint32_t index : batch.indices)
+            valid = valid && index < (uint32_t)batch.VertexCount();
+        AddTriangles(batch, after);
+    }
+
+    bool same = before.size() == after.size();
+    for (auto it = before.begin(); same && it != before.end(); ++it)
+    {
+        auto found = after.find(it->first);
+        same = found != after.end() && found->second.count == it->second.count &&
+               found->second.hashSum == it->second.hashSum;
+    }
+
+    printf("%s: %zu textures, %zu meshes with up to %zu vertices merged into %zu of up to %zu in %.2f ms\n", argv[0],
+           before.size(), drawnMeshes, largestBefore, batches.size(), largest, batchMs);
+    printf("draw calls %zu -> %zu, %.1f meshes per batch\n", drawnMeshes, batches.size(),
+           batches.empty() ? 0.0 : (double)drawnMeshes / batches.size());
+
+    if (!valid)
+        printf("A BATCH HAS TOO MANY VERTICES OR AN INDEX PAST ITS VERTICES\n");
+    if (!same)
+        printf("TRIANGLES DIFFER AFTER BATCHING\n");
+    return valid && same ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "Bench.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Every operator new in the process goes through here so commands can report
+// how many heap allocations a piece of work makes.
+static std::atomic<size_t> allocationCount{0};
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+size_t Bench::AllocationCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+size_t Bench::PeakMemoryKb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+size_t Bench::HeapInUseKb()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return (info.uordblks + info.hblkhd) / 1024;
+#else
+    return 0;
+#endif
+}
+
+bool Bench::ReadFile(const char *fileName, std::string &out)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", fileName, strerror(errno));
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    out.resize(size);
+    bool ok = fread(&out[0], 1, size, file) == (size_t)size;
+    fclose(file);
+
+    return ok;
+}
+
+struct Command
+{
+    const char *name;
+    const char *usage;
+    int (*run)(int argc, char **argv);
+};
+
+static const Command commands[] = {
+    {"parse", "parse <mapfile> [iterations] [threads]", Bench::RunParse},
+    {"load", "load <mapfile> [--read]    (run once per mode, peak memory is per process)", Bench::RunLoad},
+    {"numbers", "numbers <mapfile> [iterations]", Bench::RunNumbers},
+    {"assets", "assets <mapfile> [--stream-only]", Bench::RunAssets},
+    {"cache", "cache <mapfile> [iterations]", Bench::RunCache},
+    {"memory", "memory <mapfile>", Bench::RunMemory},
+    {"build", "build <mapfile> [max threads] [iterations]", Bench::RunBuild},
+    {"winding", "winding <mapfile> [iterations]", Bench::RunWinding},
+    {"patches", "patches <mapfile> [iterations]", Bench::RunPatches},
+    {"lod", "lod <mapfile> [max pixel error]", Bench::RunLod},
+    {"uvs", "uvs <mapfile> [iterations]", Bench::RunUVs},
+    {"bvh", "bvh <mapfile> [queries]", Bench::RunBvh},
+    {"cull", "cull <mapfile> [cell size] [frames]", Bench::RunCull},
+    {"batches", "batches <mapfile> [max vertices]", Bench::RunBatches},
+    {"textures", "textures <game dir> <mapfile> [threads] [cache file]", Bench::RunTextures},
+    {"pack", "pack <mapfile> [max page size] [frames] [game dir]", Bench::RunPack},
+    {"files", "files <game dir> <mapfile> [index file]", Bench::RunFiles},
+};
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2)
+    {
+        for (const Command &command : commands)
+        {
+            if (strcmp(argv[1], command.name) == 0)
+                return command.run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "Usage: %s <command> [args]\n", argv[0]);
+    for (const Command &command : commands)
+        fprintf(stderr, "  %s\n", command.usage);
+
+    return 1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Small helpers shared by the MapBench commands
+namespace Bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    inline double ElapsedMs(Clock::time_point start, Clock::time_point end = Clock::now())
+    {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // Number of operator new calls made by the process so far
+    size_t AllocationCount();
+
+    // Peak resident set size of the process in kilobytes
+    size_t PeakMemoryKb();
+
+    // Heap memory in use by the process in kilobytes, 0 where unknown
+    size_t HeapInUseKb();
+
+    // Reads a whole file into a string, returns false if it can't be read
+    bool ReadFile(const char *fileName, std::string &out);
+
+    // Commands, each receives the arguments that follow the command name
+    int RunParse(int argc, char **argv);
+    int RunLoad(int argc, char **argv);
+    int RunNumbers(int argc, char **argv);
+    int RunAssets(int argc, char **argv);
+    int RunCache(int argc, char **argv);
+    int RunMemory(int argc, char **argv);
+    int RunBuild(int argc, char **argv);
+    int RunWinding(int argc, char **argv);
+    int RunPatches(int argc, char **argv);
+    int RunLod(int argc, char **argv);
+    int RunUVs(int argc, char **argv);
+    int RunBvh(int argc, char **argv);
+    int RunCull(int argc, char **argv);
+    int RunBatches(int argc, char **argv);
+    int RunTextures(int argc, char **argv);
+    int RunPack(int argc, char **argv);
+    int RunFiles(int argc, char **argv);
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Bench.hpp"
+#include "FS/Hash.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/map.hpp"
+#include "Scene/Scene.hpp"
+
+template <typename T>
+static uint64_t HashVector(const std::vector<T> &values, uint64_t seed)
+{
+    return FS::Hash64(values.data(), values.size() * sizeof(T), seed);
+}
+
+// Everything the scene build produces, equal hashes mean equal output
+static uint64_t BuildHash(const Map &map, const std::vector<Scene::MeshData> &meshes)
+{
+    uint64_t hash = HashVector(map.vertices, 0);
+    hash = HashVector(map.faceIndices, hash);
+    hash = HashVector(map.patchVertices, hash);
+
+    for (const Scene::MeshData &mesh : meshes)
+    {
+        hash = FS::Hash64(&mesh.textureId, sizeof(mesh.textureId), hash);
+        hash = HashVector(mesh.vertices, hash);
+        hash = HashVector(mesh.normals, hash);
+        hash = HashVector(mesh.texcoords, hash);
+        hash = HashVector(mesh.indices, hash);
+    }
+
+    return hash;
+}
+
+// Scene build time at 1, 2, 4, ... threads, the output of every run must
+// match the single threaded one
+int Bench::RunBuild(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: build <mapfile> [max threads] [iterations]\n");
+        return 1;
+    }
+
+    int maxThreads = argc >= 2 ? atoi(argv[1]) : 0;
+    int iterations = argc >= 3 ? atoi(argv[2]) : 3;
+    if (maxThreads <= 0)
+        maxThreads = Jobs::ThreadCount();
+    if (iterations < 1)
+        iterations = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    printf("%s: %zu brushes, %zu patches, best of %d\n", argv[0], map.brushes.size(), map.patches.size(),
+           iterations);
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    uint64_t serialHash = 0;
+    double serialMs = 0.0;
+    bool identical = true;
+
+    for (int threads : threadCounts)
+    {
+        Jobs::SetThreadCount(threads);
+
+        double bestGeometry = 1e30, bestMeshes = 1e30;
+        uint64_t hash = 0;
+
+        for (int i = 0; i < iterations; i++)
+        {
+            Bench::Clock::time_point start = Bench::Clock::now();
+            map.CalculateGeometry();
+            Bench::Clock::time_point built = Bench::Clock::now();
+            std::vector<Scene::MeshData> meshes = Scene::BuildMeshes(map);
+            Bench::Clock::time_point end = Bench::Clock::now();
+
+            bestGeometry = std::min(bestGeometry, Bench::ElapsedMs(start, built));
+            bestMeshes = std::min(bestMeshes, Bench::ElapsedMs(built, end));
+            hash = BuildHash(map, meshes);
+        }
+
+        double total = bestGeometry + bestMeshes;
+        if (threads == 1)
+        {
+            serialHash = hash;
+            serialMs = total;
+        }
+
+        bool same = hash == serialHash;
+        identical = identical && same;
+
+        printf("%3d thread%s  geometry %9.2f ms  meshes %9.2f ms  total %9.2f ms  %5.2fx  %s\n", threads,
+               threads > 1 ? "s" : " ", bestGeometry, bestMeshes, total, serialMs / total,
+               same ? "same output" : "OUTPUT DIFFERS");
+    }
+
+    return identical ? 0 : 1;
+}
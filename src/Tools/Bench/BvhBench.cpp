@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include "Bench.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/MapBvh.hpp"
+
+// Every brush and patch tested for every query, what tools had to do
+// before the tree. Kept as the reference for the answers of MapBvh.
+namespace Reference
+{
+    static float RaycastBrush(const Map &map, const Brush &brush, const Ray &ray)
+    {
+        float enter = -INFINITY, exit = ray.maxDistance;
+        for (const Face &face : map.GetFaces(brush))
+        {
+            vec3 normal = map.GetNormal(face);
+            float start = glm::dot(normal, ray.origin) - map.GetDistance(face);
+            float along = glm::dot(normal, ray.direction);
+            if (std::fabs(along) < 1e-12f)
+            {
+                if (start < 0.0f)
+                    return INFINITY;
+                continue;
+            }
+
+            float t = -start / along;
+            if (along > 0.0f)
+                enter = std::max(enter, t);
+            else
+                exit = std::min(exit, t);
+        }
+        return enter <= exit && enter >= 0.0f ? enter : INFINITY;
+    }
+
+    static float RaycastTriangle(const vec3 &a, const vec3 &b, const vec3 &c, const Ray &ray)
+    {
+        vec3 ab = b - a, ac = c - a;
+        vec3 h = glm::cross(ray.direction, ac);
+        float det = glm::dot(ab, h);
+        if (std::fabs(det) < 1e-12f)
+            return INFINITY;
+
+        vec3 s = ray.origin - a;
+        float u = glm::dot(s, h) / det;
+        vec3 q = glm::cross(s, ab);
+        float v = glm::dot(ray.direction, q) / det;
+        float t = glm::dot(ac, q) / det;
+        return u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t <= ray.maxDistance ? t : INFINITY;
+    }
+
+    static float Raycast(const Map &map, const Ray &ray)
+    {
+        float best = INFINITY;
+        for (const Brush &brush : map.brushes)
+        {
+            if (brush.vertexCount > 0)
+                best = std::min(best, RaycastBrush(map, brush, ray));
+        }
+
+        for (const Patch &patch : map.patches)
+        {
+            Span<const PatchVert> grid = map.GetPatchVertices(patch);
+            for (int i = 0; i + 1 < patch.rows; i++)
+            {
+                for (int j = 0; j + 1 < patch.columns; j++)
+                {
+                    const PatchVert *top = &grid[(size_t)i * patch.columns], *bottom = top + patch.columns;
+                    best = std::min(best, RaycastTriangle(top[j].position, bottom[j].position, top[j + 1].position, ray));
+                    best = std::min(best, RaycastTriangle(top[j + 1].position, bottom[j].position,
+                                                          bottom[j + 1].position, ray));
+                }
+            }
+        }
+        return best;
+    }
+
+    static bool IsInSolid(const Map &map, const vec3 &point)
+    {
+        for (const Brush &brush : map.brushes)
+        {
+            if (brush.vertexCount == 0)
+                continue;
+
+            bool inside = true;
+            for (const Face &face : map.GetFaces(brush))
+                inside = inside && glm::dot(map.GetNormal(face), point) - map.GetDistance(face) >= 0.0f;
+            if (inside)
+                return true;
+        }
+        return false;
+    }
+}
+
+static double PerSecond(size_t count, double ms)
+{
+    return count / (ms / 1000.0);
+}
+
+// Builds the brush and patch tree, checks its answers against testing
+// everything and measures batched ray, point and box queries
+int Bench::RunBvh(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: bvh <mapfile> [queries]\n");
+        return 1;
+    }
+
+    size_t queries = argc >= 2 ? (size_t)atol(argv[1]) : 1000000;
+    if (queries < 1)
+        queries = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+    map.CalculateGeometry();
+
+    printf("%s: %zu brushes, %zu patches, %d threads\n", argv[0], map.brushes.size(), map.patches.size(),
+           Jobs::ThreadCount());
+
+    // the tree has to come out the same on one thread
+    int threads = Jobs::ThreadCount();
+    MapBvh serial;
+    Jobs::SetThreadCount(1);
+    Bench::Clock::time_point start = Bench::Clock::now();
+    serial.Build(map);
+    double serialMs = Bench::ElapsedMs(start);
+    Jobs::SetThreadCount(threads);
+
+    MapBvh bvh;
+    start = Bench::Clock::now();
+    bvh.Build(map);
+    double buildMs = Bench::ElapsedMs(start);
+
+    bool same = serial.NodeCount() == bvh.NodeCount() && serial.Cost() == bvh.Cost() && serial.Depth() == bvh.Depth();
+    printf("build %8.2f ms on 1 thread, %8.2f ms on %d: %zu nodes, depth %d, SAH cost %.1f tests%s\n", serialMs,
+           buildMs, threads, bvh.NodeCount(), bvh.Depth(), bvh.Cost(), same ? "" : ": DIFFERS BY THREAD COUNT");
+
+    vec3 mins(INFINITY), maxs(-INFINITY);
+    for (const Brush &brush : map.brushes)
+    {
+        if (brush.vertexCount == 0)
+            continue;
+        mins = glm::min(mins, brush.aabb.min);
+        maxs = glm::max(maxs, brush.aabb.max);
+    }
+    for (const PatchVert &vert : map.patchVertices)
+    {
+        mins = glm::min(mins, vert.position);
+        maxs = glm::max(maxs, vert.position);
+    }
+    if (!(mins.x <= maxs.x))
+    {
+        printf("nothing to query\n");
+        return 0;
+    }
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto randomPoint = [&]
+    {
+        return mins + (maxs - mins) * vec3(unit(random), unit(random), unit(random));
+    };
+
+    std::vector<Ray> rays(queries);
+    std::vector<vec3> points(queries);
+    for (size_t i = 0; i < queries; i++)
+    {
+        vec3 direction;
+        do
+            direction = vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f;
+        while (glm::dot(direction, direction) < 1e-4f);
+
+        rays[i].origin = randomPoint();
+        rays[i].direction = glm::normalize(direction);
+        points[i] = randomPoint();
+    }
+
+    std::vector<RayHit> hits(queries);
+    start = Bench::Clock::now();
+    bvh.Raycast(rays.data(), queries, hits.data());
+    double rayMs = Bench::ElapsedMs(start);
+
+    std::unique_ptr<bool[]> inside(new bool[queries]);
+    start = Bench::Clock::now();
+    bvh.IsInSolid(points.data(), queries, inside.get());
+    double pointMs = Bench::ElapsedMs(start);
+
+    // boxes about the size of a player
+    size_t boxCount = std::min(queries, (size_t)100000);
+    size_t overlapped = 0;
+    std::vector<int> brushes, patches;
+    start = Bench::Clock::now();
+    for (size_t i = 0; i < boxCount; i++)
+    {
+        brushes.clear();
+        patches.clear();
+        bvh.Overlapping({points[i] - vec3(16.0f, 16.0f, 24.0f), points[i] + vec3(16.0f, 16.0f, 32.0f)}, brushes,
+                        patches);
+        overlapped += brushes.size() + patches.size();
+    }
+    double boxMs = Bench::ElapsedMs(start);
+
+    size_t hitCount = std::count_if(hits.begin(), hits.end(), [](const RayHit &hit) { return hit.Hit(); });
+    size_t solidCount = std::count(inside.get(), inside.get() + queries, true);
+    printf("%-8s %10zu queries %10.2f ms %14.0f per second, %zu hit\n", "rays", queries, rayMs,
+           PerSecond(queries, rayMs), hitCount);
+    printf("%-8s %10zu queries %10.2f ms %14.0f per second, %zu in solid\n", "points", queries, pointMs,
+           PerSecond(queries, pointMs), solidCount);
+    printf("%-8s %10zu queries %10.2f ms %14.0f per second, %.2f overlaps each, one thread\n", "boxes", boxCount,
+           boxMs, PerSecond(boxCount, boxMs), (double)overlapped / boxCount);
+
+    // a sample against testing everything, sized by how much that is
+    size_t primitives = map.brushes.size() + map.patchVertices.size() * 2 + 1;
+    size_t checks = std::min(queries, std::max((size_t)100, (size_t)20000000 / primitives));
+    size_t rayMismatches = 0, pointMismatches = 0;
+    start = Bench::Clock::now();
+    for (size_t i = 0; i < checks; i++)
+    {
+        float expected = Reference::Raycast(map, rays[i]);
+        float distance = hits[i].distance;
+        if (expected != distance && !(std::fabs(expected - distance) <= 1e-4f * std::max(1.0f, expected)))
+            rayMismatches++;
+    }
+    double referenceRayMs = Bench::ElapsedMs(start);
+
+    for (size_t i = 0; i < checks; i++)
+    {
+        if (Reference::IsInSolid(map, points[i]) != inside[i])
+            pointMismatches++;
+    }
+
+    printf("checked %zu rays and points against testing everything (%.0f rays per second): %zu rays and %zu "
+           "points differ\n",
+           checks, PerSecond(checks, referenceRayMs), rayMismatches, pointMismatches);
+
+    return same && rayMismatches == 0 && pointMismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "Bench.hpp"
+#include "MapFormat/CompiledMap.hpp"
+#include "Scene/Scene.hpp"
+
+// Compares the meshes of the Map path and the compiled path. Positions and
+// normals must match exactly, UVs go through a different division order.
+static bool CompareMeshes(const std::vector<Scene::MeshData> &a, const std::vector<Scene::MeshData> &b)
+{
+    if (a.size() != b.size())
+    {
+        printf("mesh count differs: %zu vs %zu\n", a.size(), b.size());
+        return false;
+    }
+
+    float maxUVError = 0.0f;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].textureId != b[i].textureId || a[i].vertices != b[i].vertices || a[i].normals != b[i].normals ||
+            a[i].indices != b[i].indices || a[i].texcoords.size() != b[i].texcoords.size())
+        {
+            printf("mesh %zu differs\n", i);
+            return false;
+        }
+
+        for (size_t j = 0; j < a[i].texcoords.size(); j++)
+            maxUVError = std::max(maxUVError, std::fabs(a[i].texcoords[j] - b[i].texcoords[j]));
+    }
+
+    printf("meshes match, max UV difference %g\n", maxUVError);
+    return maxUVError < 1e-3f;
+}
+
+int Bench::RunCache(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: cache <mapfile> [iterations]\n");
+        return 1;
+    }
+
+    const char *mapFile = argv[0];
+    int iterations = argc >= 2 ? atoi(argv[1]) : 5;
+    std::string cacheFile = std::string(mapFile) + ".bench.cache";
+    remove(cacheFile.c_str());
+
+    // cold: parse, build geometry, compile and write the cache
+    Bench::Clock::time_point start = Bench::Clock::now();
+    CompiledMap cold;
+    if (!CompiledMap::Load(mapFile, cacheFile.c_str(), cold))
+        return 1;
+    printf("%-24s %10.2f ms\n", "cold load", Bench::ElapsedMs(start));
+
+    // warm: hash the source and map the cache
+    double hashMs = 1e30, openMs = 1e30, loadMs = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        start = Bench::Clock::now();
+        uint64_t hash;
+        if (!CompiledMap::HashSource(mapFile, hash))
+            return 1;
+        hashMs = std::min(hashMs, Bench::ElapsedMs(start));
+
+        start = Bench::Clock::now();
+        CompiledMap warm;
+        if (!warm.Open(cacheFile.c_str(), hash))
+        {
+            printf("cache was not accepted\n");
+            return 1;
+        }
+        openMs = std::min(openMs, Bench::ElapsedMs(start));
+
+        start = Bench::Clock::now();
+        CompiledMap loaded;
+        if (!CompiledMap::Load(mapFile, cacheFile.c_str(), loaded))
+            return 1;
+        loadMs = std::min(loadMs, Bench::ElapsedMs(start));
+    }
+
+    printf("%-24s %10.2f ms\n", "warm load", loadMs);
+    printf("%-24s %10.2f ms\n", "  hash source", hashMs);
+    printf("%-24s %10.2f ms\n", "  open cache", openMs);
+
+    CompiledMap compiled;
+    uint64_t hash;
+    CompiledMap::HashSource(mapFile, hash);
+    if (compiled.Open(cacheFile.c_str(), hash + 1))
+    {
+        printf("cache accepted for a different source hash\n");
+        return 1;
+    }
+    compiled.Open(cacheFile.c_str(), hash);
+
+    start = Bench::Clock::now();
+    std::vector<vec2> textureSizes(compiled.Textures().size, vec2(0.0f));
+    std::vector<Scene::MeshData> compiledMeshes = Scene::BuildMeshes(compiled, textureSizes);
+    printf("%-24s %10.2f ms\n", "meshes from cache", Bench::ElapsedMs(start));
+
+    start = Bench::Clock::now();
+    Map map;
+    if (!Map::Load(mapFile, map))
+        return 1;
+    map.CalculateGeometry();
+    std::vector<Scene::MeshData> mapMeshes = Scene::BuildMeshes(map);
+    printf("%-24s %10.2f ms\n", "meshes from source", Bench::ElapsedMs(start));
+
+    bool same = CompareMeshes(mapMeshes, compiledMeshes);
+    remove(cacheFile.c_str());
+    return same ? 0 : 1;
+}
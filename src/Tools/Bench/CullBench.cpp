@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "Bench.hpp"
+#include "MapFormat/map.hpp"
+#include "Scene/Culling.hpp"
+
+// The viewer's camera: raylib's default near and far planes, in viewer units
+static const float FOV_Y = 90.0f;
+static const float ASPECT = 1800.0f / 1000.0f;
+static const float NEAR_PLANE = 0.01f;
+static const float FAR_PLANE = 1000.0f;
+
+// Clusters the meshes of a map and culls them from cameras spread over
+// it, checks the four wide test against the one cluster at a time one and
+// that no mesh inside the frustum is in a culled cluster
+int Bench::RunCull(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: cull <mapfile> [cell size in map units] [frames]\n");
+        return 1;
+    }
+
+    float cellSize = argc >= 2 ? (float)atof(argv[1]) : 1024.0f;
+    if (cellSize <= 0.0f)
+        cellSize = 1024.0f;
+    int frames = argc >= 3 ? atoi(argv[2]) : 1000;
+    if (frames < 1)
+        frames = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+    map.CalculateGeometry();
+
+    std::vector<AABB> bounds;
+    for (const Scene::MeshData &mesh : Scene::BuildMeshes(map))
+        bounds.push_back(Scene::MeshBounds(mesh));
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    Scene::ClusterCuller culler;
+    culler.Build(bounds, cellSize / 30.0f);
+    double buildMs = Bench::ElapsedMs(start);
+
+    printf("%s: %zu meshes in %d clusters of %.0f units, clustered in %.2f ms, %d frames\n", argv[0], bounds.size(),
+           culler.ClusterCount(), cellSize, buildMs, frames);
+    if (culler.ItemCount() == 0)
+        return 0;
+
+    vec3 mins(INFINITY), maxs(-INFINITY);
+    for (int c = 0; c < culler.ClusterCount(); c++)
+    {
+        mins = glm::min(mins, culler.Bounds(c).min);
+        maxs = glm::max(maxs, culler.Bounds(c).max);
+    }
+
+    // cameras anywhere in the map looking around level, like the viewer
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Scene::Frustum> frustums(frames);
+    for (Scene::Frustum &frustum : frustums)
+    {
+        vec3 eye = mins + (maxs - mins) * vec3(unit(random), unit(random), unit(random));
+        float yaw = unit(random) * 6.2831853f, pitch = (unit(random) - 0.5f) * 1.5f;
+        vec3 forward(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+        frustum = Scene::Frustum::FromCamera(eye, eye + forward, vec3(0.0f, 1.0f, 0.0f), FOV_Y, ASPECT, NEAR_PLANE,
+                                             FAR_PLANE);
+    }
+
+    // every mesh on its own, what culling without clusters costs
+    size_t meshesVisible = 0;
+    start = Bench::Clock::now();
+    for (const Scene::Frustum &frustum : frustums)
+    {
+        for (const AABB &box : bounds)
+            meshesVisible += frustum.Intersects(box);
+    }
+    double meshMs = Bench::ElapsedMs(start);
+
+    size_t clustersVisible = 0, itemsVisible = 0;
+    start = Bench::Clock::now();
+    for (const Scene::Frustum &frustum : frustums)
+    {
+        clustersVisible += culler.Cull(frustum).size();
+        itemsVisible += culler.VisibleItemCount();
+    }
+    double clusterMs = Bench::ElapsedMs(start);
+
+    start = Bench::Clock::now();
+    for (const Scene::Frustum &frustum : frustums)
+        culler.CullScalar(frustum);
+    double scalarMs = Bench::ElapsedMs(start);
+
+    size_t differ = 0, missed = 0;
+    std::vector<char> drawn(bounds.size());
+    for (const Scene::Frustum &frustum : frustums)
+    {
+        const std::vector<int> &visible = culler.Cull(frustum);
+        differ += visible != culler.CullScalar(frustum);
+
+        std::fill(drawn.begin(), drawn.end(), 0);
+        for (int c : visible)
+        {
+            for (int item : culler.Items(c))
+                drawn[item] = 1;
+        }
+        for (size_t i = 0; i < bounds.size(); i++)
+            missed += !drawn[i] && bounds[i].min.x <= bounds[i].max.x && frustum.Intersects(bounds[i]);
+    }
+
+    printf("%-10s %10.2f us per frame, %8.1f of %d visible\n", "meshes", meshMs * 1000.0 / frames,
+           (double)meshesVisible / frames, (int)bounds.size());
+    printf("%-10s %10.2f us per frame, %8.1f of %d visible, %.1f meshes drawn\n", "clusters",
+           clusterMs * 1000.0 / frames, (double)clustersVisible / frames, culler.ClusterCount(),
+           (double)itemsVisible / frames);
+    printf("%-10s %10.2f us per frame\n", "scalar", scalarMs * 1000.0 / frames);
+    printf("%zu frames differ from the scalar test, %zu meshes inside the frustum culled\n", differ, missed);
+
+    return differ == 0 && missed == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <physfs.h>
+#include "Bench.hpp"
+#include "FS/FS.hpp"
+#include "MapFormat/map.hpp"
+
+// Looked for in this order, like FS::FindTexture
+static const char *TEXTURE_EXTENSIONS[] = {".tga", ".jpg", ".png"};
+
+// What adding a game directory and finding every texture of a map came to
+struct ResolveRun
+{
+    double addMs = 0.0, findMs = 0.0;
+    size_t archivesRead = 0, directoriesListed = 0, files = 0, found = 0;
+    std::vector<std::string> resolved; // directory or archive and file name, by texture
+};
+
+static ResolveRun ResolveIndexed(const char *dirPath, const char *indexFile, const std::vector<std::string> &names)
+{
+    ResolveRun run;
+    FS::Init();
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    FS::AddDir(dirPath, indexFile);
+    run.addMs = Bench::ElapsedMs(start);
+
+    const FS::FileIndex &index = FS::GetFileIndex();
+    run.archivesRead = index.ArchivesRead();
+    run.directoriesListed = index.DirectoriesListed();
+    run.files = index.FileCount();
+
+    std::vector<std::string> fileNames(names.size());
+    start = Bench::Clock::now();
+    for (size_t i = 0; i < names.size(); i++)
+        fileNames[i] = FS::FindTexture(names[i]);
+    run.findMs = Bench::ElapsedMs(start);
+
+    for (const std::string &fileName : fileNames)
+    {
+        const FS::FileIndex::Entry *entry = fileName.empty() ? nullptr : index.Find(fileName);
+        run.found += entry != nullptr;
+        run.resolved.push_back(entry ? index.GetSource(entry->source).path + ": " + fileName : std::string());
+    }
+
+    FS::Close();
+    return run;
+}
+
+// The way it was before the index: every pk3 mounted at the root and every
+// extension of every name searched for through all of them
+static ResolveRun ResolveSearched(const char *dirPath, const std::vector<std::string> &names)
+{
+    ResolveRun run;
+    PHYSFS_init(NULL);
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    PHYSFS_mount(dirPath, "/", 1);
+    std::vector<std::string> zipFiles;
+    if (DIR *dir = opendir(dirPath))
+    {
+        while (struct dirent *ent = readdir(dir))
+        {
+            std::string fileName = ent->d_name;
+            if (fileName.size() > 4 && fileName.substr(fileName.size() - 4) == ".pk3")
+                zipFiles.push_back(fileName);
+        }
+        closedir(dir);
+    }
+    std::sort(zipFiles.begin(), zipFiles.end());
+    for (const std::string &zipFile : zipFiles)
+        PHYSFS_mount((std::string(dirPath) + "/" + zipFile).c_str(), "/", 1);
+    run.addMs = Bench::ElapsedMs(start);
+    run.archivesRead = zipFiles.size();
+
+    std::vector<std::string> fileNames(names.size());
+    start = Bench::Clock::now();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        for (const char *extension : TEXTURE_EXTENSIONS)
+        {
+            std::string fileName = names[i] + extension;
+            if (PHYSFS_exists(fileName.c_str()))
+            {
+                fileNames[i] = fileName;
+                break;
+            }
+        }
+    }
+    run.findMs = Bench::ElapsedMs(start);
+
+    for (const std::string &fileName : fileNames)
+    {
+        const char *realDir = fileName.empty() ? nullptr : PHYSFS_getRealDir(fileName.c_str());
+        run.found += realDir != nullptr;
+        run.resolved.push_back(realDir ? std::string(realDir) + ": " + fileName : std::string());
+    }
+
+    PHYSFS_deinit();
+    return run;
+}
+
+static void PrintRun(const char *label, const ResolveRun &run, size_t names)
+{
+    printf("%-10s added in %10.2f ms, %4zu archives read, %5zu directories listed, %8.2f us per texture\n", label,
+           run.addMs, run.archivesRead, run.directoriesListed, run.findMs * 1000.0 / std::max(names, (size_t)1));
+}
+
+// Finds the textures of a map in a game directory and its pk3s through the
+// file index, built from the disk and then from the index file, and
+// through PhysFS' own search. All three must pick the same copies.
+int Bench::RunFiles(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: files <game dir> <mapfile> [index file]\n");
+        return 1;
+    }
+
+    std::string indexFile = argc >= 3 ? argv[2] : std::string(argv[1]) + ".files.index";
+
+    Map map;
+    if (!Map::Load(argv[1], map))
+        return 1;
+
+    std::vector<std::string> names;
+    for (const std::string &texture : map.textures)
+        names.push_back("textures/" + texture);
+
+    // a cold index reads every central directory and lists every loose
+    // directory, the warm one none
+    remove(indexFile.c_str());
+    ResolveRun cold = ResolveIndexed(argv[0], indexFile.c_str(), names);
+    ResolveRun warm = ResolveIndexed(argv[0], indexFile.c_str(), names);
+    ResolveRun searched = ResolveSearched(argv[0], names);
+
+    printf("%s: %zu textures, %zu found, %zu files indexed\n", argv[1], names.size(), cold.found, cold.files);
+    PrintRun("cold index", cold, names.size());
+    PrintRun("warm index", warm, names.size());
+    PrintRun("search", searched, names.size());
+
+    bool same = cold.resolved == warm.resolved && cold.resolved == searched.resolved;
+    if (!same)
+    {
+        printf("THE INDEX RESOLVES DIFFERENTLY FROM PHYSFS\n");
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (cold.resolved[i] != searched.resolved[i] || warm.resolved[i] != searched.resolved[i])
+                printf("  %s: index '%s', '%s', search '%s'\n", names[i].c_str(), cold.resolved[i].c_str(),
+                       warm.resolved[i].c_str(), searched.resolved[i].c_str());
+        }
+    }
+    bool cached = warm.archivesRead == 0 && warm.directoriesListed == 0;
+    if (!cached)
+        printf("THE INDEX FILE WASN'T USED\n");
+
+    return same && cached ? 0 : 1;
+}
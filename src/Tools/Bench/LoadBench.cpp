@@ -0,0 +1,76 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "Bench.hpp"
+#include "FS/MappedFile.hpp"
+#include "MapFormat/Lexer.hpp"
+#include "MapFormat/Parser.hpp"
+
+// Current anonymous and file-backed resident memory in kilobytes. Mapped file
+// pages count towards the peak resident size too, but they are clean page cache
+// that the kernel can drop, unlike a heap copy of the file.
+static bool residentMemoryKb(size_t &anon, size_t &file)
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status)
+        return false;
+
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), status))
+    {
+        if (sscanf(line, "RssAnon: %zu", &anon) == 1 || sscanf(line, "RssFile: %zu", &file) == 1)
+            found++;
+    }
+
+    fclose(status);
+    return found == 2;
+}
+
+// Same steps as Map::Load, timed separately. --read forces the heap buffer
+// path that Map::Load falls back to when a file can't be mapped.
+int Bench::RunLoad(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: load <mapfile> [--read]\n");
+        return 1;
+    }
+
+    bool allowMapping = !(argc >= 2 && strcmp(argv[1], "--read") == 0);
+    size_t memoryStart = Bench::PeakMemoryKb();
+    Bench::Clock::time_point start = Bench::Clock::now();
+
+    FS::MappedFile file;
+    if (!file.Open(argv[0], allowMapping))
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    Lexer lexer(file.Data(), file.Size());
+    Token first = lexer.next();
+    double firstTokenMs = Bench::ElapsedMs(start);
+    lexer.pushBack(first);
+
+    Map map;
+    if (!parseMap(lexer, &map))
+    {
+        fprintf(stderr, "Parsing failed.\n");
+        return 1;
+    }
+
+    double totalMs = Bench::ElapsedMs(start);
+
+    size_t anonKb = 0, fileKb = 0;
+    bool haveResident = residentMemoryKb(anonKb, fileKb);
+
+    printf("%s: %.2f MB, %s\n", argv[0], file.Size() / (1024.0 * 1024.0), file.IsMapped() ? "mapped" : "read into heap");
+    printf("first token %10.2f ms\n", firstTokenMs);
+    printf("total       %10.2f ms\n", totalMs);
+    printf("peak memory %10.2f MB (%.2f MB at start)\n", Bench::PeakMemoryKb() / 1024.0, memoryStart / 1024.0);
+    if (haveResident)
+        printf("resident    %10.2f MB anonymous, %.2f MB file-backed after parsing\n", anonKb / 1024.0, fileKb / 1024.0);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Bench.hpp"
+#include "MapFormat/map.hpp"
+#include "Scene/PatchLod.hpp"
+
+// Viewer settings the levels are picked for
+static const float FOV_Y = 90.0f * 3.14159265f / 180.0f;
+static const float VIEWPORT_HEIGHT = 1000.0f;
+
+// Vertices further than this from the neighbour's edge are a crack
+static const float MAX_GAP = 1e-3f;
+
+// Triangle counts of every patch level and of the levels picked from a
+// few distances, and checks that shared edges stay closed at all of them
+int Bench::RunLod(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: lod <mapfile> [max pixel error]\n");
+        return 1;
+    }
+
+    float maxPixelError = argc >= 2 ? (float)atof(argv[1]) : 1.0f;
+    if (maxPixelError <= 0.0f)
+        maxPixelError = 1.0f;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    Scene::PatchLod lod;
+    vec3 mins(INFINITY), maxs(-INFINITY);
+    for (const Patch &patch : map.patches)
+    {
+        Span<const PatchVert> controlPoints = map.GetControlPoints(patch);
+        lod.AddPatch(controlPoints.data, patch.width, patch.height, patch.textureId);
+        for (const PatchVert &cp : controlPoints)
+        {
+            mins = glm::min(mins, cp.position);
+            maxs = glm::max(maxs, cp.position);
+        }
+    }
+    lod.Finish();
+    double buildMs = Bench::ElapsedMs(start);
+
+    if (lod.PatchCount() == 0)
+    {
+        printf("%s: no patches\n", argv[0]);
+        return 0;
+    }
+
+    printf("%s: %d patches, levels cached in %.2f ms, %zu vertices\n", argv[0], lod.PatchCount(), buildMs,
+           lod.CachedVertexCount());
+
+    bool closed = true;
+    for (int level = 0; level <= Patch::MAX_LOD_LEVEL; level++)
+    {
+        int refined = 0;
+        float maxError = 0.0f;
+        for (int p = 0; p < lod.PatchCount(); p++)
+        {
+            int used = std::min(level, lod.FinestLevel(p));
+            refined += lod.FinestLevel(p) >= level;
+            maxError = std::max(maxError, lod.Error(p, used));
+        }
+
+        lod.SelectLevel(level);
+        float gap = lod.MaxEdgeGap();
+        closed = closed && gap <= MAX_GAP;
+        printf("level %d (%2d steps): %6d patches go this fine, %10zu triangles, max error %8.3f, max edge gap %g\n",
+               level, 1 << level, refined, lod.TriangleCount(level), maxError, gap);
+    }
+
+    // looking at the middle of the patches from further and further away
+    vec3 center = (mins + maxs) * 0.5f;
+    float radius = std::max(glm::length(maxs - mins) * 0.5f, 1.0f);
+    const float distances[] = {0.0f, 0.25f, 1.0f, 4.0f, 16.0f};
+
+    printf("max %.2f pixels of error, %.0f pixel high viewport\n", maxPixelError, VIEWPORT_HEIGHT);
+    for (float distance : distances)
+    {
+        vec3 eye = center + glm::normalize(vec3(1.0f, 1.0f, 0.5f)) * (distance * radius);
+
+        start = Bench::Clock::now();
+        size_t changed = lod.Select(eye, FOV_Y, VIEWPORT_HEIGHT, maxPixelError).size();
+        double selectMs = Bench::ElapsedMs(start);
+
+        int perLevel[Patch::MAX_LOD_LEVEL + 1] = {};
+        for (int p = 0; p < lod.PatchCount(); p++)
+            perLevel[lod.Level(p)]++;
+
+        float gap = lod.MaxEdgeGap();
+        closed = closed && gap <= MAX_GAP;
+        printf("at %5.2f radii: %10zu triangles, patches per level %d/%d/%d/%d, %zu meshes changed in %.3f ms, "
+               "max edge gap %g\n",
+               distance, lod.SelectedTriangleCount(), perLevel[0], perLevel[1], perLevel[2], perLevel[3], changed,
+               selectMs, gap);
+    }
+
+    if (!closed)
+        printf("CRACKS BETWEEN PATCHES\n");
+    return closed ? 0 : 1;
+}
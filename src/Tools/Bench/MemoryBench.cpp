@@ -0,0 +1,45 @@
+#include <cstdio>
+#include <memory>
+#include "Bench.hpp"
+#include "MapFormat/map.hpp"
+
+// Allocations and heap footprint of a loaded map, and how long freeing it takes
+int Bench::RunMemory(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: memory <mapfile>\n");
+        return 1;
+    }
+
+    size_t heapStart = Bench::HeapInUseKb();
+    size_t allocStart = Bench::AllocationCount();
+    Bench::Clock::time_point start = Bench::Clock::now();
+
+    std::unique_ptr<Map> map(new Map());
+    if (!Map::Load(argv[0], *map))
+        return 1;
+
+    double loadMs = Bench::ElapsedMs(start);
+    size_t loadAllocations = Bench::AllocationCount() - allocStart;
+    size_t loadHeap = Bench::HeapInUseKb() - heapStart;
+
+    allocStart = Bench::AllocationCount();
+    start = Bench::Clock::now();
+    map->CalculateGeometry();
+
+    double geometryMs = Bench::ElapsedMs(start);
+    size_t geometryAllocations = Bench::AllocationCount() - allocStart;
+    size_t totalHeap = Bench::HeapInUseKb() - heapStart;
+
+    start = Bench::Clock::now();
+    map.reset();
+    double freeMs = Bench::ElapsedMs(start);
+
+    printf("%-18s %10.2f ms %10zu allocs %10.2f MB heap\n", "Map::Load", loadMs, loadAllocations, loadHeap / 1024.0);
+    printf("%-18s %10.2f ms %10zu allocs %10.2f MB heap\n", "CalculateGeometry", geometryMs, geometryAllocations,
+           (totalHeap - loadHeap) / 1024.0);
+    printf("%-18s %10.2f ms\n", "free", freeMs);
+    printf("total heap %.2f MB, peak memory %.2f MB\n", totalHeap / 1024.0, Bench::PeakMemoryKb() / 1024.0);
+    return 0;
+}
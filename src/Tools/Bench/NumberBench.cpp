@@ -0,0 +1,162 @@
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "MapFormat/Lexer.hpp"
+#include "MapFormat/Number.hpp"
+
+// The conversion the parser used before parseFloat: copy into a terminated
+// buffer and run strtof on it
+static bool referenceFloat(std::string_view text, float &out)
+{
+    char buffer[64];
+    if (text.empty() || text.size() >= sizeof(buffer))
+        return false;
+
+    memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = '\0';
+
+    char *endptr = nullptr;
+    out = std::strtof(buffer, &endptr);
+    return endptr != buffer && *endptr == '\0';
+}
+
+static bool fromCharsFloat(std::string_view text, float &out)
+{
+    std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+static bool sameResult(std::string_view text)
+{
+    float expected = 0.0f, actual = 0.0f;
+    bool expectedOk = referenceFloat(text, expected);
+    bool actualOk = parseFloat(text, actual);
+
+    if (expectedOk != actualOk || (expectedOk && memcmp(&expected, &actual, sizeof(float)) != 0))
+    {
+        printf("MISMATCH '%.*s': strtof %s %.9g, parseFloat %s %.9g\n", (int)text.size(), text.data(),
+               expectedOk ? "ok" : "fail", expected, actualOk ? "ok" : "fail", actual);
+        return false;
+    }
+
+    return true;
+}
+
+// Radiant style numbers plus some that only the slow paths handle
+static std::vector<std::string> generatedNumbers(size_t count)
+{
+    static const char *special[] = {
+        "0", "-0", "+0", "-0.0", "1.", ".5", "-.5", "16777216", "16777217", "-16777217",
+        "0.1", "0.3333333333", "1e10", "1E-5", "3.4028235e38", "1e39", "-1e39", "1e-50",
+        "inf", "-inf", "nan", "0x1p3", "+-1", "-", "+", ".", "1e", "12abc", "00000000000000000000001.5"};
+
+    std::vector<std::string> numbers(std::begin(special), std::end(special));
+    std::mt19937 rng(1234);
+    char buffer[64];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        switch (rng() % 4)
+        {
+        case 0:
+            snprintf(buffer, sizeof(buffer), "%d", (int)(rng() % 200001) - 100000);
+            break;
+        case 1:
+            snprintf(buffer, sizeof(buffer), "%.*f", (int)(rng() % 11), ((int)(rng() % 2000001) - 1000000) / 997.0);
+            break;
+        case 2:
+            snprintf(buffer, sizeof(buffer), "%.10f", (double)rng() / rng.max());
+            break;
+        default:
+            snprintf(buffer, sizeof(buffer), "%.9g", ((double)rng() - rng.max() / 2) * 1e-3);
+            break;
+        }
+
+        numbers.push_back(buffer);
+    }
+
+    return numbers;
+}
+
+template <typename Convert>
+static double timeConversions(const std::vector<std::string_view> &tokens, int iterations, Convert convert)
+{
+    double best = 1e30;
+    float sum = 0.0f;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        Bench::Clock::time_point start = Bench::Clock::now();
+        for (std::string_view token : tokens)
+        {
+            float value = 0.0f;
+            convert(token, value);
+            sum += value;
+        }
+
+        double ms = Bench::ElapsedMs(start);
+        if (ms < best)
+            best = ms;
+    }
+
+    if (sum == 12345.0f)
+        printf("(unlikely sum)\n");
+
+    return best;
+}
+
+int Bench::RunNumbers(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: numbers <mapfile> [iterations]\n");
+        return 1;
+    }
+
+    int iterations = argc >= 2 ? atoi(argv[1]) : 5;
+    if (iterations < 1)
+        iterations = 1;
+
+    std::string source;
+    if (!Bench::ReadFile(argv[0], source))
+        return 1;
+
+    // every word in the map that strtof accepts is a number token
+    std::vector<std::string_view> tokens;
+    Lexer lexer(source.data(), source.size());
+    Token tok;
+    float unused;
+
+    while ((tok = lexer.next()).type != TokenType::END)
+    {
+        if (tok.type == TokenType::WORD && referenceFloat(tok.text, unused))
+            tokens.push_back(tok.text);
+    }
+
+    size_t mismatches = 0;
+    for (std::string_view token : tokens)
+        mismatches += !sameResult(token);
+
+    std::vector<std::string> generated = generatedNumbers(1000000);
+    for (const std::string &number : generated)
+        mismatches += !sameResult(number);
+
+    printf("%zu number tokens from %s, %zu generated, %zu mismatches against strtof\n",
+           tokens.size(), argv[0], generated.size(), mismatches);
+
+    double strtofMs = timeConversions(tokens, iterations, referenceFloat);
+    double fromCharsMs = timeConversions(tokens, iterations, fromCharsFloat);
+    double parseFloatMs = timeConversions(tokens, iterations, parseFloat);
+
+    printf("%-14s %10.2f ms %8.2f ns/number\n", "strtof", strtofMs, strtofMs * 1e6 / tokens.size());
+    printf("%-14s %10.2f ms %8.2f ns/number\n", "from_chars", fromCharsMs, fromCharsMs * 1e6 / tokens.size());
+    printf("%-14s %10.2f ms %8.2f ns/number (%.1fx strtof)\n", "parseFloat", parseFloatMs,
+           parseFloatMs * 1e6 / tokens.size(), strtofMs / parseFloatMs);
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "FS/FS.hpp"
+#include "FS/TextureLoader.hpp"
+#include "MapFormat/map.hpp"
+#include "Scene/Culling.hpp"
+#include "Scene/TexturePacking.hpp"
+
+// The viewer's camera and clusters, like the cull command
+static const float FOV_Y = 90.0f;
+static const float ASPECT = 1800.0f / 1000.0f;
+static const float NEAR_PLANE = 0.01f;
+static const float FAR_PLANE = 1000.0f;
+static const float CLUSTER_SIZE = 1024.0f;
+
+// Texture size taken for every texture without a game directory, what
+// face UVs fall back to
+static const float DEFAULT_TEXTURE_SIZE = 512.0f;
+
+static bool SamePacking(const Scene::TexturePacking &a, const Scene::TexturePacking &b)
+{
+    if (a.textures.size() != b.textures.size() || a.binds.size() != b.binds.size())
+        return false;
+
+    for (size_t t = 0; t < a.textures.size(); t++)
+    {
+        const Scene::PackedTexture &ta = a.textures[t], &tb = b.textures[t];
+        if (ta.bind != tb.bind || ta.layer != tb.layer || ta.x != tb.x || ta.y != tb.y || ta.tiles != tb.tiles)
+            return false;
+    }
+    for (size_t i = 0; i < a.binds.size(); i++)
+    {
+        const Scene::TextureBind &ba = a.binds[i], &bb = b.binds[i];
+        if (ba.kind != bb.kind || ba.width != bb.width || ba.height != bb.height || ba.textures != bb.textures)
+            return false;
+    }
+    return true;
+}
+
+// Every bind holds what it says: array layers of its size, atlas textures
+// inside their page and apart from each other with their padding
+static size_t CountLayoutErrors(const Scene::TexturePacking &packing)
+{
+    size_t errors = 0;
+    for (size_t b = 0; b < packing.binds.size(); b++)
+    {
+        const Scene::TextureBind &bind = packing.binds[b];
+        for (size_t i = 0; i < bind.textures.size(); i++)
+        {
+            const Scene::PackedTexture &texture = packing.textures[bind.textures[i]];
+            errors += texture.bind != (int)b;
+
+            if (bind.kind == Scene::TextureBind::Array)
+            {
+                errors += texture.layer != (int)i || texture.width != bind.width || texture.height != bind.height;
+            }
+            else if (bind.kind == Scene::TextureBind::Atlas)
+            {
+                int p = Scene::ATLAS_PADDING;
+                errors += texture.tiles || texture.x < p || texture.y < p ||
+                          texture.x + texture.width + p > bind.width || texture.y + texture.height + p > bind.height;
+
+                for (size_t j = 0; j < i; j++)
+                {
+                    const Scene::PackedTexture &other = packing.textures[bind.textures[j]];
+                    errors += texture.x - p < other.x + other.width + p && other.x - p < texture.x + texture.width + p &&
+                              texture.y - p < other.y + other.height + p && other.y - p < texture.y + texture.height + p;
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+// Vertices whose packed UV doesn't lead back to the texel they had, or
+// that have the wrong bind or layer
+static size_t CountUVErrors(const std::vector<Scene::MeshData> &meshes, const std::vector<Scene::MeshData> &packed,
+                            const std::vector<int> &layers, const Scene::TexturePacking &packing)
+{
+    size_t errors = 0;
+    for (size_t m = 0; m < meshes.size(); m++)
+    {
+        const Scene::MeshData &mesh = meshes[m];
+        if (mesh.indices.empty())
+            continue;
+
+        const Scene::PackedTexture &texture = packing.textures[mesh.textureId];
+        const Scene::TextureBind &bind = packing.binds[texture.bind];
+        errors += packed[m].textureId != texture.bind || layers[m] != texture.layer;
+
+        for (int v = 0; v < mesh.VertexCount(); v++)
+        {
+            vec2 uv(mesh.texcoords[2 * v], mesh.texcoords[2 * v + 1]);
+            vec2 packedUV(packed[m].texcoords[2 * v], packed[m].texcoords[2 * v + 1]);
+            if (bind.kind == Scene::TextureBind::Atlas)
+            {
+                packedUV = (packedUV * vec2((float)bind.width, (float)bind.height) - vec2((float)texture.x, (float)texture.y)) /
+                           vec2((float)texture.width, (float)texture.height);
+            }
+
+            // a hundredth of a texel
+            vec2 tolerance(0.01f / std::max(texture.width, 1), 0.01f / std::max(texture.height, 1));
+            errors += std::abs(packedUV.x - uv.x) > tolerance.x || std::abs(packedUV.y - uv.y) > tolerance.y;
+        }
+    }
+    return errors;
+}
+
+// Packs the textures of a map into arrays and atlas pages and counts the
+// texture binds drawing it takes before and after, for the whole map and
+// from cameras spread over it like the cull command's. Texture sizes come
+// from the file headers in the game directory when there's one.
+int Bench::RunPack(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: pack <mapfile> [max page size] [frames] [game dir]\n");
+        return 1;
+    }
+
+    int maxPageSize = argc >= 2 ? atoi(argv[1]) : 2048;
+    if (maxPageSize < 1)
+        maxPageSize = 2048;
+    int frames = argc >= 3 ? atoi(argv[2]) : 1000;
+    if (frames < 1)
+        frames = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    if (argc >= 4)
+    {
+        if (FS::Init() != 0 || FS::AddDir(argv[3]) != 0)
+        {
+            fprintf(stderr, "Failed to add %s\n", argv[3]);
+            return 1;
+        }
+
+        std::vector<std::string> names;
+        for (const std::string &texture : map.textures)
+            names.push_back("textures/" + texture);
+
+        std::vector<FS::TextureSize> sizes = FS::ReadTextureSizes(names);
+        for (size_t t = 0; t < sizes.size(); t++)
+            map.textureSizes[t] = vec2((float)sizes[t].width, (float)sizes[t].height);
+        FS::Close();
+    }
+    else
+    {
+        std::fill(map.textureSizes.begin(), map.textureSizes.end(), vec2(DEFAULT_TEXTURE_SIZE));
+    }
+    map.CalculateGeometry();
+
+    std::vector<Scene::MeshData> meshes = Scene::BuildMeshes(map);
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    Scene::TexturePacking packing = Scene::PackTextures(meshes, map.textureSizes, maxPageSize);
+    double packMs = Bench::ElapsedMs(start);
+
+    std::vector<Scene::MeshData> packed = meshes;
+    start = Bench::Clock::now();
+    std::vector<int> meshLayers = Scene::ApplyPacking(packing, packed);
+    double applyMs = Bench::ElapsedMs(start);
+
+    bool deterministic = SamePacking(packing, Scene::PackTextures(meshes, map.textureSizes, maxPageSize));
+    size_t layoutErrors = CountLayoutErrors(packing);
+    size_t uvErrors = CountUVErrors(meshes, packed, meshLayers, packing);
+
+    size_t used = 0, tiling = 0, arrays = 0, layers = 0, pages = 0, pageTextures = 0, singles = 0;
+    double pageTexels = 0.0, usedTexels = 0.0;
+    for (const Scene::PackedTexture &texture : packing.textures)
+    {
+        used += texture.bind >= 0;
+        tiling += texture.bind >= 0 && texture.tiles;
+    }
+    for (const Scene::TextureBind &bind : packing.binds)
+    {
+        if (bind.kind == Scene::TextureBind::Array)
+        {
+            arrays++;
+            layers += bind.textures.size();
+        }
+        else if (bind.kind == Scene::TextureBind::Atlas)
+        {
+            pages++;
+            pageTextures += bind.textures.size();
+            pageTexels += (double)bind.width * bind.height;
+            for (int t : bind.textures)
+                usedTexels += (double)packing.textures[t].width * packing.textures[t].height;
+        }
+        else
+        {
+            singles++;
+        }
+    }
+
+    std::vector<int> all(meshes.size());
+    for (size_t m = 0; m < meshes.size(); m++)
+        all[m] = (int)m;
+
+    printf("%s: %zu textures used, %zu tile, packed in %.3f ms, UVs moved in %.3f ms\n", argv[0], used, tiling, packMs,
+           applyMs);
+    printf("%zu arrays with %zu layers, %zu atlas pages of up to %d with %zu textures %.0f%% full, %zu on their own\n",
+           arrays, layers, pages, maxPageSize, pageTextures, pageTexels > 0.0 ? 100.0 * usedTexels / pageTexels : 0.0,
+           singles);
+    printf("whole map: %d binds -> %d\n", Scene::CountBinds(meshes, {all.data(), all.size()}),
+           Scene::CountBinds(packed, {all.data(), all.size()}));
+
+    std::vector<AABB> bounds;
+    for (const Scene::MeshData &mesh : meshes)
+        bounds.push_back(Scene::MeshBounds(mesh));
+
+    Scene::ClusterCuller culler;
+    culler.Build(bounds, CLUSTER_SIZE / 30.0f);
+    if (culler.ItemCount() > 0)
+    {
+        vec3 mins(INFINITY), maxs(-INFINITY);
+        for (int c = 0; c < culler.ClusterCount(); c++)
+        {
+            mins = glm::min(mins, culler.Bounds(c).min);
+            maxs = glm::max(maxs, culler.Bounds(c).max);
+        }
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        size_t bindsBefore = 0, bindsAfter = 0;
+        std::vector<int> visible;
+        for (int f = 0; f < frames; f++)
+        {
+            vec3 eye = mins + (maxs - mins) * vec3(unit(random), unit(random), unit(random));
+            float yaw = unit(random) * 6.2831853f, pitch = (unit(random) - 0.5f) * 1.5f;
+            vec3 forward(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+            Scene::Frustum frustum = Scene::Frustum::FromCamera(eye, eye + forward, vec3(0.0f, 1.0f, 0.0f), FOV_Y,
+                                                                ASPECT, NEAR_PLANE, FAR_PLANE);
+
+            visible.clear();
+            for (int c : culler.Cull(frustum))
+            {
+                for (int item : culler.Items(c))
+                    visible.push_back(item);
+            }
+            bindsBefore += Scene::CountBinds(meshes, {visible.data(), visible.size()});
+            bindsAfter += Scene::CountBinds(packed, {visible.data(), visible.size()});
+        }
+
+        printf("per frame: %.1f binds -> %.1f, %.1f saved over %d frames\n", (double)bindsBefore / frames,
+               (double)bindsAfter / frames, (double)(bindsBefore - bindsAfter) / frames, frames);
+    }
+
+    if (!deterministic)
+        printf("PACKING DIFFERS BETWEEN RUNS\n");
+    if (layoutErrors > 0)
+        printf("%zu TEXTURES OUT OF PLACE IN THEIR BINDS\n", layoutErrors);
+    if (uvErrors > 0)
+        printf("%zu VERTICES WITH WRONG PACKED UVS, LAYERS OR BINDS\n", uvErrors);
+    return deterministic && layoutErrors == 0 && uvErrors == 0 ? 0 : 1;
+}
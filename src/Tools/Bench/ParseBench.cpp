@@ -0,0 +1,280 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/Lexer.hpp"
+#include "MapFormat/Parser.hpp"
+
+struct LexResult
+{
+    size_t tokens;
+    size_t allocations;
+    double ms;
+};
+
+// Lexes the whole buffer. With copyTokens set every token is also copied into
+// an owning std::string, which is what the lexer did before tokens became views.
+static LexResult lexAll(const std::string &source, bool copyTokens)
+{
+    LexResult result = {0, 0, 0.0};
+    size_t allocStart = Bench::AllocationCount();
+    Bench::Clock::time_point start = Bench::Clock::now();
+
+    Lexer lexer(source.c_str());
+    size_t checksum = 0;
+    Token tok;
+
+    while ((tok = lexer.next()).type != TokenType::END)
+    {
+        if (copyTokens)
+        {
+            std::string owned(tok.text);
+            checksum += owned.size();
+        }
+        else
+        {
+            checksum += tok.text.size();
+        }
+
+        result.tokens++;
+    }
+
+    result.ms = Bench::ElapsedMs(start);
+    result.allocations = Bench::AllocationCount() - allocStart;
+
+    if (checksum == 0)
+        printf("(empty input)\n");
+
+    return result;
+}
+
+// Everything the parser produces, in a comparable form
+static std::string mapSignature(Map &map)
+{
+    std::string signature = map.Stringify();
+
+    for (const Entity &entity : map.entities)
+    {
+        signature += "entity " + std::to_string(entity.id) + ":";
+        for (const Brush &brush : map.GetBrushes(entity))
+            signature += " b" + std::to_string(brush.id);
+        for (const Patch &patch : map.GetPatches(entity))
+            signature += " p" + std::to_string(patch.id);
+        signature += "\n";
+    }
+
+    std::vector<std::string> textures;
+    for (const std::string &texture : map.textures)
+        textures.push_back(texture);
+    for (const std::string &model : map.models)
+        textures.push_back("model " + model);
+
+    for (const std::string &texture : textures)
+        signature += texture + "\n";
+
+    return signature;
+}
+
+// The source with a quoted string between the first two entities, which
+// the parser has to reject. Empty if there's no second entity.
+static std::string strayString(const std::string &source)
+{
+    int depth = 0;
+    for (size_t pos = 0; pos < source.size(); pos++)
+    {
+        char c = source[pos];
+        if (c == '"')
+        {
+            size_t quote = source.find('"', pos + 1);
+            pos = quote == std::string::npos ? source.size() : quote;
+        }
+        else if (c == '/' && pos + 1 < source.size() && source[pos + 1] == '/')
+        {
+            size_t newline = source.find('\n', pos);
+            pos = newline == std::string::npos ? source.size() : newline;
+        }
+        else if (c == '{')
+        {
+            depth++;
+        }
+        else if (c == '}' && --depth == 0)
+        {
+            if (source.find('{', pos) == std::string::npos)
+                return std::string();
+            return source.substr(0, pos + 1) + "\n\"junk\"\n" + source.substr(pos + 1);
+        }
+    }
+    return std::string();
+}
+
+// The source with the first number of the first brush face replaced by a
+// word, which the parser has to reject with or without geometry. Empty if
+// there's no brush face.
+static std::string badNumber(const std::string &source)
+{
+    for (size_t pos = source.find("( "); pos != std::string::npos; pos = source.find("( ", pos + 1))
+    {
+        size_t start = pos + 2;
+        size_t end = source.find_first_of(" \t\r\n", start);
+        if (end == std::string::npos)
+            break;
+
+        char c = source[start];
+        if ((c >= '0' && c <= '9') || c == '-' || c == '.')
+            return source.substr(0, start) + "foo" + source.substr(end);
+    }
+    return std::string();
+}
+
+// Takes nothing but the texture names, like the asset scan
+class NoGeometryVisitor : public MapVisitor
+{
+public:
+    bool wantsGeometry() const override { return false; }
+};
+
+static void printLex(const char *label, const LexResult &result, size_t bytes)
+{
+    printf("%-22s %10.2f ms %9.1f MB/s %10zu tokens %10zu allocs (%.3f per token)\n",
+           label, result.ms, bytes / (1024.0 * 1024.0) / (result.ms / 1000.0), result.tokens,
+           result.allocations, result.tokens ? (double)result.allocations / result.tokens : 0.0);
+}
+
+int Bench::RunParse(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: parse <mapfile> [iterations] [threads]\n");
+        return 1;
+    }
+
+    int iterations = argc >= 2 ? atoi(argv[1]) : 5;
+    if (iterations < 1)
+        iterations = 1;
+
+    std::string source;
+    if (!Bench::ReadFile(argv[0], source))
+        return 1;
+
+    printf("%s: %.2f MB, %d iterations\n", argv[0], source.size() / (1024.0 * 1024.0), iterations);
+
+    LexResult bestViews = {0, 0, 1e30}, bestCopies = {0, 0, 1e30};
+    for (int i = 0; i < iterations; i++)
+    {
+        LexResult views = lexAll(source, false);
+        LexResult copies = lexAll(source, true);
+
+        if (views.ms < bestViews.ms)
+            bestViews = views;
+        if (copies.ms < bestCopies.ms)
+            bestCopies = copies;
+    }
+
+    printLex("lex (token views)", bestViews, source.size());
+    printLex("lex (owning copies)", bestCopies, source.size());
+
+    // the serial parse is the reference the parallel one has to match exactly
+    int threads = argc >= 3 ? atoi(argv[2]) : 0;
+    std::string reference;
+
+    for (int threadCount : {1, threads})
+    {
+        Jobs::SetThreadCount(threadCount);
+
+        double bestParse = 1e30;
+        size_t parseAllocations = 0;
+        size_t entities = 0;
+        std::string signature;
+
+        for (int i = 0; i < iterations; i++)
+        {
+            size_t allocStart = Bench::AllocationCount();
+            Bench::Clock::time_point start = Bench::Clock::now();
+
+            Map map;
+            Lexer lexer(source.data(), source.size());
+            if (!parseMap(lexer, &map))
+            {
+                fprintf(stderr, "Parsing failed.\n");
+                return 1;
+            }
+
+            double ms = Bench::ElapsedMs(start);
+            parseAllocations = Bench::AllocationCount() - allocStart;
+            entities = map.entities.size();
+
+            if (ms < bestParse)
+                bestParse = ms;
+
+            if (i == 0)
+                signature = mapSignature(map);
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "parseMap (%d thread%s)", Jobs::ThreadCount(), Jobs::ThreadCount() > 1 ? "s" : "");
+        printf("%-22s %10.2f ms %9.1f MB/s %10zu entities %8zu allocs\n", label, bestParse,
+               source.size() / (1024.0 * 1024.0) / (bestParse / 1000.0), entities, parseAllocations);
+
+        if (reference.empty())
+        {
+            reference = signature;
+        }
+        else if (signature != reference)
+        {
+            printf("MISMATCH: parallel parse differs from the serial parse\n");
+            return 1;
+        }
+    }
+
+    // damaged input has to fail the same way whatever the thread count
+    std::string damaged = strayString(source);
+    if (!damaged.empty())
+    {
+        bool rejected[2];
+        int threadCounts[2] = {1, threads};
+        for (int i = 0; i < 2; i++)
+        {
+            Jobs::SetThreadCount(threadCounts[i]);
+            Map map;
+            Lexer lexer(damaged.data(), damaged.size());
+            rejected[i] = !parseMap(lexer, &map);
+        }
+
+        printf("stray top level string rejected: %s serially, %s in parallel\n", rejected[0] ? "yes" : "no",
+               rejected[1] ? "yes" : "no");
+        if (!rejected[0] || !rejected[1])
+        {
+            printf("MISMATCH: a damaged map parses\n");
+            return 1;
+        }
+    }
+
+    // a word where a number goes fails whether the numbers are kept or not
+    std::string malformed = badNumber(source);
+    if (!malformed.empty())
+    {
+        Jobs::SetThreadCount(1);
+        ParseContext context;
+        context.printErrors = false;
+
+        Map map;
+        Lexer mapLexer(malformed.data(), malformed.size());
+        bool mapRejected = !parseMap(mapLexer, &map, context);
+
+        NoGeometryVisitor visitor;
+        Lexer streamLexer(malformed.data(), malformed.size());
+        bool streamRejected = !parseMap(streamLexer, visitor, context);
+
+        printf("malformed number rejected: %s into a map, %s streamed without geometry\n",
+               mapRejected ? "yes" : "no", streamRejected ? "yes" : "no");
+        if (!mapRejected || !streamRejected)
+        {
+            printf("MISMATCH: a map with a malformed number parses\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
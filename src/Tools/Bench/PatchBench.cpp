@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Bench.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/map.hpp"
+
+// The patch tessellator as it was before the precomputed basis: three
+// evaluations per vertex for a finite difference normal. Kept as the
+// reference for the output and the speed of Patch::CalculateGeometry.
+namespace Reference
+{
+    static float BezierQuad1D(float b0, float b1, float b2, float t)
+    {
+        float it = 1.0f - t;
+        return b0 * (it * it) + 2.0f * b1 * (it * t) + b2 * (t * t);
+    }
+
+    static PatchVert EvaluatePatchPoint(const PatchVert cp[3][3], float u, float v)
+    {
+        PatchVert tmp[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            tmp[i].position.x = BezierQuad1D(cp[i][0].position.x, cp[i][1].position.x, cp[i][2].position.x, u);
+            tmp[i].position.y = BezierQuad1D(cp[i][0].position.y, cp[i][1].position.y, cp[i][2].position.y, u);
+            tmp[i].position.z = BezierQuad1D(cp[i][0].position.z, cp[i][1].position.z, cp[i][2].position.z, u);
+            tmp[i].uv.x = BezierQuad1D(cp[i][0].uv.x, cp[i][1].uv.x, cp[i][2].uv.x, u);
+            tmp[i].uv.y = BezierQuad1D(cp[i][0].uv.y, cp[i][1].uv.y, cp[i][2].uv.y, u);
+        }
+
+        PatchVert out;
+        out.position.x = BezierQuad1D(tmp[0].position.x, tmp[1].position.x, tmp[2].position.x, v);
+        out.position.y = BezierQuad1D(tmp[0].position.y, tmp[1].position.y, tmp[2].position.y, v);
+        out.position.z = BezierQuad1D(tmp[0].position.z, tmp[1].position.z, tmp[2].position.z, v);
+        out.uv.x = BezierQuad1D(tmp[0].uv.x, tmp[1].uv.x, tmp[2].uv.x, v);
+        out.uv.y = BezierQuad1D(tmp[0].uv.y, tmp[1].uv.y, tmp[2].uv.y, v);
+        return out;
+    }
+
+    static PatchVert EvaluateQuadPatch(const PatchVert cp[3][3], float u, float v)
+    {
+        PatchVert center = EvaluatePatchPoint(cp, u, v);
+
+        const float d = 0.001f;
+        PatchVert pu = EvaluatePatchPoint(cp, glm::clamp(u + d, 0.0f, 1.0f), v);
+        PatchVert pv = EvaluatePatchPoint(cp, u, glm::clamp(v + d, 0.0f, 1.0f));
+
+        center.normal = glm::normalize(glm::cross(pu.position - center.position, pv.position - center.position));
+        return center;
+    }
+
+    // Same grid layout and subdivisions as Patch::CalculateGeometry
+    static void CalculateGeometry(const Map &map, const Patch &patch, std::vector<PatchVert> &grid)
+    {
+        Span<const PatchVert> controlPoints = map.GetControlPoints(patch);
+        int cpRows = patch.height, cpCols = patch.width;
+        int pV = (cpRows - 1) / 2, pU = (cpCols - 1) / 2;
+        if (controlPoints.empty() || pV < 1 || pU < 1)
+            return;
+
+        int N = 1 << Patch::RequiredLevel(Patch::Curvature(controlPoints.data, cpCols, cpRows));
+        int nV = pV * N, nU = pU * N;
+
+        for (int i = 0; i <= nV; ++i)
+        {
+            float vScaled = float(i) / float(nV) * float(pV);
+            int subV = std::min(pV - 1, int(std::floor(vScaled)));
+
+            for (int j = 0; j <= nU; ++j)
+            {
+                float uScaled = float(j) / float(nU) * float(pU);
+                int subU = std::min(pU - 1, int(std::floor(uScaled)));
+
+                PatchVert block[3][3];
+                for (int vv = 0; vv < 3; ++vv)
+                    for (int uu = 0; uu < 3; ++uu)
+                        block[vv][uu] = controlPoints[(size_t)(subV * 2 + vv) * cpCols + subU * 2 + uu];
+
+                grid.push_back(EvaluateQuadPatch(block, uScaled - float(subU), vScaled - float(subV)));
+            }
+        }
+    }
+}
+
+// Largest differences between the reference grids and the map's. Normals
+// are only compared where the reference has a usable one: its finite
+// difference is NaN along the far edges of every patch.
+static bool CompareWithReference(const Map &map)
+{
+    std::vector<PatchVert> reference;
+    for (const Patch &patch : map.patches)
+        Reference::CalculateGeometry(map, patch, reference);
+
+    if (reference.size() != map.patchVertices.size())
+    {
+        printf("%zu vertices, reference has %zu: DIFFERS FROM THE REFERENCE\n", map.patchVertices.size(),
+               reference.size());
+        return false;
+    }
+
+    float maxPosition = 0.0f, maxUV = 0.0f, minNormalDot = 1.0f;
+    size_t nanNormals = 0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        const PatchVert &a = reference[i];
+        const PatchVert &b = map.patchVertices[i];
+
+        maxPosition = std::max(maxPosition, glm::length(a.position - b.position));
+        maxUV = std::max(maxUV, std::max(std::fabs(a.uv.x - b.uv.x), std::fabs(a.uv.y - b.uv.y)));
+
+        if (std::isfinite(a.normal.x) && std::isfinite(a.normal.y) && std::isfinite(a.normal.z))
+            minNormalDot = std::min(minNormalDot, glm::dot(a.normal, b.normal));
+        else
+            nanNormals++;
+    }
+
+    // finite differences a thousandth of the way along are only accurate
+    // to a few degrees on tight curves
+    bool same = maxPosition < 1e-2f && maxUV < 1e-4f && minNormalDot > 0.99f;
+    printf("%zu vertices: max position difference %g, max UV difference %g, min normal dot %g "
+           "(%zu NaN reference normals)%s\n",
+           reference.size(), maxPosition, maxUV, minNormalDot, nanNormals, same ? "" : ": DIFFERS FROM THE REFERENCE");
+    return same;
+}
+
+// Checks Patch::CalculateGeometry against the old evaluator and compares
+// their throughput on one thread
+int Bench::RunPatches(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: patches <mapfile> [iterations]\n");
+        return 1;
+    }
+
+    int iterations = argc >= 2 ? atoi(argv[1]) : 3;
+    if (iterations < 1)
+        iterations = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    Jobs::SetThreadCount(1);
+    printf("%s: %zu patches, %zu control points, best of %d\n", argv[0], map.patches.size(),
+           map.controlPoints.size(), iterations);
+
+    double bestReference = 1e30, bestCurrent = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        std::vector<PatchVert> reference;
+
+        Bench::Clock::time_point start = Bench::Clock::now();
+        for (const Patch &patch : map.patches)
+            Reference::CalculateGeometry(map, patch, reference);
+        bestReference = std::min(bestReference, Bench::ElapsedMs(start));
+
+        map.patchVertices.clear();
+
+        start = Bench::Clock::now();
+        for (Patch &patch : map.patches)
+            patch.CalculateGeometry(map);
+        bestCurrent = std::min(bestCurrent, Bench::ElapsedMs(start));
+    }
+
+    double vertices = (double)map.patchVertices.size();
+    printf("%-12s %10.2f ms %12.0f vertices/s\n", "reference", bestReference, vertices / (bestReference / 1000.0));
+    printf("%-12s %10.2f ms %12.0f vertices/s %6.1fx\n", "current", bestCurrent, vertices / (bestCurrent / 1000.0),
+           bestReference / bestCurrent);
+
+    return CompareWithReference(map) ? 0 : 1;
+}
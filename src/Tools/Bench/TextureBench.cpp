@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "FS/FS.hpp"
+#include "FS/Hash.hpp"
+#include "FS/TextureCache.hpp"
+#include "FS/TextureLoader.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/map.hpp"
+
+// What decoding every texture of a map came to
+struct DecodeRun
+{
+    double ms = 0.0;
+    size_t found = 0, decoded = 0, cached = 0, bytes = 0;
+    std::vector<uint64_t> hashes; // of the top level pixels, by texture
+    std::vector<FS::TextureSize> sizes;
+};
+
+// Decodes every texture through a TextureLoader and drops the images
+// where the viewer would upload them
+static DecodeRun DecodeAll(const std::vector<std::string> &names, FS::TextureCache *cache = nullptr)
+{
+    DecodeRun run;
+    run.hashes.assign(names.size(), 0);
+    run.sizes.assign(names.size(), FS::TextureSize());
+
+    Bench::Clock::time_point start = Bench::Clock::now();
+    FS::TextureLoader loader;
+    loader.Start(names, cache);
+
+    FS::DecodedTexture texture;
+    while (loader.Next(texture))
+    {
+        run.found += !texture.fileName.empty();
+        if (texture.image.data == nullptr)
+            continue;
+
+        size_t size = FS::ImageDataSize(texture.image);
+        run.decoded++;
+        run.cached += texture.cached;
+        run.bytes += size;
+        run.hashes[texture.id] = FS::Hash64(texture.image.data, size);
+        run.sizes[texture.id] = {texture.image.width, texture.image.height};
+        texture.Unload();
+    }
+
+    run.ms = Bench::ElapsedMs(start);
+    return run;
+}
+
+static void PrintRun(const char *label, const DecodeRun &run, double baselineMs)
+{
+    printf("%-12s %10.2f ms %10.1f us per texture %8.1f MB/s %8.2fx, %zu from the cache\n", label, run.ms,
+           run.ms * 1000.0 / std::max(run.decoded, (size_t)1), run.bytes / (1024.0 * 1024.0) / (run.ms / 1000.0),
+           baselineMs / run.ms, run.cached);
+}
+
+// Reads, decodes and mipmaps the textures of a map from a game directory
+// and its pk3s, on one thread and on the job pool, then fills the texture
+// cache and loads them from it. Also reads only the sizes from the headers,
+// what the viewer needs before its first frame. No window or GPU, the
+// upload is left out.
+int Bench::RunTextures(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: textures <game dir> <mapfile> [threads] [cache file]\n");
+        return 1;
+    }
+
+    int threads = argc >= 3 ? atoi(argv[2]) : 0;
+    std::string cacheFile = argc >= 4 ? argv[3] : std::string(argv[1]) + ".textures.cache";
+
+    Map map;
+    if (!Map::Load(argv[1], map))
+        return 1;
+
+    if (FS::Init() != 0 || FS::AddDir(argv[0]) != 0)
+    {
+        fprintf(stderr, "Failed to add %s\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    for (const std::string &texture : map.textures)
+        names.push_back("textures/" + texture);
+
+    Jobs::SetThreadCount(threads);
+    Bench::Clock::time_point start = Bench::Clock::now();
+    std::vector<FS::TextureSize> headerSizes = FS::ReadTextureSizes(names);
+    double headerMs = Bench::ElapsedMs(start);
+
+    Jobs::SetThreadCount(1);
+    DecodeRun serial = DecodeAll(names);
+
+    Jobs::SetThreadCount(threads);
+    DecodeRun pooled = DecodeAll(names);
+
+    // a cold cache fills up, the warm one has everything
+    remove(cacheFile.c_str());
+    FS::TextureCache cache;
+    DecodeRun cold = DecodeAll(names, &cache);
+    start = Bench::Clock::now();
+    bool saved = cache.Save(cacheFile.c_str());
+    double saveMs = Bench::ElapsedMs(start);
+
+    start = Bench::Clock::now();
+    cache.Open(cacheFile.c_str());
+    double openMs = Bench::ElapsedMs(start);
+    DecodeRun warm = DecodeAll(names, &cache);
+
+    printf("%s: %zu textures, %zu found, %zu decoded, %.1f MB with mips\n", argv[1], names.size(), serial.found,
+           serial.decoded, serial.bytes / (1024.0 * 1024.0));
+    std::string pool = std::to_string(Jobs::ThreadCount()) + " threads";
+    PrintRun("1 thread", serial, serial.ms);
+    PrintRun(pool.c_str(), pooled, serial.ms);
+    PrintRun("cold cache", cold, serial.ms);
+    PrintRun("warm cache", warm, serial.ms);
+    printf("%-12s %10.2f ms %10.1f us per texture %8.2fx\n", "headers", headerMs,
+           headerMs * 1000.0 / std::max(names.size(), (size_t)1), serial.ms / headerMs);
+    printf("cache %s: %zu entries, %zu images, saved in %.2f ms, opened in %.3f ms\n", cacheFile.c_str(),
+           cache.EntryCount(), cache.ImageCount(), saveMs, openMs);
+
+    bool same = serial.hashes == pooled.hashes && serial.hashes == cold.hashes && serial.hashes == warm.hashes;
+    if (!same)
+        printf("IMAGES DIFFER BETWEEN THREAD COUNTS OR FROM THE CACHE\n");
+    size_t sizeMismatches = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        // a header that can't be read is 0x0, the viewer falls back then
+        bool read = headerSizes[i].width != 0;
+        sizeMismatches += read && (headerSizes[i].width != serial.sizes[i].width ||
+                                   headerSizes[i].height != serial.sizes[i].height);
+    }
+    if (sizeMismatches > 0)
+        printf("%zu HEADER SIZES DIFFER FROM THE DECODED ONES\n", sizeMismatches);
+    if (!saved)
+        printf("FAILED TO WRITE THE CACHE\n");
+
+    cache.Close();
+    FS::Close();
+    return same && saved && sizeMismatches == 0 && warm.cached == warm.decoded ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Bench.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/map.hpp"
+
+// Face UVs as they were computed before texture matrices: the projection
+// axis, rotation and scales worked out again for every vertex. Kept as the
+// reference for the output and the speed of Face::GetTextureMatrix.
+namespace Reference
+{
+    static vec2 GetStandardUV(const vec3 &vertex, const vec3 &normal, const Face *face, vec2 textureSize)
+    {
+        vec2 ret;
+
+        vec3 UP_VECTOR = vec3(0.0f, 0.0f, 1.0f);
+        vec3 RIGHT_VECTOR = vec3(0.0f, 1.0f, 0.0f);
+        vec3 FORWARD_VECTOR = vec3(1.0f, 0.0f, 1.0f);
+
+        float du = std::fabs(glm::dot(normal, UP_VECTOR));
+        float dr = std::fabs(glm::dot(normal, RIGHT_VECTOR));
+        float df = std::fabs(glm::dot(normal, FORWARD_VECTOR));
+
+        if (du >= dr && du >= df)
+            ret = vec2(vertex.x, -vertex.y);
+        else if (dr >= du && dr >= df)
+            ret = vec2(vertex.x, -vertex.z);
+        else if (df >= du && df >= dr)
+            ret = vec2(vertex.y, -vertex.z);
+
+        float angle = face->textureProjection.standard.rotation * (M_PI / 180.0f);
+        ret = vec2(ret.x * cos(angle) - ret.y * sin(angle), ret.x * sin(angle) + ret.y * cos(angle));
+
+        ret.x /= textureSize.x;
+        ret.y /= textureSize.y;
+
+        ret.x /= face->textureProjection.standard.xScale;
+        ret.y /= face->textureProjection.standard.yScale;
+
+        ret.x += face->textureProjection.standard.xOffset / textureSize.x;
+        ret.y += face->textureProjection.standard.yOffset / textureSize.y;
+
+        return ret;
+    }
+
+    static vec2 GetValve220UV(const vec3 &vertex, const Face *face, vec2 textureSize)
+    {
+        const Valve220 &projection = face->textureProjection.valve220;
+        return vec2(dot(vertex, projection.uAxis) / (textureSize.x * projection.xScale) +
+                        (projection.xOffset / textureSize.x),
+                    dot(vertex, projection.vAxis) / (textureSize.y * projection.yScale) +
+                        (projection.yOffset / textureSize.y));
+    }
+
+    // Brush primitives had no UVs before, they are checked against the q3map2
+    // formula written out per vertex
+    static vec2 GetBrushPrimitiveUV(const vec3 &vertex, const vec3 &normal, const Face *face)
+    {
+        vec3 n = normal;
+        for (int i = 0; i < 3; i++)
+        {
+            if (std::fabs(n[i]) < 1e-6f)
+                n[i] = 0.0f;
+        }
+
+        float rotY = -std::atan2(n.z, std::sqrt(n.y * n.y + n.x * n.x));
+        float rotZ = std::atan2(n.y, n.x);
+        vec3 texS(-std::sin(rotZ), std::cos(rotZ), 0.0f);
+        vec3 texT(-std::sin(rotY) * std::cos(rotZ), -std::sin(rotY) * std::sin(rotZ), -std::cos(rotY));
+
+        float s = glm::dot(vertex, texS), t = glm::dot(vertex, texT);
+        const float(*m)[3] = face->textureProjection.brushPrimitive.matrix;
+        return vec2(m[0][0] * s + m[0][1] * t + m[0][2], m[1][0] * s + m[1][1] * t + m[1][2]);
+    }
+
+    static vec2 GetUV(const Face &face, const vec3 &vertex, const vec3 &normal, vec2 textureSize)
+    {
+        if (textureSize.x == 0.0f)
+            textureSize = vec2(512.0f, 512.0f);
+
+        switch (face.projectionType)
+        {
+        case TextureProjectionType::Standard:
+            return GetStandardUV(vertex, normal, &face, textureSize);
+        case TextureProjectionType::Valve220:
+            return GetValve220UV(vertex, &face, textureSize);
+        case TextureProjectionType::BrushPrimitive:
+            return GetBrushPrimitiveUV(vertex, normal, &face);
+        default:
+            return vec2(0.0f);
+        }
+    }
+}
+
+static vec2 TextureSize(const Map &map, const Face &face)
+{
+    return face.textureId < (int)map.textureSizes.size() ? map.textureSizes[face.textureId] : vec2(0.0f);
+}
+
+// UVs of every face index in map order, the old way and the batched way
+static void ReferenceUVs(const Map &map, std::vector<vec2> &uvs)
+{
+    uvs.resize(map.faceIndices.size());
+    for (const Face &face : map.faces)
+    {
+        vec3 normal = map.GetNormal(face);
+        vec2 size = TextureSize(map, face);
+        for (int i = 0; i < face.indexCount; i++)
+            uvs[face.firstIndex + i] = Reference::GetUV(face, map.vertices[map.faceIndices[face.firstIndex + i]], normal, size);
+    }
+}
+
+static void BatchedUVs(const Map &map, std::vector<vec2> &uvs)
+{
+    uvs.resize(map.faceIndices.size());
+    for (const Face &face : map.faces)
+    {
+        face.GetTextureMatrix(map.GetNormal(face), TextureSize(map, face))
+            .Apply(map.vertices.data(), map.faceIndices.data() + face.firstIndex, face.indexCount,
+                   uvs.data() + face.firstIndex);
+    }
+}
+
+// Compares the per vertex and the batched face UVs and their throughput on
+// one thread. They only differ by float rounding, the matrix folds the
+// scales and the rotation into one multiply-add per coordinate.
+int Bench::RunUVs(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: uvs <mapfile> [iterations]\n");
+        return 1;
+    }
+
+    int iterations = argc >= 2 ? atoi(argv[1]) : 5;
+    if (iterations < 1)
+        iterations = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    Jobs::SetThreadCount(1);
+    map.CalculateGeometry();
+
+    int projections[3] = {};
+    for (const Face &face : map.faces)
+        projections[(int)face.projectionType]++;
+    printf("%s: %zu faces (%d standard, %d valve220, %d brush primitive), %zu face vertices, best of %d\n", argv[0],
+           map.faces.size(), projections[0], projections[1], projections[2], map.faceIndices.size(), iterations);
+
+    std::vector<vec2> reference, batched;
+    double bestReference = 1e30, bestBatched = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        Bench::Clock::time_point start = Bench::Clock::now();
+        ReferenceUVs(map, reference);
+        bestReference = std::min(bestReference, Bench::ElapsedMs(start));
+
+        start = Bench::Clock::now();
+        BatchedUVs(map, batched);
+        bestBatched = std::min(bestBatched, Bench::ElapsedMs(start));
+    }
+
+    double vertices = (double)map.faceIndices.size();
+    printf("%-12s %10.2f ms %12.0f UVs/s\n", "reference", bestReference, vertices / (bestReference / 1000.0));
+    printf("%-12s %10.2f ms %12.0f UVs/s %6.1fx\n", "batched", bestBatched, vertices / (bestBatched / 1000.0),
+           bestReference / bestBatched);
+
+    // a few float roundings of the larger UVs
+    float maxDifference = 0.0f, maxRelative = 0.0f;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            float difference = std::fabs(reference[i][k] - batched[i][k]);
+            maxDifference = std::max(maxDifference, difference);
+            maxRelative = std::max(maxRelative, difference / std::max(1.0f, std::fabs(reference[i][k])));
+        }
+    }
+
+    bool same = maxRelative < 1e-5f;
+    printf("max UV difference %g, %g relative to the UV%s\n", maxDifference, maxRelative,
+           same ? "" : ": DIFFERS FROM THE REFERENCE");
+    return same ? 0 : 1;
+}
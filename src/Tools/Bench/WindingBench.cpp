@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "Bench.hpp"
+#include "Jobs/Jobs.hpp"
+#include "MapFormat/map.hpp"
+
+// The brush winding code as it was before windings moved to the stack, one
+// heap allocated polygon per clip. Kept as the reference for the output
+// and the speed of Brush::CalculateGeometry.
+namespace Reference
+{
+    static std::vector<vec3> WindingForFace(const vec3 &n, float d, float large = 8192.0f)
+    {
+        vec3 up = (fabs(n.z) < 0.9f ? vec3(0, 0, 1) : vec3(1, 0, 0));
+        vec3 u = glm::normalize(glm::cross(up, n));
+        vec3 v = glm::cross(n, u);
+        vec3 origin = n * d;
+
+        std::vector<vec3> w(4);
+        w[0] = origin + (u + v) * large;
+        w[1] = origin + (-u + v) * large;
+        w[2] = origin + (-u + -v) * large;
+        w[3] = origin + (u + -v) * large;
+        return w;
+    }
+
+    static std::vector<vec3> ClipToPlane(const std::vector<vec3> &in, const vec3 &clipN, float clipD,
+                                         float eps = 1e-3f)
+    {
+        std::vector<vec3> out;
+        auto side = [&](const vec3 &p) { return glm::dot(clipN, p) - clipD; };
+        for (size_t i = 0, n = in.size(); i < n; ++i)
+        {
+            const vec3 &P = in[i];
+            const vec3 &Q = in[(i + 1) % n];
+            float sP = side(P), sQ = side(Q);
+            if (sP >= -eps)
+                out.push_back(P);
+            if ((sP > 0) != (sQ > 0))
+            {
+                float t = sP / (sP - sQ);
+                out.push_back(P + t * (Q - P));
+            }
+        }
+        return out;
+    }
+
+    // Same output layout as Brush::CalculateGeometry, faceRanges gets the
+    // first index and count of every face
+    static void CalculateGeometry(const Map &map, const Brush &brush, std::vector<vec3> &vertices,
+                                  std::vector<int> &indices, std::vector<int> &faceRanges)
+    {
+        const PlaneTable &planes = map.planes;
+        Span<const Face> faces = map.GetFaces(brush);
+        size_t firstVertex = vertices.size();
+
+        for (const Face &face : faces)
+        {
+            vec3 normal = planes.Normal(face.plane);
+            auto poly = WindingForFace(normal, planes.Distance(face.plane));
+
+            for (const Face &other : faces)
+                if (other.plane != face.plane)
+                    poly = ClipToPlane(poly, planes.Normal(other.plane), planes.Distance(other.plane));
+
+            int firstIndex = (int)indices.size();
+            for (auto &p : poly)
+            {
+                auto it = std::find_if(vertices.begin() + firstVertex, vertices.end(),
+                                       [&](const vec3 &v) { return glm::length(v - p) < 1e-3f; });
+                if (it == vertices.end())
+                {
+                    indices.push_back((int)vertices.size());
+                    vertices.push_back(p);
+                }
+                else
+                {
+                    indices.push_back((int)std::distance(vertices.begin(), it));
+                }
+            }
+
+            int indexCount = (int)indices.size() - firstIndex;
+            if (indexCount >= 3)
+            {
+                int *winding = &indices[firstIndex];
+                vec3 windingNormal = glm::normalize(glm::cross(vertices[winding[1]] - vertices[winding[0]],
+                                                               vertices[winding[2]] - vertices[winding[0]]));
+                if (glm::dot(windingNormal, normal) > 0.0f)
+                    std::reverse(winding, winding + indexCount);
+            }
+
+            faceRanges.push_back(firstIndex);
+            faceRanges.push_back(indexCount);
+        }
+    }
+}
+
+// Brush geometry from the reference, compared bit for bit with the map's
+static bool CompareWithReference(const Map &map)
+{
+    std::vector<vec3> vertices;
+    std::vector<int> indices, faceRanges;
+    for (const Brush &brush : map.brushes)
+        Reference::CalculateGeometry(map, brush, vertices, indices, faceRanges);
+
+    std::vector<int> mapRanges;
+    for (const Face &face : map.faces)
+    {
+        mapRanges.push_back(face.firstIndex);
+        mapRanges.push_back(face.indexCount);
+    }
+
+    bool same = vertices.size() == map.vertices.size() && indices == map.faceIndices && faceRanges == mapRanges &&
+                memcmp(vertices.data(), map.vertices.data(), vertices.size() * sizeof(vec3)) == 0;
+
+    printf("%zu vertices, %zu indices: %s\n", map.vertices.size(), map.faceIndices.size(),
+           same ? "same as the reference" : "DIFFERS FROM THE REFERENCE");
+    return same;
+}
+
+// Adds a brush shaped like a cylinder with the given number of sides. Its
+// caps get one point per side, more than a winding keeps on the stack once
+// there are enough sides.
+static void AddCylinder(Map &map, int sides, float radius, float height, vec3 origin)
+{
+    int entity = (int)map.entities.size();
+    map.entities.emplace_back(entity);
+    map.entities.back().firstBrush = (int)map.brushes.size();
+    map.entities.back().brushCount = 1;
+
+    int brush = (int)map.brushes.size();
+    map.brushes.emplace_back(brush, entity, (int)map.faces.size());
+    int texture = map.InternTexture("common/caulk");
+
+    // three points per face, wound so the planes face into the brush
+    auto addFace = [&](vec3 p1, vec3 p2, vec3 p3)
+    {
+        Face &face = map.faces.emplace_back(brush);
+        face.p1 = origin + p1;
+        face.p2 = origin + p2;
+        face.p3 = origin + p3;
+        face.textureId = texture;
+        face.projectionType = TextureProjectionType::Standard;
+        face.textureProjection.standard = {0.5f, 0.5f, 0.0f, 0.0f, 0.0f};
+        map.brushes[brush].faceCount++;
+    };
+
+    for (int i = 0; i < sides; i++)
+    {
+        float angle = 6.2831853f * i / sides;
+        vec3 out(cosf(angle), sinf(angle), 0.0f);
+        vec3 along(-out.y, out.x, 0.0f);
+        vec3 p = out * radius;
+        addFace(p, p + vec3(0, 0, 1), p + along);
+    }
+    addFace(vec3(0, 0, height), vec3(0, 1, height), vec3(1, 0, height));
+    addFace(vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0));
+}
+
+// Cylinders from ordinary to more sides than the stack windings hold,
+// compared with the reference so no cap goes missing
+static bool CompareCylinders()
+{
+    static const int sideCounts[] = {32, 64, 128, 255, 256, 300, 512};
+
+    Map map;
+    float x = 0.0f;
+    for (int sides : sideCounts)
+    {
+        AddCylinder(map, sides, 256.0f, 128.0f, vec3(x, 0.0f, 0.0f));
+        x += 1024.0f;
+    }
+    map.CalculateGeometry();
+
+    printf("cylinders of %d to %d sides: ", sideCounts[0], sideCounts[sizeof(sideCounts) / sizeof(sideCounts[0]) - 1]);
+    bool same = CompareWithReference(map);
+
+    for (const Brush &brush : map.brushes)
+    {
+        // both caps are the last two faces and need a point per side
+        Span<Face> faces = map.GetFaces(brush);
+        for (size_t i = faces.size - 2; i < faces.size; i++)
+        {
+            if (faces[i].indexCount < (int)faces.size - 2)
+            {
+                printf("cap of the %zu sided cylinder has %d points\n", faces.size - 2, faces[i].indexCount);
+                same = false;
+            }
+        }
+    }
+    return same;
+}
+
+static void PrintRate(const char *label, double ms, size_t allocations, size_t brushes)
+{
+    printf("%-12s %10.2f ms %12.0f brushes/s %8.2f allocs per brush\n", label, ms, brushes / (ms / 1000.0),
+           (double)allocations / brushes);
+}
+
+// Checks Brush::CalculateGeometry against the old heap based clipping and
+// compares their throughput on one thread, then checks high sided cylinders
+int Bench::RunWinding(int argc, char **argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "Usage: winding <mapfile> [iterations]\n");
+        return 1;
+    }
+
+    int iterations = argc >= 2 ? atoi(argv[1]) : 3;
+    if (iterations < 1)
+        iterations = 1;
+
+    Map map;
+    if (!Map::Load(argv[0], map))
+        return 1;
+
+    Jobs::SetThreadCount(1);
+    printf("%s: %zu brushes, %zu faces, best of %d\n", argv[0], map.brushes.size(), map.faces.size(), iterations);
+
+    double bestReference = 1e30, bestCurrent = 1e30;
+    size_t referenceAllocations = 0, currentAllocations = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        std::vector<vec3> vertices;
+        std::vector<int> indices, faceRanges;
+
+        size_t allocStart = Bench::AllocationCount();
+        Bench::Clock::time_point start = Bench::Clock::now();
+        for (const Brush &brush : map.brushes)
+            Reference::CalculateGeometry(map, brush, vertices, indices, faceRanges);
+        bestReference = std::min(bestReference, Bench::ElapsedMs(start));
+        referenceAllocations = Bench::AllocationCount() - allocStart;
+
+        map.vertices.clear();
+        map.faceIndices.clear();
+
+        allocStart = Bench::AllocationCount();
+        start = Bench::Clock::now();
+        for (Brush &brush : map.brushes)
+            brush.CalculateGeometry(map);
+        bestCurrent = std::min(bestCurrent, Bench::ElapsedMs(start));
+        currentAllocations = Bench::AllocationCount() - allocStart;
+    }
+
+    PrintRate("reference", bestReference, referenceAllocations, map.brushes.size());
+    PrintRate("current", bestCurrent, currentAllocations, map.brushes.size());
+
+    bool same = CompareWithReference(map);
+    same &= CompareCylinders();
+    return same ? 0 : 1;
+}
@@ -1,145 +1,100 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <raylib.h>
 #include "FS/FS.hpp"
-#include "MapFormat/Map.hpp"
-
-// helper to convert your vec3 -> raylib Vector3, with your 30-unit scale & axis swap
-static Vector3 ToRay(const vec3 &v) {
-    return { v.x/30.0f,  v.z/30.0f,  -v.y/30.0f };
-}
+#include "FS/TextureCache.hpp"
+#include "FS/TextureLoader.hpp"
+#include "MapFormat/CompiledMap.hpp"
+#include "Scene/Scene.hpp"
+#include "Scene/PatchLod.hpp"
+#include "Scene/Culling.hpp"
 
 #define Deg2Rad(degrees) degrees * (M_PI / 180.0f)
 
-Mesh GenMeshPolyhedron(int vertexCount, Vector3 *vertices, Vector2 *uvs, Vector3 normal)
-{
-    Mesh mesh = { 0 };
+// Patch tessellation may be off the surface by this many pixels on screen
+static const float MAX_PATCH_PIXEL_ERROR = 1.0f;
 
-    if (vertexCount < 3) return mesh;  // need at least a triangle
+// Meshes are culled in clusters of about this many map units
+static const float CLUSTER_SIZE = 1024.0f;
 
-    int triCount = vertexCount - 2;
-    mesh.vertexCount   = vertexCount;
-    mesh.triangleCount = triCount;
+// rlgl's RL_CULL_DISTANCE_NEAR and RL_CULL_DISTANCE_FAR, what BeginMode3D projects with
+static const float CAMERA_NEAR = 0.01f;
+static const float CAMERA_FAR = 1000.0f;
 
-    // allocate CPU arrays
-    mesh.vertices  = (float *)RL_MALLOC(sizeof(float)*3*vertexCount);
-    mesh.normals   = (float *)RL_MALLOC(sizeof(float)*3*vertexCount);
-    mesh.texcoords = (float *)RL_MALLOC(sizeof(float)*2*vertexCount);
-    mesh.indices   = (unsigned short *)RL_MALLOC(sizeof(unsigned short)*3*triCount);
+// Decoded and mipmapped textures are kept here between runs
+static const char *TEXTURE_CACHE_FILE = "textures.cache";
 
-    // fill vertex positions, normals & UVs
-    for (int i = 0; i < vertexCount; i++)
-    {
-        // positions
-        mesh.vertices[3*i + 0] = vertices[i].x;
-        mesh.vertices[3*i + 1] = vertices[i].y;
-        mesh.vertices[3*i + 2] = vertices[i].z;
-
-        // all vertices share the same face normal
-        mesh.normals[3*i + 0] = normal.x;
-        mesh.normals[3*i + 1] = normal.y;
-        mesh.normals[3*i + 2] = normal.z;
-
-        // UVs
-        mesh.texcoords[2*i + 0] = uvs[i].x;
-        mesh.texcoords[2*i + 1] = uvs[i].y;
-    }
+// Where every file of the game directory's pk3s is, rebuilt when one of them changes
+static const char *FILE_INDEX_FILE = "files.index";
 
-    // build a simple triangle‐fan
-    for (int i = 0; i < triCount; i++)
-    {
-        mesh.indices[3*i + 0] = 0;
-        mesh.indices[3*i + 1] = i + 1;
-        mesh.indices[3*i + 2] = i + 2;
-    }
+// Time per frame spent on textures while they stream in. Decoding only
+// happens on this thread when the job pool has no threads of its own.
+static const double TEXTURE_DECODE_BUDGET_MS = 2.0;
+static const double TEXTURE_UPLOAD_BUDGET_MS = 2.0;
 
-    // upload to GPU (static)
-    UploadMesh(&mesh, false);
+using Clock = std::chrono::steady_clock;
 
-    return mesh;
+static double ElapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
 }
 
-Mesh GenMeshFromPatch(const std::vector<std::vector<PatchVert>>& patchVerts)
+// A model and the texture it's drawn with, looked up when it's drawn so
+// textures can stream in without touching the models
+struct TexturedModel
 {
-    Mesh mesh = { 0 };
-
-    int rows = (int)patchVerts.size();
-    if (rows < 2) return mesh;        // need at least one quad
-    int cols = (int)patchVerts[0].size();
-    if (cols < 2) return mesh;
-
-    int vCount  = rows * cols;
-    int tCount  = (rows - 1) * (cols - 1) * 2;
-
-    mesh.vertexCount   = vCount;
-    mesh.triangleCount = tCount;
-
-    // allocate your arrays
-    mesh.vertices  = (float *)RL_MALLOC(sizeof(float)*3*vCount);
-    mesh.normals   = (float *)RL_MALLOC(sizeof(float)*3*vCount);
-    mesh.texcoords = (float *)RL_MALLOC(sizeof(float)*2*vCount);
-    mesh.indices   = (unsigned short *)RL_MALLOC(sizeof(unsigned short)*3*tCount);
+    Model model;
+    int textureId;
+};
 
-    // fill vertex data
-    int vid = 0;
-    for (int i = 0; i < rows; i++)
-    {
-        for (int j = 0; j < cols; j++)
-        {
-            const PatchVert &pv = patchVerts[i][j];
+// Copies CPU mesh data into a raylib mesh and uploads it to the GPU. The
+// mesh can have up to Scene::MAX_MESH_VERTICES, raylib's indices are 16 bit.
+Mesh UploadMeshData(const Scene::MeshData &data)
+{
+    Mesh mesh = { 0 };
 
-            // correct conversion & scale
-            Vector3 p = ToRay(pv.position);
-            vec3 _n = (pv.normal);
-            Vector3 n = { _n.x, _n.z, -_n.y };
+    mesh.vertexCount   = data.VertexCount();
+    mesh.triangleCount = data.TriangleCount();
 
-            mesh.vertices[3*vid + 0]  = p.x;
-            mesh.vertices[3*vid + 1]  = p.y;
-            mesh.vertices[3*vid + 2]  = p.z;
+    mesh.vertices  = (float *)RL_MALLOC(sizeof(float)*data.vertices.size());
+    mesh.normals   = (float *)RL_MALLOC(sizeof(float)*data.normals.size());
+    mesh.texcoords = (float *)RL_MALLOC(sizeof(float)*data.texcoords.size());
+    mesh.indices   = (unsigned short *)RL_MALLOC(sizeof(unsigned short)*data.indices.size());
 
-            mesh.normals[3*vid + 0]   = n.x;
-            mesh.normals[3*vid + 1]   = n.y;
-            mesh.normals[3*vid + 2]   = n.z;
+    memcpy(mesh.vertices,  data.vertices.data(),  sizeof(float)*data.vertices.size());
+    memcpy(mesh.normals,   data.normals.data(),   sizeof(float)*data.normals.size());
+    memcpy(mesh.texcoords, data.texcoords.data(), sizeof(float)*data.texcoords.size());
+    for (size_t i = 0; i < data.indices.size(); i++) mesh.indices[i] = (unsigned short)data.indices[i];
 
-            mesh.texcoords[2*vid + 0] = pv.uv.x;
-            mesh.texcoords[2*vid + 1] = pv.uv.y;
+    // upload to GPU (static)
+    UploadMesh(&mesh, false);
 
-            vid++;
-        }
-    }
+    return mesh;
+}
 
-    // build two tris per quad
-    int idx = 0;
-    for (int i = 0; i < rows - 1; i++)
-    {
-        for (int j = 0; j < cols - 1; j++)
-        {
-            int topLeft     = i*cols + j;
-            int bottomLeft  = (i+1)*cols + j;
-            int topRight    = topLeft + 1;
-            int bottomRight = bottomLeft + 1;
-
-            // tri A
-            mesh.indices[3*idx + 0] = topLeft;
-            mesh.indices[3*idx + 1] = bottomLeft;
-            mesh.indices[3*idx + 2] = topRight;
-            idx++;
-
-            // tri B
-            mesh.indices[3*idx + 0] = topRight;
-            mesh.indices[3*idx + 1] = bottomLeft;
-            mesh.indices[3*idx + 2] = bottomRight;
-            idx++;
-        }
+// One model per mesh, drawn with the mesh's texture
+std::vector<TexturedModel> UploadModels(const std::vector<Scene::MeshData> &meshes)
+{
+    std::vector<TexturedModel> models;
+    for (const auto &data : meshes) {
+        models.push_back({ LoadModelFromMesh(UploadMeshData(data)), data.textureId });
     }
+    return models;
+}
 
-    // upload to GPU
-    UploadMesh(&mesh, false);
-    return mesh;
+void DrawTexturedModel(TexturedModel &model, const std::vector<Texture2D> &textures)
+{
+    model.model.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = textures[model.textureId];
+    DrawModel(model.model, { 0.0f, 0.0f, 0.0f }, 1.0f, WHITE);
 }
 
 int main(int argc, char **argv)
 {
+    Clock::time_point startTime = Clock::now();
+
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <mapfile>\n", argv[0]);
         return 1;
@@ -152,14 +107,16 @@ int main(int argc, char **argv)
     }
 
     // replace this line with your own path to the Quake 3 Arena baseq3 directory
-    if (FS::AddDir("E:/Games/Steam/steamapps/common/Quake 3 Arena/baseq3") != 0)
+    if (FS::AddDir("E:/Games/Steam/steamapps/common/Quake 3 Arena/baseq3", FILE_INDEX_FILE) != 0)
     {
         fprintf(stderr, "Failed to add directory.\n");
         return 1;
     }
 
-    Map map;
-    if (!Map::Load(argv[1], map)) {
+    // the compiled map is cached next to the source and rebuilt when the source changes
+    std::string cacheFile = std::string(argv[1]) + ".cache";
+    CompiledMap map;
+    if (!CompiledMap::Load(argv[1], cacheFile.c_str(), map)) {
         fprintf(stderr, "Failed to load map.\n");
         return 1;
     }
@@ -176,16 +133,17 @@ int main(int argc, char **argv)
     };
 
     bool foundPlayerStart = false;
-    for (auto &e : map.entities) {
-        if (e.properties["classname"] == "info_player_deathmatch" && !foundPlayerStart)
+    for (auto &e : map.Entities()) {
+        if (map.GetProperty(e, "classname") == "info_player_deathmatch" && !foundPlayerStart)
         {
             if (GetRandomValue(0, 10) == 5) foundPlayerStart = true;
 
 
             vec3 pos = { 0.0f, 0.0f, 0.0f };
-            if (e.properties.find("origin") != e.properties.end())
+            std::string origin(map.GetProperty(e, "origin"));
+            if (!origin.empty())
             {
-                sscanf(e.properties["origin"].c_str(), "%f %f %f", &pos.x, &pos.y, &pos.z);
+                sscanf(origin.c_str(), "%f %f %f", &pos.x, &pos.y, &pos.z);
             }
 
             // set camera position
@@ -193,96 +151,103 @@ int main(int argc, char **argv)
 
             // get player start angle
             float angle = 0.0f;
-            if (e.properties.find("angle") != e.properties.end())
+            std::string angleValue(map.GetProperty(e, "angle"));
+            if (!angleValue.empty())
             {
-                angle = std::stof(e.properties["angle"]);
+                angle = std::stof(angleValue);
                 angle = fmodf(angle, 360.0f);
             }
 
             // set camera target
             camera.target = { pos.x/30.0f + cosf(Deg2Rad(angle)), pos.z/30.0f, -pos.y/30.0f - sinf(Deg2Rad(angle)) };
         }
-
-        for (auto &b : e.brushes)    b.CalculateGeometry();
-        for (auto &p : e.patches)    p.CalculateGeometry();
     }
 
     Image defaultImage = GenImageChecked(1024, 1024, 1, 1, PURPLE, BLACK);
     Texture2D defaultTexture = LoadTextureFromImage(defaultImage);
     UnloadImage(defaultImage);
 
-    // load textures
-    std::unordered_map<std::string, Texture2D> textures;
-
-    for (auto &tex: map.textureSizes) {
-        // load texture
-        std::string texName = "textures/" + tex.first;
-        Texture2D texture;
+    // indexed by texture ID, everything is drawn with the default texture
+    // until its own one has streamed in
+    std::vector<Texture2D> textures(map.Textures().size, defaultTexture);
+    std::vector<std::string> textureNames;
+    for (uint32_t id = 0; id < map.Textures().size; id++) {
+        textureNames.push_back("textures/" + std::string(map.TextureName(id)));
+    }
 
-        if (FS::Exists((texName + ".tga").c_str()))
-        {
-            texture = FS::LoadTexture((texName + ".tga").c_str());
-        }
-        else if (FS::Exists((texName + ".jpg").c_str()))
-        {
-            texture = FS::LoadTexture((texName + ".jpg").c_str());
-        }
-        else if (FS::Exists((texName + ".png").c_str()))
-        {
-            texture = FS::LoadTexture((texName + ".png").c_str());
-        }
-        else
-        {
-            texture = defaultTexture;
-        }
+    // UVs only need the sizes, they're read from the file headers
+    std::vector<vec2> textureSizes;
+    for (const FS::TextureSize &size : FS::ReadTextureSizes(textureNames)) {
+        textureSizes.push_back({ (float)size.width, (float)size.height });
+    }
 
-        textures[tex.first] = texture;
+    // meshes are built on the CPU first, only the upload needs the window.
+    // Face meshes come first, then one per patch, which is also the order
+    // of the clusters' items.
+    std::vector<Scene::MeshData> meshes = Scene::BuildMeshes(map, textureSizes, false);
+    int faceCount = (int)meshes.size();
+    std::vector<AABB> bounds;
+    for (const auto &data : meshes) {
+        bounds.push_back(Scene::MeshBounds(data));
+    }
 
-        if (texture.width != 0 && texture.height != 0)
-        {
-            map.textureSizes[tex.first] = {(float)texture.width, (float)texture.height};
-        }
+    // patches keep all their levels, their meshes are rebuilt when the
+    // patch's level or a neighbour's changes
+    Scene::PatchLod patchLod;
+    for (const CompiledPatch &patch : map.Patches()) {
+        patchLod.AddPatch(&map.PatchVerts()[patch.firstControlPoint], patch.width, patch.height, (int)patch.texture);
     }
+    patchLod.Finish();
 
-    std::vector<Model> models;
+    meshes.resize(faceCount + patchLod.PatchCount());
+    for (int p = 0; p < patchLod.PatchCount(); p++) {
+        bounds.push_back(Scene::ToViewSpace(patchLod.Bounds(p)));
+    }
 
-    for (auto &e : map.entities) {
-        for (auto &b : e.brushes) {
-            for (auto &f : b.faces)
-            {
-                // skip if texture name starts with common/
-                if (f.texture.find("common/") == 0) continue;
-
-                Vector3 verts[f.vertices.size()];
-                Vector2 uvs[f.vertices.size()];
-                vec3 n = f.GetNormal();
-                Vector3 normal = { n.x, n.z, -n.y };
-                f.textureSize = map.textureSizes[f.texture];
-                
-                for (size_t i = 0; i < f.vertices.size(); ++i)
-                {
-                    Vector3 vert = ToRay(f.parentBrush->vertices[f.vertices[i]]);
-                    vec2 uv = f.GetUV(f.parentBrush->vertices[f.vertices[i]]);
-                    verts[i] = { vert.x, vert.y, vert.z };
-                    uvs[i]   = { uv.x, uv.y };
-                }
+    Scene::ClusterCuller culler;
+    culler.Build(bounds, CLUSTER_SIZE / 30.0f);
+
+    // the faces and patches of a cluster are merged by texture, a cluster
+    // takes one draw call per texture. Clusters are uploaded on the first
+    // frame once the patch levels are picked, and again when a patch in
+    // them changes level.
+    std::vector<std::vector<TexturedModel>> clusterModels(culler.ClusterCount());
+    std::vector<bool> clusterDirty(culler.ClusterCount(), true);
+    std::vector<bool> clusterHasPatches(culler.ClusterCount(), false);
+    std::vector<int> itemCluster(meshes.size(), -1);
+    for (int c = 0; c < culler.ClusterCount(); c++) {
+        for (int item : culler.Items(c)) {
+            itemCluster[item] = c;
+            if (item >= faceCount) clusterHasPatches[c] = true;
+        }
+    }
 
-                Mesh mesh = GenMeshPolyhedron(f.vertices.size(), verts, uvs, normal);
-                Model model = LoadModelFromMesh(mesh);
-                model.materialCount = 1;
-                model.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = textures[f.texture];
-                models.push_back(model);
-            }
+    // faces and patches of every cluster by texture, the textures used by
+    // the most visible ones are streamed in first
+    std::vector<std::vector<std::pair<int, int>>> clusterTextureUses(culler.ClusterCount());
+    std::vector<int> uses(textures.size(), 0);
+    for (int c = 0; c < culler.ClusterCount(); c++) {
+        for (int item : culler.Items(c)) {
+            int textureId = item < faceCount ? meshes[item].textureId : (int)map.Patches()[item - faceCount].texture;
+            uses[textureId]++;
         }
-        for (auto &p : e.patches) {
-            Mesh mesh = GenMeshFromPatch(p.vertices);
-            Model model = LoadModelFromMesh(mesh);
-            model.materialCount = 1;
-            model.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = textures[p.texture];
-            models.push_back(model);
+        for (int t = 0; t < (int)uses.size(); t++) {
+            if (uses[t] > 0) clusterTextureUses[c].push_back({ t, uses[t] });
+            uses[t] = 0;
         }
     }
 
+    FS::TextureCache textureCache;
+    textureCache.Open(TEXTURE_CACHE_FILE);
+
+    // textures are read and decoded on the job pool unless the cache has
+    // them, the frames only upload them as they finish
+    FS::TextureLoader textureLoader;
+    textureLoader.Start(textureNames, &textureCache);
+    size_t streamedTextures = 0;
+    std::vector<float> texturePriorities(textures.size());
+    bool firstFrame = true;
+
     bool disableCursor = false;
     std::vector<Color> FACE_COLORS = {
             LIGHTGRAY, GRAY, DARKGRAY, YELLOW, GOLD, ORANGE, PINK, RED, MAROON, GREEN, LIME,
@@ -305,21 +270,100 @@ int main(int argc, char **argv)
         if (disableCursor)
             SetMousePosition(GetScreenWidth() / 2, GetScreenHeight() / 2);
 
+        vec3 eye = Scene::FromViewSpace({ camera.position.x, camera.position.y, camera.position.z });
+        for (int p : patchLod.Select(eye, (float)(Deg2Rad(camera.fovy)), (float)GetScreenHeight(), MAX_PATCH_PIXEL_ERROR)) {
+            int item = faceCount + p;
+            meshes[item] = patchLod.BuildMesh(p);
+            if (itemCluster[item] >= 0) clusterDirty[itemCluster[item]] = true;
+        }
+
+        for (int c = 0; c < culler.ClusterCount(); c++) {
+            if (!clusterDirty[c]) continue;
+
+            for (auto &m : clusterModels[c]) UnloadModel(m.model);
+            clusterModels[c] = UploadModels(Scene::BatchMeshes(meshes, culler.Items(c)));
+            clusterDirty[c] = false;
+
+            // a cluster without patches is never rebuilt, its faces can go
+            if (!clusterHasPatches[c]) {
+                for (int item : culler.Items(c)) meshes[item] = Scene::MeshData();
+            }
+        }
+
         BeginDrawing();
         ClearBackground(RAYWHITE);
 
+        Scene::Frustum frustum = Scene::Frustum::FromCamera(
+            { camera.position.x, camera.position.y, camera.position.z },
+            { camera.target.x, camera.target.y, camera.target.z },
+            { camera.up.x, camera.up.y, camera.up.z },
+            camera.fovy, (float)GetScreenWidth() / (float)GetScreenHeight(), CAMERA_NEAR, CAMERA_FAR);
+
+        const std::vector<int> &visible = culler.Cull(frustum);
+
+        if (streamedTextures < textures.size()) {
+            std::fill(texturePriorities.begin(), texturePriorities.end(), 0.0f);
+            for (int c : visible) {
+                for (auto &use : clusterTextureUses[c]) texturePriorities[use.first] += (float)use.second;
+            }
+            textureLoader.Prioritize(texturePriorities);
+
+            // without pool threads the decoding happens here too, it has its
+            // own budget so it can't starve the uploads
+            textureLoader.Pump(TEXTURE_DECODE_BUDGET_MS);
+
+            // at least one upload per frame so finished images don't pile up
+            Clock::time_point uploadStart = Clock::now();
+            FS::DecodedTexture decoded;
+            for (bool first = true; (first || ElapsedMs(uploadStart) < TEXTURE_UPLOAD_BUDGET_MS) && textureLoader.TryNext(decoded); first = false) {
+                streamedTextures++;
+
+                // missing textures keep the default one
+                if (decoded.image.data == nullptr) continue;
+
+                Texture2D texture = LoadTextureFromImage(decoded.image);
+                decoded.Unload();
+
+                if (texture.width != 0 && texture.height != 0) textures[decoded.id] = texture;
+            }
+
+            if (streamedTextures == textures.size()) {
+                printf("All %zu textures in after %.1f ms\n", textures.size(), ElapsedMs(startTime));
+
+                if (textureCache.AddedCount() > 0 && !textureCache.Save(TEXTURE_CACHE_FILE)) {
+                    fprintf(stderr, "Failed to write texture cache %s\n", TEXTURE_CACHE_FILE);
+                }
+            }
+        }
+
+        int drawCalls = 0;
         BeginMode3D(camera);
-            for (auto &model : models) {
-                DrawModel(model, { 0.0f, 0.0f, 0.0f }, 1.0f, WHITE);
+            for (int c : visible) {
+                for (auto &model : clusterModels[c]) {
+                    DrawTexturedModel(model, textures);
+                    drawCalls++;
+                }
             }
         EndMode3D();
 
+        DrawText(TextFormat("%d / %d clusters, %d / %d meshes, %d draw calls, %d / %d textures", culler.VisibleCount(),
+                            culler.ClusterCount(), culler.VisibleItemCount(), culler.ItemCount(), drawCalls,
+                            (int)streamedTextures, (int)textures.size()),
+                 10, 10, 20, DARKGRAY);
+
         EndDrawing();
+
+        if (firstFrame) {
+            printf("First frame after %.1f ms, %zu / %zu textures in\n", ElapsedMs(startTime), streamedTextures, textures.size());
+            firstFrame = false;
+        }
     }
 
+    // decodes still running read through the file system
+    textureLoader.Cancel();
     FS::Close();
-    for (auto &m : models)   UnloadModel(m);
-    for (auto &kv: textures) UnloadTexture(kv.second);
+    for (auto &models : clusterModels) for (auto &m : models) UnloadModel(m.model);
+    for (auto &t : textures) if (t.id != defaultTexture.id) UnloadTexture(t);
     UnloadTexture(defaultTexture);
 
     CloseWindow();